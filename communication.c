@@ -2,17 +2,54 @@
 #include "communication.h"
 #include "state.h"
 #include "servers-coopgamma.h"
+#include "types-stats.h"
 
 #include <sys/socket.h>
 #include <errno.h>
+#include <limits.h>
 #include <string.h>
 
 
+#ifndef IOV_MAX
+# define IOV_MAX _XOPEN_IOV_MAX
+#endif
+
+#ifndef SUBSCRIBER_LAG_MARK
+/**
+ * The number of bytes that may be queued for a
+ * client before events reported to it are coalesced
+ */
+# define SUBSCRIBER_LAG_MARK (1 << 16)
+#endif
+
+
+/**
+ * The beginning of a message reporting coalesced
+ * events, it is followed by the list of events
+ */
+#define COALESCED_EVENT_HEADERS\
+	"Command: event\n"\
+	"Coalesced: yes\n"\
+	"Event: "
+
+
+/**
+ * Has `notify_subscribers` queued or coalesced
+ * any event that `send_events` has not handled?
+ */
+static int events_pending = 0;
+
+
 /**
  * Send a message
  * 
+ * The message is queued, and all queued messages
+ * are sent with as few system calls as possible
+ * 
  * @param   conn  The index of the connection
- * @param   buf   The data to send
+ * @param   buf   The data to send, allocated with `pool_alloc`,
+ *                the function takes over the ownership of it,
+ *                `NULL` to only send already queued messages
  * @param   n     The size of `buf`
  * @return        Zero on success, -1 on error, 1 if disconncted
  *                EINTR, EAGAIN, EWOULDBLOCK, and ECONNRESET count
@@ -24,82 +61,53 @@ send_message(size_t conn, char *restrict buf, size_t n)
 {
 	struct ring *restrict ring = outbound + conn;
 	int fd = connections[conn];
-	int saved_errno;
-	size_t ptr = 0;
+	struct msghdr msg;
 	ssize_t sent;
-	size_t chunksize = n;
-	size_t sendsize;
-	size_t old_n;
-	char *old_buf;
-	size_t old_ptr;
-
-	while ((old_buf = ring_peek(ring, &old_n))) {
-		for (old_ptr = 0; old_ptr < n;) {
-			sendsize = old_n - old_ptr < chunksize ? old_n - old_ptr : chunksize;
-			sent = send(fd, old_buf + old_ptr, sendsize, MSG_NOSIGNAL);
-			if (sent < 0) {
-				if (errno == EPIPE)
-					errno = ECONNRESET;
-				if (errno != EMSGSIZE)
-					goto fail;
-				chunksize >>= 1;
-				if (!chunksize)
-					goto fail;
-				continue;
-			}
-			old_ptr += (size_t)sent;
-			ring_pop(ring, (size_t)sent);
-		}
+	size_t count;
+
+	if (buf && ring_push(ring, buf, n) < 0) {
+		pool_free(buf);
+		return -1;
 	}
 
-	while (ptr < n) {
-		sendsize = n - ptr < chunksize ? n - ptr : chunksize;
-		sent = send(fd, buf + ptr, sendsize, MSG_NOSIGNAL);
+	memset(&msg, 0, sizeof(msg));
+	while ((msg.msg_iov = ring_peek(ring, &count))) {
+		msg.msg_iovlen = count < IOV_MAX ? count : IOV_MAX;
+		sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
 		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
 			if (errno == EPIPE)
 				errno = ECONNRESET;
-			if (errno != EMSGSIZE)
-				goto fail;
-			chunksize >>= 1;
-			if (!chunksize)
-				goto fail;
-			continue;
+			goto fail;
 		}
-		ptr += (size_t)sent;
+		ring_pop(ring, (size_t)sent);
+		stats.counters[COUNTER_BYTES_SENT] += (uint64_t)sent;
 	}
 
-	free(buf);
 	return 0;
 
 fail:
 	switch (errno) {
-	case EINTR:
 #if defined(EAGAIN)
 	case EAGAIN:
 #endif
 #if defined(EWOULDBLOCK) && (!defined(EAGAIN) || EAGAIN != EWOULDBLOCK)
 	case EWOULDBLOCK:
 #endif
-		if (ring_push(ring, buf + ptr, n - ptr) < 0)
-			goto proper_fail;
-		free(buf);
+		if (buf)
+			stats.counters[COUNTER_DEFERRED_MESSAGES] += 1;
 		return 0;
 
 	case ECONNRESET:
-		free(buf);
-		if (connection_closed(fd) < 0)
+		ring_destroy(ring);
+		if (connection_closed(conn, fd) < 0)
 			return -1;
 		return 1;
 
 	default:
-		break;
+		return -1;
 	}
-
-proper_fail:
-	saved_errno = errno;
-	free(buf);
-	errno = saved_errno;
-	return -1;
 }
 
 
@@ -157,3 +165,169 @@ int
 
 	return send_message(conn, buf, n);
 }
+
+
+/**
+ * Send a reply with binary framing
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The ID of the message to which this message is a response
+ * @param   error       The value of `.error` in the reply
+ * @param   payload     The payload, may be `NULL` if `n` is 0
+ * @param   n           The size of the payload
+ * @return              1: Client disconnected
+ *                      0: Success (possibily delayed)
+ *                      -1: An error occurred
+ */
+static int
+send_binary_reply(size_t conn, uint32_t message_id, int32_t error, const char *restrict payload, size_t n)
+{
+	struct binary_reply reply;
+	char *restrict buf;
+
+	reply.in_response_to = message_id;
+	reply.error = error;
+	reply.payload_length = (uint32_t)n;
+
+	buf = pool_alloc(sizeof(reply) + n);
+	if (!buf)
+		return -1;
+	memcpy(buf, &reply, sizeof(reply));
+	if (n)
+		memcpy(&buf[sizeof(reply)], payload, n);
+
+	return send_message(conn, buf, sizeof(reply) + n);
+}
+
+
+/**
+ * Send a custom error without an error number, with binary framing
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The ID of the message to which this message is a response
+ * @param   desc        The error description to send
+ * @return              1: Client disconnected
+ *                      0: Success (possibily delayed)
+ *                      -1: An error occurred
+ */
+int
+send_binary_error(size_t conn, uint32_t message_id, const char *restrict desc)
+{
+	return send_binary_reply(conn, message_id, -1, desc, strlen(desc));
+}
+
+
+/**
+ * Send a standard error, with binary framing
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The ID of the message to which this message is a response
+ * @param   number      The value of `errno`, 0 to indicate success
+ * @return              1: Client disconnected
+ *                      0: Success (possibily delayed)
+ *                      -1: An error occurred
+ */
+int
+send_binary_errno(size_t conn, uint32_t message_id, int number)
+{
+	return send_binary_reply(conn, message_id, (int32_t)number, NULL, 0);
+}
+
+
+/**
+ * Report an event to all clients that have subscribed to it
+ * 
+ * The event is only queued, it is sent by `send_events`;
+ * if a client is lagging behind, or is using binary framing,
+ * the event is coalesced with other events for the client
+ * and reported together with them later
+ * 
+ * @param   event  The event
+ * @param   crtc   The name of the CRTC the event occurred on
+ * @return         Zero on success, -1 on error
+ */
+int
+notify_subscribers(enum event event, const char *restrict crtc)
+{
+	struct subscription *restrict sub;
+	char *restrict buf;
+	size_t i, n;
+
+	for (i = 0; i < connections_used; i++) {
+		sub = subscriptions + i;
+		if (connections[i] < 0 || !subscription_covers(sub, event, crtc))
+			continue;
+
+		events_pending = 1;
+		/* Once an event has been coalesced, all following events must be
+		 * too, otherwise the client could see them in the wrong order. */
+		if (sub->coalesced || inbound[i].framing != FRAMING_TEXT || outbound[i].bytes >= SUBSCRIBER_LAG_MARK) {
+			sub->coalesced |= EVENT_BIT(event);
+			continue;
+		}
+
+		MAKE_MESSAGE(&buf, &n, 0,
+		             "Command: event\n"
+		             "Event: %s\n"
+		             "CRTC: %s\n"
+		             "\n",
+		             event_name(event), crtc);
+
+		if (ring_push(outbound + i, buf, n) < 0) {
+			pool_free(buf);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Send all events queued by `notify_subscribers`, and
+ * report coalesced events to clients that have caught up
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int
+send_events(void)
+{
+	struct subscription *restrict sub;
+	char *restrict buf;
+	size_t i, n;
+
+	if (!events_pending)
+		return 0;
+	events_pending = 0;
+
+	for (i = 0; i < connections_used; i++) {
+		sub = subscriptions + i;
+		if (connections[i] < 0 || !sub->events)
+			continue;
+
+		if (sub->coalesced) {
+			if (inbound[i].framing != FRAMING_TEXT || outbound[i].bytes >= SUBSCRIBER_LAG_MARK) {
+				events_pending = 1;
+				continue;
+			}
+			n = sizeof(COALESCED_EVENT_HEADERS) - 1;
+			buf = pool_alloc(n + events_format(sub->coalesced, NULL) + 3);
+			if (!buf)
+				return -1;
+			memcpy(buf, COALESCED_EVENT_HEADERS, n);
+			n += events_format(sub->coalesced, &buf[n]);
+			memcpy(&buf[n], "\n\n", 2);
+			n += 2;
+			if (ring_push(outbound + i, buf, n) < 0) {
+				pool_free(buf);
+				return -1;
+			}
+			sub->coalesced = 0;
+		}
+
+		if (ring_have_more(outbound + i) && continue_send(i) < 0)
+			return -1;
+	}
+
+	return 0;
+}
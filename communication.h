@@ -2,6 +2,10 @@
 #ifndef COMMUNICATION_H
 #define COMMUNICATION_H
 
+#include "types-pool.h"
+#include "types-subscription.h"
+
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -26,7 +30,7 @@
 	do {\
 		ssize_t m__;\
 		snprintf(NULL, 0, format "%zn", __VA_ARGS__, &m__);\
-		*(bufp) = malloc((size_t)(extra) + (size_t)m__ + (size_t)1);\
+		*(bufp) = pool_alloc((size_t)(extra) + (size_t)m__ + (size_t)1);\
 		if (!*(bufp))\
 			return -1;\
 		sprintf(*(bufp), format, __VA_ARGS__);\
@@ -56,8 +60,13 @@
 /**
  * Send a message
  * 
+ * The message is queued, and all queued messages
+ * are sent with as few system calls as possible
+ * 
  * @param   conn  The index of the connection
- * @param   buf   The data to send
+ * @param   buf   The data to send, allocated with `pool_alloc`,
+ *                the function takes over the ownership of it,
+ *                `NULL` to only send already queued messages
  * @param   n     The size of `buf`
  * @return        Zero on success, -1 on error, 1 if disconncted
  *                EINTR, EAGAIN, EWOULDBLOCK, and ECONNRESET count
@@ -92,6 +101,54 @@ int (send_error)(size_t conn, const char *restrict message_id, const char *restr
 GCC_ONLY(__attribute__((__nonnull__)))
 int (send_errno)(size_t conn, const char *restrict message_id, int number);
 
+/**
+ * Send a custom error without an error number, with binary framing
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The ID of the message to which this message is a response
+ * @param   desc        The error description to send
+ * @return              1: Client disconnected
+ *                      0: Success (possibily delayed)
+ *                      -1: An error occurred
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int send_binary_error(size_t conn, uint32_t message_id, const char *restrict desc);
+
+/**
+ * Send a standard error, with binary framing
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The ID of the message to which this message is a response
+ * @param   number      The value of `errno`, 0 to indicate success
+ * @return              1: Client disconnected
+ *                      0: Success (possibily delayed)
+ *                      -1: An error occurred
+ */
+int send_binary_errno(size_t conn, uint32_t message_id, int number);
+
+/**
+ * Report an event to all clients that have subscribed to it
+ * 
+ * The event is only queued, it is sent by `send_events`;
+ * if a client is lagging behind, or is using binary framing,
+ * the event is coalesced with other events for the client
+ * and reported together with them later
+ * 
+ * @param   event  The event
+ * @param   crtc   The name of the CRTC the event occurred on
+ * @return         Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int notify_subscribers(enum event event, const char *restrict crtc);
+
+/**
+ * Send all events queued by `notify_subscribers`, and
+ * report coalesced events to clients that have caught up
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int send_events(void);
+
 /**
  * Continue sending the queued messages
  * 
@@ -7,6 +7,8 @@ COMMAND = coopgammad
 
 CC=cc
 
+# Add -DUSE_POLL to use poll(3p) instead of epoll(7) on Linux
+# Add -DOUTBOUND_HIGH_WATER_MARK=n to stop reading from a client when n bytes are queued for it (default 1 MiB)
 CPPFLAGS = -D_XOPEN_SOURCE=700 -D_GNU_SOURCE -DUSE_VALGRIND
 CFLAGS   = -std=c11 -Wall -Og
-LDFLAGS  = -lgamma -s
+LDFLAGS  = -lgamma -lm -s
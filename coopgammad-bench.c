@@ -0,0 +1,1603 @@
+/* See LICENSE file for copyright and license details. */
+#include "arg.h"
+#include "types-message.h"
+#include "types-ramps.h"
+
+#include <libclut.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+
+/**
+ * Lists all commands that can be issued, will call
+ * macro X with the enum value of the command as the
+ * first argument, the name used in the mix as the
+ * second argument, and the default weight in the mix
+ * as the third argument
+ */
+#define LIST_COMMANDS\
+	X(ENUMERATE_CRTCS,     "enumerate-crtcs",     1)\
+	X(GET_GAMMA_INFO,      "get-gamma-info",      1)\
+	X(GET_GAMMA,           "get-gamma",           2)\
+	X(GET_GAMMA_COALESCED, "get-gamma-coalesced", 2)\
+	X(SET_GAMMA,           "set-gamma",           4)
+
+
+/**
+ * Commands that can be issued
+ */
+enum command {
+#define X(ENUM, NAME, WEIGHT) ENUM,
+	LIST_COMMANDS
+#undef X
+
+	/**
+	 * The number of commands
+	 */
+	COMMAND_COUNT
+};
+
+/**
+ * A CRTC that requests can be made for
+ */
+struct crtc {
+	/**
+	 * The name of the CRTC
+	 */
+	char *name;
+
+	/**
+	 * Ramps to use as the payload in ‘Command: set-gamma’
+	 */
+	char *ramps;
+
+	/**
+	 * The size of `.ramps`
+	 */
+	size_t ramps_size;
+
+	/**
+	 * The index of the CRTC in the response
+	 * to ‘Command: enumerate-crtcs’
+	 */
+	size_t index;
+};
+
+/**
+ * A connection to the server
+ */
+struct client {
+	/**
+	 * The file descriptor of the socket
+	 */
+	int fd;
+
+	/**
+	 * The command of the request waiting for a response,
+	 * `COMMAND_COUNT` if there is none
+	 */
+	enum command command;
+
+	/**
+	 * When the request was sent, in nanoseconds
+	 */
+	uint64_t sent;
+
+	/**
+	 * The message ID of the last request
+	 */
+	unsigned long int message_id;
+
+	/**
+	 * The header of the last request, `header_alloc`
+	 * bytes are allocated for it
+	 */
+	char *header;
+
+	/**
+	 * The number of bytes in `.header` that have been sent
+	 */
+	size_t header_ptr;
+
+	/**
+	 * The size of the header of the last request
+	 */
+	size_t header_size;
+
+	/**
+	 * The payload of the request, not owned by the client
+	 */
+	const char *payload;
+
+	/**
+	 * The number of bytes in `.payload` that have been sent
+	 */
+	size_t payload_ptr;
+
+	/**
+	 * The size of `.payload`
+	 */
+	size_t payload_size;
+
+	/**
+	 * Buffer for received data
+	 */
+	char *buffer;
+
+	/**
+	 * The number of bytes stored in `.buffer`
+	 */
+	size_t buffer_ptr;
+
+	/**
+	 * The allocation size of `.buffer`
+	 */
+	size_t buffer_size;
+};
+
+/**
+ * Statistics for a command
+ */
+struct stats {
+	/**
+	 * The latency of each response, in nanoseconds
+	 */
+	uint64_t *latencies;
+
+	/**
+	 * The number of elements in `.latencies`
+	 */
+	size_t count;
+
+	/**
+	 * The number of elements allocated for `.latencies`
+	 */
+	size_t alloc;
+
+	/**
+	 * The number of responses that were errors
+	 */
+	size_t errors;
+};
+
+
+/**
+ * The name of the process
+ */
+char *restrict argv0;
+
+/**
+ * The name of each command
+ */
+static const char *const command_names[] = {
+#define X(ENUM, NAME, WEIGHT) NAME,
+	LIST_COMMANDS
+#undef X
+};
+
+/**
+ * The weight of each command in the mix
+ */
+static unsigned command_weights[] = {
+#define X(ENUM, NAME, WEIGHT) WEIGHT,
+	LIST_COMMANDS
+#undef X
+};
+
+/**
+ * The sum of `command_weights`
+ */
+static unsigned weight_sum;
+
+/**
+ * The CRTC:s that support gamma adjustments
+ */
+static struct crtc *crtcs = NULL;
+
+/**
+ * The number of elements in `crtcs`
+ */
+static size_t crtcs_n = 0;
+
+/**
+ * The number of bytes allocated for the
+ * header buffer of each client
+ */
+static size_t header_alloc;
+
+/**
+ * Statistics for each command
+ */
+static struct stats stats[COMMAND_COUNT];
+
+/**
+ * Whether the clients use binary framing
+ */
+static int binary = 0;
+
+
+/**
+ * Print usage information and exit
+ */
+#if defined(__GNU__) || defined(__clang__)
+__attribute__((__noreturn__))
+#endif
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: %s [-b] [-c clients] [-n requests] [-x command=weight]... socket\n"
+	                "       %s -r pid socket\n"
+	                "       %s -t\n", argv0, argv0, argv0);
+	exit(1);
+}
+
+
+/**
+ * Get the current time
+ * 
+ * @return  The current time in nanoseconds
+ */
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+
+/**
+ * Connect to the server
+ * 
+ * @param   path  The pathname of the server's socket
+ * @return        The file descriptor of the socket, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+connect_to_server(const char *path)
+{
+	struct sockaddr_un address;
+	int fd;
+
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+
+	fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	if (connect(fd, (struct sockaddr *)&address, (socklen_t)sizeof(address)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/**
+ * Get the value of a header in a received message
+ * 
+ * @param   message  The message, NUL-terminated after its header
+ * @param   name     The name of the header, including the ": "
+ * @return           The value of the header, terminated by a
+ *                   new line, `NULL` if the header is missing
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static const char *
+get_header(const char *message, const char *name)
+{
+	size_t n = strlen(name);
+
+	for (; *message && *message != '\n'; message = &strchr(message, '\n')[1])
+		if (!strncmp(message, name, n))
+			return &message[n];
+
+	return NULL;
+}
+
+
+/**
+ * Check whether a complete message has been received by a client,
+ * if so, the second new line of the message's header is replaced
+ * with a NUL byte, unless binary framing is used
+ * 
+ * @param   client       The client
+ * @param   header_size  Output parameter for the size of the message's header,
+ *                       including the empty line that ends it
+ * @return               The size of the message, 0 if it is incomplete
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static size_t
+complete_message(struct client *restrict client, size_t *restrict header_size)
+{
+	char *end;
+	const char *value;
+	size_t length = 0;
+	struct binary_reply reply;
+
+	if (binary) {
+		if (client->buffer_ptr < sizeof(reply))
+			return 0;
+		memcpy(&reply, client->buffer, sizeof(reply));
+		*header_size = sizeof(reply);
+		if (client->buffer_ptr - sizeof(reply) < (size_t)reply.payload_length)
+			return 0;
+		return sizeof(reply) + (size_t)reply.payload_length;
+	}
+
+	if (!client->buffer_ptr)
+		return 0;
+	client->buffer[client->buffer_ptr] = '\0';
+	end = strstr(client->buffer, "\n\n");
+	if (!end)
+		return 0;
+	*header_size = (size_t)(end - client->buffer) + 2;
+	end[1] = '\0';
+
+	if ((value = get_header(client->buffer, "Length: ")))
+		length = (size_t)strtoul(value, NULL, 10);
+	if (client->buffer_ptr < *header_size + length) {
+		end[1] = '\n';
+		return 0;
+	}
+
+	return *header_size + length;
+}
+
+
+/**
+ * Remove a message from the beginning of a client's buffer
+ * 
+ * @param  client  The client
+ * @param  n       The size of the message
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static void
+discard_message(struct client *restrict client, size_t n)
+{
+	client->buffer_ptr -= n;
+	memmove(client->buffer, &client->buffer[n], client->buffer_ptr);
+}
+
+
+/**
+ * Receive all available data for a client
+ * 
+ * @param   client  The client
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+receive(struct client *restrict client)
+{
+	ssize_t got;
+	char *new;
+
+	for (;;) {
+		if (client->buffer_size - client->buffer_ptr < 4096 + 1) {
+			new = realloc(client->buffer, client->buffer_size * 2 + 4096 + 1);
+			if (!new)
+				return -1;
+			client->buffer = new;
+			client->buffer_size = client->buffer_size * 2 + 4096 + 1;
+		}
+		got = recv(client->fd, &client->buffer[client->buffer_ptr],
+		           client->buffer_size - client->buffer_ptr - 1, 0);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		} else if (!got) {
+			errno = ECONNRESET;
+			return -1;
+		}
+		client->buffer_ptr += (size_t)got;
+	}
+}
+
+
+/**
+ * Wait until a complete message has been received by a client
+ * 
+ * @param   client       The client
+ * @param   header_size  Output parameter for the size of the message's header
+ * @return               The size of the message, 0 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static size_t
+wait_message(struct client *restrict client, size_t *restrict header_size)
+{
+	struct pollfd pfd;
+	size_t n;
+
+	pfd.fd = client->fd;
+	pfd.events = POLLIN;
+	while (!(n = complete_message(client, header_size))) {
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return 0;
+		if (receive(client) < 0)
+			return 0;
+	}
+
+	return n;
+}
+
+
+/**
+ * Send as much as possible of a client's pending request
+ * 
+ * @param   client  The client
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+send_pending(struct client *restrict client)
+{
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t sent;
+	size_t n;
+
+	while (client->header_ptr < client->header_size || client->payload_ptr < client->payload_size) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		if (client->header_ptr < client->header_size) {
+			iov[msg.msg_iovlen].iov_base = &client->header[client->header_ptr];
+			iov[msg.msg_iovlen++].iov_len = client->header_size - client->header_ptr;
+		}
+		if (client->payload_ptr < client->payload_size) {
+			iov[msg.msg_iovlen].iov_base = (char *)&client->payload[client->payload_ptr];
+			iov[msg.msg_iovlen++].iov_len = client->payload_size - client->payload_ptr;
+		}
+		sent = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		n = (size_t)sent;
+		if (client->header_ptr < client->header_size) {
+			if (n <= client->header_size - client->header_ptr) {
+				client->header_ptr += n;
+				continue;
+			}
+			n -= client->header_size - client->header_ptr;
+			client->header_ptr = client->header_size;
+		}
+		client->payload_ptr += n;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Check whether a client has a partially sent request
+ * 
+ * @param   client  The client
+ * @return          1 if the request is partially sent, 0 otherwise
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static inline int
+have_pending(const struct client *restrict client)
+{
+	return client->header_ptr < client->header_size || client->payload_ptr < client->payload_size;
+}
+
+
+/**
+ * Select a command to issue next
+ * 
+ * @return  The command
+ */
+static enum command
+select_command(void)
+{
+	unsigned r = (unsigned)rand() % weight_sum;
+	int command;
+
+	for (command = 0; r >= command_weights[command]; command++)
+		r -= command_weights[command];
+
+	return (enum command)command;
+}
+
+
+/**
+ * Make a client issue a request
+ * 
+ * @param   client   The client
+ * @param   command  The command of the request
+ * @param   crtc     The CRTC the request shall be made for,
+ *                   unused for ‘Command: enumerate-crtcs’
+ * @return           Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__(1))))
+static int
+issue_request(struct client *restrict client, enum command command, const struct crtc *restrict crtc)
+{
+	static const char *const lifespans[] = {"until-death", "until-death", "until-removal", "remove"};
+	static const uint8_t binary_lifespans[] = {2, 2, 1, 0};
+	const char *lifespan;
+	char priority[sizeof("Priority: \n") + 3 * sizeof(int)];
+	struct binary_frame frame;
+	int len, which;
+
+	client->message_id += 1;
+	client->payload = NULL;
+	client->payload_size = 0;
+	client->payload_ptr = 0;
+	client->header_ptr = 0;
+
+	switch (command) {
+	case ENUMERATE_CRTCS:
+		len = snprintf(client->header, header_alloc,
+		               "Command: enumerate-crtcs\n"
+		               "Message ID: %lu\n"
+		               "\n",
+		               client->message_id);
+		break;
+
+	case GET_GAMMA_INFO:
+		len = snprintf(client->header, header_alloc,
+		               "Command: get-gamma-info\n"
+		               "Message ID: %lu\n"
+		               "CRTC: %s\n"
+		               "\n",
+		               client->message_id, crtc->name);
+		break;
+
+	case GET_GAMMA:
+	case GET_GAMMA_COALESCED:
+		len = snprintf(client->header, header_alloc,
+		               "Command: get-gamma\n"
+		               "Message ID: %lu\n"
+		               "CRTC: %s\n"
+		               "Coalesce: %s\n"
+		               "High priority: %"PRIi64"\n"
+		               "Low priority: %"PRIi64"\n"
+		               "\n",
+		               client->message_id, crtc->name, command == GET_GAMMA ? "no" : "yes",
+		               INT64_MAX, INT64_MIN);
+		break;
+
+	case SET_GAMMA:
+		if (binary) {
+			which = rand() % 4;
+			if (which != 3) {
+				client->payload = crtc->ramps;
+				client->payload_size = crtc->ramps_size;
+			}
+			frame.message_id = (uint32_t)client->message_id;
+			frame.command = BINARY_COMMAND_SET_GAMMA;
+			frame.lifespan = binary_lifespans[which];
+			frame.crtc = (uint32_t)crtc->index;
+			frame.payload_length = (uint32_t)client->payload_size;
+			frame.priority = which == 3 ? 0 : rand() % 17 - 8;
+			len = snprintf(&client->header[sizeof(frame)], header_alloc - sizeof(frame),
+			               COMMAND"::bench::%i", rand() % 16);
+			frame.class_length = (uint16_t)(len + 1);
+			memcpy(client->header, &frame, sizeof(frame));
+			len += (int)sizeof(frame) + 1;
+			break;
+		}
+		lifespan = lifespans[rand() % 4];
+		*priority = '\0';
+		if (strcmp(lifespan, "remove")) {
+			sprintf(priority, "Priority: %i\n", rand() % 17 - 8);
+			client->payload = crtc->ramps;
+			client->payload_size = crtc->ramps_size;
+		}
+		len = snprintf(client->header, header_alloc,
+		               "Command: set-gamma\n"
+		               "Message ID: %lu\n"
+		               "CRTC: %s\n"
+		               "Class: "COMMAND"::bench::%i\n"
+		               "Lifespan: %s\n"
+		               "%s"
+		               "Length: %zu\n"
+		               "\n",
+		               client->message_id, crtc->name, rand() % 16,
+		               lifespan, priority, client->payload_size);
+		break;
+
+	default:
+		abort();
+	}
+
+	if (len < 0 || (size_t)len >= header_alloc) {
+		errno = ENOMEM;
+		return -1;
+	}
+	client->header_size = (size_t)len;
+	client->command = command;
+	client->sent = now();
+	return send_pending(client);
+}
+
+
+/**
+ * Record the response to a client's request
+ * 
+ * @param   client  The client
+ * @param   error   Whether the response was an error
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+record_response(struct client *restrict client, int error)
+{
+	struct stats *st = &stats[client->command];
+	uint64_t *new;
+
+	if (st->count == st->alloc) {
+		new = realloc(st->latencies, (st->alloc * 2 + 1024) * sizeof(*new));
+		if (!new)
+			return -1;
+		st->latencies = new;
+		st->alloc = st->alloc * 2 + 1024;
+	}
+	st->latencies[st->count++] = now() - client->sent;
+	st->errors += (size_t)error;
+	client->command = COMMAND_COUNT;
+	return 0;
+}
+
+
+/**
+ * Check whether the response a client has received is an error
+ * 
+ * @param   client  The client, with a complete message
+ *                  at the beginning of its buffer
+ * @return          1 if the response is an error, 0 otherwise
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static int
+is_error(const struct client *restrict client)
+{
+	struct binary_reply reply;
+	const char *value;
+
+	if (binary) {
+		memcpy(&reply, client->buffer, sizeof(reply));
+		return reply.error != 0;
+	}
+
+	value = get_header(client->buffer, "Error: ");
+	return value && strncmp(value, "0\n", 2);
+}
+
+
+/**
+ * Send a client's pending request in full and
+ * wait until the response has been received
+ * 
+ * @param   client       The client
+ * @param   header_size  Output parameter for the size of the response's header
+ * @return               The size of the response, 0 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static size_t
+exchange(struct client *restrict client, size_t *restrict header_size)
+{
+	struct pollfd pfd;
+
+	pfd.fd = client->fd;
+	pfd.events = POLLOUT;
+	for (;;) {
+		if (send_pending(client) < 0)
+			return 0;
+		if (!have_pending(client))
+			break;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return 0;
+	}
+
+	client->command = COMMAND_COUNT;
+	return wait_message(client, header_size);
+}
+
+
+/**
+ * Switch a client to binary framing
+ * 
+ * @param   client  A connected client without pending requests
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+use_binary_framing(struct client *restrict client)
+{
+	size_t n, header_size;
+	int len;
+
+	client->message_id += 1;
+	client->payload = NULL;
+	client->payload_size = 0;
+	client->payload_ptr = 0;
+	client->header_ptr = 0;
+	len = snprintf(client->header, header_alloc,
+	               "Command: set-framing\n"
+	               "Message ID: %lu\n"
+	               "Framing: binary\n"
+	               "\n",
+	               client->message_id);
+	client->header_size = (size_t)len;
+
+	if (!(n = exchange(client, &header_size)))
+		return -1;
+	if (is_error(client)) {
+		errno = EPROTO;
+		return -1;
+	}
+	discard_message(client, n);
+	return 0;
+}
+
+
+/**
+ * Create ramps to use as the payload in ‘Command: set-gamma’
+ * 
+ * @param   crtc   The CRTC, `.ramps_size` will be set
+ * @param   depth  The value of the ‘Depth’ header for the CRTC
+ * @param   sizes  The number of stops in the red, green, and blue ramps
+ * @return         Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+make_ramps(struct crtc *restrict crtc, const char *depth, const size_t sizes[3])
+{
+	size_t i, j, k = 0, width;
+	double x;
+
+	if (*depth == 'f')
+		width = sizeof(float);
+	else if (*depth == 'd')
+		width = sizeof(double);
+	else
+		width = (size_t)atoi(depth) / 8;
+
+	crtc->ramps_size = (sizes[0] + sizes[1] + sizes[2]) * width;
+	crtc->ramps = malloc(crtc->ramps_size);
+	if (!crtc->ramps)
+		return -1;
+
+	/* Use slightly different curves for each channel so the
+	 * server cannot take shortcuts for uniform ramps. */
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < sizes[i]; j++, k += width) {
+			x = sizes[i] > 1 ? (double)j / (double)(sizes[i] - 1) : 0;
+			x = x * (1 - (double)i / 16);
+#define X(TYPE, MAX)\
+			do {\
+				TYPE v__ = (TYPE)(x * (MAX));\
+				memcpy(&crtc->ramps[k], &v__, sizeof(v__));\
+			} while (0)
+			switch (*depth) {
+			case 'f': X(float, 1); break;
+			case 'd': X(double, 1); break;
+			default:
+				switch (width) {
+				case 1: X(uint8_t, UINT8_MAX); break;
+				case 2: X(uint16_t, UINT16_MAX); break;
+				case 4: X(uint32_t, UINT32_MAX); break;
+				case 8: X(uint64_t, (double)UINT64_MAX); break;
+				default:
+					errno = EPROTO;
+					return -1;
+				}
+				break;
+			}
+#undef X
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Find the CRTC:s that support gamma adjustments
+ * 
+ * @param   client  A connected client without pending requests
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+find_crtcs(struct client *restrict client)
+{
+	struct crtc crtc = {NULL, NULL, 0, 0};
+	char *names = NULL, *name, *end;
+	const char *depth, *support;
+	size_t n, header_size, sizes[3], index = 0;
+	int saved_errno;
+
+	if (issue_request(client, ENUMERATE_CRTCS, NULL) < 0)
+		return -1;
+	if (!(n = wait_message(client, &header_size)))
+		return -1;
+	names = malloc(n - header_size + 1);
+	if (!names)
+		return -1;
+	memcpy(names, &client->buffer[header_size], n - header_size);
+	names[n - header_size] = '\0';
+	discard_message(client, n);
+	client->command = COMMAND_COUNT;
+
+	for (name = names; *name; name = &end[1], index++) {
+		end = strchr(name, '\n');
+		if (!end)
+			break;
+		*end = '\0';
+
+		crtc.name = name;
+		crtc.index = index;
+		crtc.ramps = NULL;
+		if (strlen(name) + 512 > header_alloc) {
+			errno = ENAMETOOLONG;
+			goto fail;
+		}
+		if (issue_request(client, GET_GAMMA_INFO, &crtc) < 0)
+			goto fail;
+		if (!(n = wait_message(client, &header_size)))
+			goto fail;
+		client->command = COMMAND_COUNT;
+
+		support = get_header(client->buffer, "Gamma support: ");
+		depth   = get_header(client->buffer, "Depth: ");
+		if (!support || !strncmp(support, "no\n", 3) || !depth) {
+			discard_message(client, n);
+			continue;
+		}
+		sizes[0] = get_header(client->buffer, "Red size: ")   ? (size_t)atol(get_header(client->buffer, "Red size: "))   : 0;
+		sizes[1] = get_header(client->buffer, "Green size: ") ? (size_t)atol(get_header(client->buffer, "Green size: ")) : 0;
+		sizes[2] = get_header(client->buffer, "Blue size: ")  ? (size_t)atol(get_header(client->buffer, "Blue size: "))  : 0;
+		if (make_ramps(&crtc, depth, sizes) < 0)
+			goto fail;
+		discard_message(client, n);
+
+		crtc.name = strdup(name);
+		if (!crtc.name)
+			goto fail;
+		if (!(crtcs_n & (crtcs_n - 1))) {
+			void *new = realloc(crtcs, (crtcs_n ? crtcs_n * 2 : 1) * sizeof(*crtcs));
+			if (!new) {
+				free(crtc.name);
+				goto fail;
+			}
+			crtcs = new;
+		}
+		crtcs[crtcs_n++] = crtc;
+	}
+
+	free(names);
+	return 0;
+
+fail:
+	saved_errno = errno;
+	free(crtc.ramps);
+	free(names);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Add or remove one of the filters used by `check_reexec`
+ * 
+ * @param   client  A connected client without pending requests
+ * @param   crtc    The CRTC the filter shall be applied to
+ * @param   index   The index of the filter, also used as its priority
+ * @param   add     1 to add the filter, 0 to remove it
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+set_reexec_filter(struct client *restrict client, const struct crtc *restrict crtc, int index, int add)
+{
+	size_t n, header_size;
+	int len;
+
+	client->message_id += 1;
+	client->payload = add ? crtc->ramps : NULL;
+	client->payload_size = add ? crtc->ramps_size : 0;
+	client->payload_ptr = 0;
+	client->header_ptr = 0;
+	len = snprintf(client->header, header_alloc,
+	               "Command: set-gamma\n"
+	               "Message ID: %lu\n"
+	               "CRTC: %s\n"
+	               "Class: "COMMAND"::bench-reexec::%i\n"
+	               "Lifespan: %s\n"
+	               "Priority: %i\n"
+	               "Length: %zu\n"
+	               "\n",
+	               client->message_id, crtc->name, index,
+	               add ? "until-removal" : "remove", index, client->payload_size);
+	if (len < 0 || (size_t)len >= header_alloc) {
+		errno = ENOMEM;
+		return -1;
+	}
+	client->header_size = (size_t)len;
+
+	if (!(n = exchange(client, &header_size)))
+		return -1;
+	if (is_error(client)) {
+		discard_message(client, n);
+		errno = EPROTO;
+		return -1;
+	}
+	discard_message(client, n);
+	return 0;
+}
+
+
+/**
+ * Get the coalesced gamma ramps of all filters on a CRTC
+ * 
+ * @param   client  A connected client without pending requests
+ * @param   crtc    The CRTC
+ * @return          The ramps, `crtc->ramps_size` bytes, which
+ *                  shall be free(3)d, `NULL` on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static char *
+get_coalesced(struct client *restrict client, const struct crtc *restrict crtc)
+{
+	size_t n, header_size;
+	char *ramps;
+
+	if (issue_request(client, GET_GAMMA_COALESCED, crtc) < 0)
+		return NULL;
+	if (!(n = exchange(client, &header_size)))
+		return NULL;
+	if (is_error(client) || n - header_size != crtc->ramps_size) {
+		discard_message(client, n);
+		errno = EPROTO;
+		return NULL;
+	}
+	ramps = malloc(crtc->ramps_size);
+	if (ramps)
+		memcpy(ramps, &client->buffer[header_size], crtc->ramps_size);
+	discard_message(client, n);
+	return ramps;
+}
+
+
+/**
+ * Check that the coalesced gamma ramps of each CRTC
+ * are unchanged when the server re-executes
+ * 
+ * A few filters are added to each CRTC, the server is
+ * made to re-execute, and the filters are removed again
+ * 
+ * @param   client  A connected client without pending requests
+ * @param   pid     The process ID of the server
+ * @return          Zero if the ramps are unchanged, 1 if they
+ *                  have changed, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+check_reexec(struct client *restrict client, pid_t pid)
+{
+	struct timespec delay = {1, 0};
+	char **before, *after;
+	size_t i;
+	int j, r = -1, changed = 0, saved_errno;
+
+	before = calloc(crtcs_n, sizeof(*before));
+	if (!before)
+		return -1;
+
+	for (i = 0; i < crtcs_n; i++) {
+		for (j = 1; j <= 3; j++)
+			if (set_reexec_filter(client, &crtcs[i], j, 1) < 0)
+				goto out;
+		if (!(before[i] = get_coalesced(client, &crtcs[i])))
+			goto out;
+	}
+
+	/* The connection survives the re-execution, but there
+	 * is no way to tell when it has happened, so wait a
+	 * while to not have the request answered before it */
+	if (kill(pid, SIGUSR1) < 0)
+		goto out;
+	while (nanosleep(&delay, &delay) < 0)
+		if (errno != EINTR)
+			goto out;
+
+	for (i = 0; i < crtcs_n; i++) {
+		if (!(after = get_coalesced(client, &crtcs[i])))
+			goto out;
+		if (memcmp(before[i], after, crtcs[i].ramps_size)) {
+			fprintf(stderr, "%s: gamma ramps of CRTC %s changed by re-execution\n", argv0, crtcs[i].name);
+			changed = 1;
+		}
+		free(after);
+		for (j = 1; j <= 3; j++)
+			if (set_reexec_filter(client, &crtcs[i], j, 0) < 0)
+				goto out;
+	}
+
+	r = changed;
+out:
+	saved_errno = errno;
+	for (i = 0; i < crtcs_n; i++)
+		free(before[i]);
+	free(before);
+	errno = saved_errno;
+	return r;
+}
+
+
+/**
+ * Get the size of a stop
+ * 
+ * @param   depth  The depth of the stops, see `struct output.depth`
+ * @return         The size of a stop, in bytes
+ */
+GCC_ONLY(__attribute__((__const__)))
+static size_t
+stop_width(int depth)
+{
+	return depth == -1 ? sizeof(float) : depth == -2 ? sizeof(double) : (size_t)depth / 8;
+}
+
+
+/**
+ * Point a ramp-trio to a raw array of ramps
+ * 
+ * @param  ramps  The ramp-trio
+ * @param  raw    The red, green and blue ramps, as one single raw array
+ * @param  n      The number of stops in each ramp
+ * @param  width  The size of a stop
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static void
+set_ramps(union gamma_ramps *restrict ramps, char *raw, size_t n, size_t width)
+{
+	ramps->u8.red_size = ramps->u8.green_size = ramps->u8.blue_size = n;
+	ramps->u8.red   = (uint8_t *)raw;
+	ramps->u8.green = (uint8_t *)&raw[n * width];
+	ramps->u8.blue  = (uint8_t *)&raw[2 * n * width];
+}
+
+
+/**
+ * Fill ramps with random stops, floating-point
+ * stops are mostly, but not always, in [0, 1]
+ * 
+ * @param  raw    The red, green and blue ramps, as one single raw array
+ * @param  n      The number of stops in each ramp
+ * @param  depth  The depth of the stops, see `struct output.depth`
+ * @param  first  The index of the first ramp to fill
+ * @param  grey   Whether the ramps after the first
+ *                filled shall be copies of it
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static void
+random_ramps(char *raw, size_t n, int depth, int first, int grey)
+{
+	size_t i, width = stop_width(depth);
+	char *ramp;
+	int k;
+
+	for (k = first; k < 3; k++) {
+		ramp = &raw[(size_t)k * n * width];
+		if (grey && k > first) {
+			memcpy(ramp, &raw[(size_t)first * n * width], n * width);
+		} else if (depth == -1) {
+			for (i = 0; i < n; i++)
+				((float *)ramp)[i] = (float)((double)rand() / RAND_MAX * 1.5 - 0.25);
+		} else if (depth == -2) {
+			for (i = 0; i < n; i++)
+				((double *)ramp)[i] = (double)rand() / RAND_MAX * 1.5 - 0.25;
+		} else {
+			for (i = 0; i < n * width; i++)
+				ramp[i] = (char)rand();
+		}
+	}
+}
+
+
+/**
+ * Check that composing filters with `gamma_ramps_apply`,
+ * which only calculates one channel when all channels of
+ * both ramp-trios are identical, gives bit-identical
+ * results to calculating each channel
+ * 
+ * For integral stops, the reference is `libclut_apply`;
+ * for floating-point stops, which `gamma_ramps_apply`
+ * interpolates, the reference is `gamma_ramps_apply`
+ * itself with the green and blue channels of the filter
+ * altered so that every channel has to be calculated
+ * 
+ * @return  Zero if all results are identical, 1 if
+ *          any result differs, -1 on error
+ */
+static int
+check_composition(void)
+{
+	static const int depths[] = {8, 16, 32, 64, -1, -2};
+	union gamma_ramps result, reference, filter;
+	char *result_raw, *reference_raw, *filter_raw, *base_raw;
+	size_t d, n, width, size, trial;
+	int grey, failed = 0;
+
+	size = 3 * 1024 * sizeof(uint64_t);
+	result_raw    = malloc(size);
+	reference_raw = malloc(size);
+	filter_raw    = malloc(size);
+	base_raw      = malloc(size);
+	if (!result_raw || !reference_raw || !filter_raw || !base_raw) {
+		failed = -1;
+		goto out;
+	}
+
+	for (d = 0; d < sizeof(depths) / sizeof(*depths); d++) {
+		width = stop_width(depths[d]);
+		for (trial = 0; trial < 512; trial++) {
+			grey = (int)(trial & 1);
+			n = 1 + (size_t)rand() % 1024;
+			size = 3 * n * width;
+			set_ramps(&result, result_raw, n, width);
+			set_ramps(&reference, reference_raw, n, width);
+			set_ramps(&filter, filter_raw, n, width);
+
+			random_ramps(base_raw, n, depths[d], 0, grey);
+			random_ramps(filter_raw, n, depths[d], 0, grey);
+			memcpy(result_raw, base_raw, size);
+			memcpy(reference_raw, base_raw, size);
+			gamma_ramps_apply(&result, filter_raw, depths[d], &result);
+
+			switch (depths[d]) {
+			case 8:
+				libclut_apply(&reference.u8, UINT8_MAX, uint8_t, &filter.u8, UINT8_MAX, uint8_t, 1, 1, 1);
+				break;
+			case 16:
+				libclut_apply(&reference.u16, UINT16_MAX, uint16_t, &filter.u16, UINT16_MAX, uint16_t, 1, 1, 1);
+				break;
+			case 32:
+				libclut_apply(&reference.u32, UINT32_MAX, uint32_t, &filter.u32, UINT32_MAX, uint32_t, 1, 1, 1);
+				break;
+			case 64:
+				libclut_apply(&reference.u64, UINT64_MAX, uint64_t, &filter.u64, UINT64_MAX, uint64_t, 1, 1, 1);
+				break;
+			default:
+				if (!grey)
+					continue;
+				/* Each channel is calculated independently, so
+				 * the red channel is unaffected by the others */
+				random_ramps(filter_raw, n, depths[d], 1, 0);
+				gamma_ramps_apply(&reference, filter_raw, depths[d], &reference);
+				memcpy(&reference_raw[n * width], reference_raw, n * width);
+				memcpy(&reference_raw[2 * n * width], reference_raw, n * width);
+				break;
+			}
+
+			if (memcmp(result_raw, reference_raw, size)) {
+				fprintf(stderr, "%s: composition of %s ramps with %zu stops and depth %i is not bit-identical\n",
+				        argv0, grey ? "uniform" : "non-uniform", n, depths[d]);
+				failed = 1;
+			}
+		}
+	}
+
+out:
+	free(result_raw);
+	free(reference_raw);
+	free(filter_raw);
+	free(base_raw);
+	return failed;
+}
+
+
+/**
+ * Check that `gamma_ramps_apply` interpolates linearly
+ * between the stops of filters with floating-point stops,
+ * and clamps the stops it is applied on to [0, 1], by
+ * comparing against precalculated results
+ * 
+ * @return  Zero if all results are as expected, 1 otherwise
+ */
+static int
+check_interpolation(void)
+{
+	static const double input[3][5] = {
+		{0, .5, 1, -.5, 1.5},        /* endpoints, a stop, and clamping */
+		{.25, .625, .375, .875, 0},  /* between stops */
+		{1, .75, .5, .25, 0}
+	};
+	static const double stops[5] = {.0625, .125, .5, .75, 1};
+	static const double expected[3][5] = {
+		{.0625, .5, 1, .0625, 1},
+		{.125, .625, .3125, .875, .0625},
+		{1, .75, .5, .125, .0625}
+	};
+	static const int depths[] = {-1, -2};
+	double raw[2][3 * 5];
+	union gamma_ramps ramps;
+	size_t d, i, n, width;
+	int k, uniform, failed = 0;
+	double value;
+
+#define STOP(RAW, I) (depths[d] == -1 ? (double)((float *)(RAW))[I] : ((double *)(RAW))[I])
+#define SET_STOP(RAW, I, V)\
+	do {\
+		if (depths[d] == -1)\
+			((float *)(RAW))[I] = (float)(V);\
+		else\
+			((double *)(RAW))[I] = (V);\
+	} while (0)
+
+	for (d = 0; d < sizeof(depths) / sizeof(*depths); d++) {
+		width = stop_width(depths[d]);
+
+		/* With the same stops in every channel, only one channel is calculated */
+		for (uniform = 0; uniform < 2; uniform++) {
+			n = 5;
+			set_ramps(&ramps, (char *)raw[0], n, width);
+			for (k = 0; k < 3; k++) {
+				for (i = 0; i < n; i++) {
+					SET_STOP(raw[0], (size_t)k * n + i, input[uniform ? 0 : k][i]);
+					SET_STOP(raw[1], (size_t)k * n + i, stops[i]);
+				}
+			}
+			gamma_ramps_apply(&ramps, raw[1], depths[d], &ramps);
+			for (k = 0; k < 3; k++) {
+				for (i = 0; i < n; i++) {
+					value = STOP(raw[0], (size_t)k * n + i);
+					if (value != expected[uniform ? 0 : k][i]) {
+						fprintf(stderr, "%s: applying %g with depth %i gave %g, expected %g\n", argv0,
+						        input[uniform ? 0 : k][i], depths[d], value, expected[uniform ? 0 : k][i]);
+						failed = 1;
+					}
+				}
+			}
+		}
+
+		/* A filter with a single stop is constant */
+		n = 1;
+		set_ramps(&ramps, (char *)raw[0], n, width);
+		for (k = 0; k < 3; k++) {
+			SET_STOP(raw[0], (size_t)k, .75);
+			SET_STOP(raw[1], (size_t)k, .25);
+		}
+		gamma_ramps_apply(&ramps, raw[1], depths[d], &ramps);
+		for (k = 0; k < 3; k++) {
+			if ((value = STOP(raw[0], (size_t)k)) != .25) {
+				fprintf(stderr, "%s: applying a constant filter with depth %i gave %g, expected %g\n",
+				        argv0, depths[d], value, .25);
+				failed = 1;
+			}
+		}
+	}
+
+#undef STOP
+#undef SET_STOP
+
+	return failed;
+}
+
+
+/**
+ * Compare two latencies
+ * 
+ * @param   a  Return -1 if this one is lower
+ * @param   b  Return +1 if this one is lower
+ * @return     See description of `a` and `b`,
+ *             0 if returned if they are the same
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static int
+latency_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+
+/**
+ * Get a percentile of the latencies of a command
+ * 
+ * @param   st  The statistics for the command, the latencies must be sorted
+ * @param   p   The percentile, in thousandths
+ * @return      The latency, in microseconds
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static double
+percentile(const struct stats *restrict st, size_t p)
+{
+	size_t i = (st->count * p + 999) / 1000;
+	if (!st->count)
+		return 0;
+	return (double)st->latencies[i ? i - 1 : 0] / 1000;
+}
+
+
+/**
+ * Print the statistics
+ * 
+ * @param  elapsed  The duration of the benchmark, in nanoseconds
+ */
+static void
+print_stats(uint64_t elapsed)
+{
+	double seconds = (double)elapsed / 1000000000.;
+	size_t total = 0, errors = 0;
+	int i;
+
+	printf("%-20s %10s %8s %12s %10s %10s %10s\n",
+	       "command", "count", "errors", "req/s", "p50 (us)", "p99 (us)", "p99.9 (us)");
+	for (i = 0; i < COMMAND_COUNT; i++) {
+		if (!stats[i].count)
+			continue;
+		qsort(stats[i].latencies, stats[i].count, sizeof(*stats[i].latencies), latency_cmp);
+		printf("%-20s %10zu %8zu %12.0f %10.1f %10.1f %10.1f\n",
+		       command_names[i], stats[i].count, stats[i].errors, (double)stats[i].count / seconds,
+		       percentile(&stats[i], 500), percentile(&stats[i], 990), percentile(&stats[i], 999));
+		total += stats[i].count;
+		errors += stats[i].errors;
+	}
+	printf("%-20s %10zu %8zu %12.0f\n", "total", total, errors, (double)total / seconds);
+}
+
+
+/**
+ * Set the weight of a command in the mix
+ * 
+ * @param   arg  The argument of -x, ‘command=weight’
+ * @return       Zero on success, -1 if the argument is invalid
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+set_weight(const char *arg)
+{
+	const char *p = strchr(arg, '=');
+	char *end;
+	unsigned long weight;
+	int i;
+
+	if (!p || !p[1])
+		return -1;
+	weight = strtoul(&p[1], &end, 10);
+	if (*end || weight > 1000000UL)
+		return -1;
+
+	for (i = 0; i < COMMAND_COUNT; i++) {
+		if (strlen(command_names[i]) == (size_t)(p - arg) && !strncmp(command_names[i], arg, (size_t)(p - arg))) {
+			command_weights[i] = (unsigned)weight;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+
+/**
+ * Run a load against a coopgammad server, check that it
+ * can re-execute without changing the gamma ramps, or
+ * check the composition and interpolation of filters
+ * 
+ * @param   argc  The number of elements in `argv`
+ * @param   argv  Command line arguments
+ * @return        0: Successful
+ *                1: An error occurred
+ */
+int
+main(int argc, char *argv[])
+{
+	struct client *clients = NULL;
+	struct pollfd *fds = NULL;
+	size_t i, n, header_size, clients_n = 16, requests = 100000, issued = 0, answered = 0;
+	uint64_t start;
+	long int arg;
+	pid_t reexec_pid = 0;
+	int error, use_binary = 0, self_test = 0, rc = 1;
+
+	ARGBEGIN {
+	case 'b':
+		use_binary = 1;
+		break;
+	case 'c':
+		arg = atol(EARGF(usage()));
+		if (arg <= 0)
+			usage();
+		clients_n = (size_t)arg;
+		break;
+	case 'n':
+		arg = atol(EARGF(usage()));
+		if (arg <= 0)
+			usage();
+		requests = (size_t)arg;
+		break;
+	case 'x':
+		if (set_weight(EARGF(usage())) < 0)
+			usage();
+		break;
+	case 't':
+		self_test = 1;
+		break;
+	case 'r':
+		arg = atol(EARGF(usage()));
+		if (arg <= 0)
+			usage();
+		reexec_pid = (pid_t)arg;
+		break;
+	default:
+		usage();
+	} ARGEND;
+
+	if (self_test) {
+		if (argc)
+			usage();
+		srand((unsigned)time(NULL) ^ (unsigned)getpid());
+		if ((rc = check_composition()) < 0) {
+			perror(argv0);
+			return 1;
+		}
+		return rc | check_interpolation();
+	}
+
+	if (argc != 1 || (reexec_pid && use_binary))
+		usage();
+	if (reexec_pid)
+		clients_n = 1;
+
+	/* Only set-gamma can be sent with binary framing. */
+	for (i = 0; use_binary && i < COMMAND_COUNT; i++)
+		if (i != SET_GAMMA)
+			command_weights[i] = 0;
+
+	for (i = 0; i < COMMAND_COUNT; i++)
+		weight_sum += command_weights[i];
+	if (!weight_sum)
+		usage();
+
+	srand((unsigned)time(NULL) ^ (unsigned)getpid());
+	header_alloc = 4096;
+
+	clients = calloc(clients_n, sizeof(*clients));
+	fds = calloc(clients_n, sizeof(*fds));
+	if (!clients || !fds)
+		goto fail;
+	for (i = 0; i < clients_n; i++)
+		clients[i].fd = -1;
+
+	for (i = 0; i < clients_n; i++) {
+		clients[i].command = COMMAND_COUNT;
+		clients[i].fd = connect_to_server(argv[0]);
+		if (clients[i].fd < 0)
+			goto fail;
+		if (fcntl(clients[i].fd, F_SETFL, O_NONBLOCK) < 0)
+			goto fail;
+		clients[i].header = malloc(header_alloc);
+		if (!clients[i].header)
+			goto fail;
+		fds[i].fd = clients[i].fd;
+	}
+
+	if (find_crtcs(clients) < 0)
+		goto fail;
+	if (!crtcs_n) {
+		fprintf(stderr, "%s: no CRTC supports gamma adjustments\n", argv0);
+		goto done;
+	}
+
+	if (reexec_pid) {
+		switch (check_reexec(clients, reexec_pid)) {
+		case 0:
+			rc = 0;
+			goto done;
+		case 1:
+			goto done;
+		default:
+			goto fail;
+		}
+	}
+
+	if (use_binary) {
+		for (i = 0; i < clients_n; i++)
+			if (use_binary_framing(&clients[i]) < 0)
+				goto fail;
+		binary = 1;
+	}
+
+	start = now();
+	for (i = 0; i < clients_n && issued < requests; i++, issued++)
+		if (issue_request(&clients[i], select_command(), &crtcs[(size_t)rand() % crtcs_n]) < 0)
+			goto fail;
+
+	while (answered < requests) {
+		for (i = 0; i < clients_n; i++)
+			fds[i].events = POLLIN | (have_pending(&clients[i]) ? POLLOUT : 0);
+		if (poll(fds, (nfds_t)clients_n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		for (i = 0; i < clients_n; i++) {
+			if (fds[i].revents & POLLOUT)
+				if (send_pending(&clients[i]) < 0)
+					goto fail;
+			if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			if (receive(&clients[i]) < 0)
+				goto fail;
+			while ((n = complete_message(&clients[i], &header_size))) {
+				if (clients[i].command == COMMAND_COUNT) {
+					fprintf(stderr, "%s: received unexpected message\n", argv0);
+					goto done;
+				}
+				error = is_error(&clients[i]);
+				discard_message(&clients[i], n);
+				if (record_response(&clients[i], error) < 0)
+					goto fail;
+				answered += 1;
+				if (issued < requests) {
+					issued += 1;
+					if (issue_request(&clients[i], select_command(), &crtcs[(size_t)rand() % crtcs_n]) < 0)
+						goto fail;
+				}
+			}
+		}
+	}
+
+	print_stats(now() - start);
+	rc = 0;
+	goto done;
+
+fail:
+	perror(argv0);
+done:
+	if (clients) {
+		for (i = 0; i < clients_n; i++) {
+			if (clients[i].fd >= 0)
+				close(clients[i].fd);
+			free(clients[i].header);
+			free(clients[i].buffer);
+		}
+	}
+	for (i = 0; i < crtcs_n; i++) {
+		free(crtcs[i].name);
+		free(crtcs[i].ramps);
+	}
+	for (i = 0; i < COMMAND_COUNT; i++)
+		free(stats[i].latencies);
+	free(crtcs);
+	free(clients);
+	free(fds);
+	return rc;
+}
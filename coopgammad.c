@@ -23,7 +23,7 @@
  * Number put in front of the marshalled data
  * so the program an detect incompatible updates
  */
-#define MARSHAL_VERSION  0
+#define MARSHAL_VERSION  11
 
 
 #ifndef GCC_ONLY
@@ -191,6 +191,36 @@ bad:
 }
 
 
+/**
+ * Parse the frame rate for transitions
+ * 
+ * @param   arg  The number of updates per second, as a string
+ * @return       The number of updates per second, 0 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static unsigned
+get_frame_rate(const char *restrict arg)
+{
+	const char *restrict p;
+	int rate;
+
+	if (!*arg || (/* avoid overflow: */ strlen(arg) > 4))
+		goto bad;
+	for (p = arg; *p; p++)
+		if ('0' > *p || *p > '9')
+			goto bad;
+
+	rate = atoi(arg);
+	if (rate > 0)
+		return (unsigned)rate;
+
+bad:
+	fprintf(stderr, "%s: invalid frame rate: %s\n", argv0, arg);
+	errno = 0;
+	return 0;
+}
+
+
 /**
  * Set up signal handlers
  * 
@@ -730,7 +760,7 @@ __attribute__((__noreturn__))
 static void
 usage(void)
 {
-	fprintf(stderr, "usage: %s [-m method] [-s site] [-fkpq]\n", argv0);
+	fprintf(stderr, "usage: %s [-m method] [-s site] [-r rate] [-fkpq]\n", argv0);
 	exit(1);
 }
 
@@ -803,6 +833,11 @@ main(int argc, char *argv[])
 		if (method < 0)
 			goto fail;
 		break;
+	case 'r':
+		frame_rate = get_frame_rate(EARGF(usage()));
+		if (!frame_rate)
+			goto fail;
+		break;
 	case 'p': preserve    = 1;     break;
 	case 'f': foreground  = 1;     break;
 	case 'k': keep_stderr = 1;     break;
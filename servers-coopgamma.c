@@ -4,84 +4,232 @@
 #include "state.h"
 #include "communication.h"
 #include "util.h"
+#include "types-blob.h"
+#include "types-class.h"
+#include "types-function.h"
 #include "types-output.h"
+#include "types-stats.h"
+#include "types-transaction.h"
 
-#include <libclut.h>
-
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 
 /**
- * Apply a filter on top of another filter
- * 
- * @param  dest         The output for the resulting ramp-trio, must be initialised
- * @param  application  The red, green and blue ramps, as one single raw array,
- *                      of the filter that should be applied
- * @param  depth        -1: `float` stops
- *                      -2: `double` stops
- *                      Other: the number of bits of each (integral) stop
- * @param  base         The CLUT on top of which the new filter should be applied,
- *                      this can be the same pointer as `dest`
+ * Get the ramps of a node in the segment tree of an output
+ * 
+ * @param   output  The output
+ * @param   node    The index of the node
+ * @return          The node's red, green and blue ramps,
+ *                  as one single raw array
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static inline void *
+tree_node(const struct output *restrict output, size_t node)
+{
+	if (node >= output->tree_leaves)
+		return output->table_filters[node - output->tree_leaves].ramps;
+	return output->table_tree[node].u8.red;
+}
+
+
+/**
+ * Recompose a node in the segment tree of an output
+ * from its two children
+ * 
+ * @param  output  The output
+ * @param  node    The index of the node
+ * @param  height  The height of the node, 1 if its children are leaves
  */
+GCC_ONLY(__attribute__((__nonnull__)))
 static void
-apply_filter(union gamma_ramps *dest, void *restrict application, int depth, union gamma_ramps *base)
+compose_node(struct output *restrict output, size_t node, size_t height)
 {
-	union gamma_ramps app;
-	size_t bytedepth;
-	size_t red_width, green_width, blue_width;
-
-	if (depth == -1)
-		bytedepth = sizeof(float);
-	else if (depth == -2)
-		bytedepth = sizeof(double);
-	else
-		bytedepth = (size_t)depth / 8;
+	union gamma_ramps *dest = output->table_tree + node;
+	size_t n = output->table_size, leaves = output->tree_leaves;
 
-	red_width   = (app.u8.red_size   = base->u8.red_size)   * bytedepth;
-	green_width = (app.u8.green_size = base->u8.green_size) * bytedepth;
-	blue_width  = (app.u8.blue_size  = base->u8.blue_size)  * bytedepth;
+	if ((node << height) - leaves >= n)
+		return; /* The node does not cover any filter. */
 
-	app.u8.red   = application;
-	app.u8.green = &app.u8.red[red_width];
-	app.u8.blue  = &app.u8.green[green_width];
+	memcpy(dest->u8.red, tree_node(output, 2 * node), output->ramps_size);
+	if (((2 * node + 1) << (height - 1)) - leaves < n)
+		gamma_ramps_apply(dest, tree_node(output, 2 * node + 1), output->depth, dest);
+}
 
-	if (dest != base) {
-		memcpy(dest->u8.red,   base->u8.red,   red_width);
-		memcpy(dest->u8.green, base->u8.green, green_width);
-		memcpy(dest->u8.blue,  base->u8.blue,  blue_width);
+
+/**
+ * Update the segment tree of an output
+ * 
+ * @param   output         The output, must have at least one filter
+ * @param   first_updated  The index of the first altered slot in the filter table
+ * @param   last_updated   The index of the last altered slot in the filter table, plus 1
+ * @return                 Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+update_tree(struct output *restrict output, size_t first_updated, size_t last_updated)
+{
+	size_t n = output->table_size, leaves, i, lo, hi, height;
+	union gamma_ramps *tree;
+
+	if (output->tree_leaves < n) {
+		for (leaves = 2; leaves < n; leaves <<= 1);
+		tree = calloc(leaves, sizeof(*tree));
+		if (!tree)
+			return -1;
+		for (i = 1; i < leaves; i++) {
+			if (make_plain_ramps(tree + i, output) < 0) {
+				while (--i)
+					libgamma_gamma_ramps8_destroy(&tree[i].u8);
+				free(tree);
+				return -1;
+			}
+		}
+		for (i = 1; i < output->tree_leaves; i++)
+			libgamma_gamma_ramps8_destroy(&output->table_tree[i].u8);
+		free(output->table_tree);
+		output->table_tree = tree;
+		output->tree_leaves = leaves;
+		first_updated = 0;
+		last_updated = n;
 	}
 
-	switch (depth) {
-	case 8:
-		libclut_apply(&dest->u8, UINT8_MAX, uint8_t, &app.u8, UINT8_MAX, uint8_t, 1, 1, 1);
-		break;
+	/* If filters were removed from the end of the table, the nodes
+	 * that covered both them and the new last filter must be updated. */
+	if (first_updated >= n)
+		first_updated = n - 1;
+	if (last_updated > n)
+		last_updated = n;
+	if (last_updated <= first_updated)
+		last_updated = first_updated + 1;
+
+	leaves = output->tree_leaves;
+	lo = (leaves + first_updated) >> 1;
+	hi = (leaves + last_updated - 1) >> 1;
+	for (height = 1; lo; height++, lo >>= 1, hi >>= 1)
+		for (i = lo; i <= hi; i++)
+			compose_node(output, i, height);
 
-	case 16:
-		libclut_apply(&dest->u16, UINT16_MAX, uint16_t, &app.u16, UINT16_MAX, uint16_t, 1, 1, 1);
-		break;
+	return 0;
+}
 
-	case 32:
-		libclut_apply(&dest->u32, UINT32_MAX, uint32_t, &app.u32, UINT32_MAX, uint32_t, 1, 1, 1);
-		break;
 
-	case 64:
-		libclut_apply(&dest->u64, UINT64_MAX, uint64_t, &app.u64, UINT64_MAX, uint64_t, 1, 1, 1);
-		break;
+/**
+ * Bring the elements in the result table of an
+ * output up to date up to a selected index
+ * 
+ * @param   output  The output
+ * @param   end     The number of elements, from the beginning,
+ *                  in `output->table_sums` that shall be up to date
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+update_sums(struct output *restrict output, size_t end)
+{
+	const union gamma_ramps *plain;
+	size_t i = output->table_sums_valid;
 
-	case -1:
-		libclut_apply(&dest->f, 1.0f, float, &app.d, 1.0f, float, 1, 1, 1);
-		break;
+	if (i >= end)
+		return 0;
 
-	case -2:
-		libclut_apply(&dest->d, (double)1, double, &app.f, (double)1, double, 1, 1, 1);
-		break;
+	if (!i) {
+		if (!(plain = get_plain_ramps(output)))
+			return -1;
+		gamma_ramps_apply(&output->table_sums[0], output->table_filters[0].ramps, output->depth, plain);
+		i = 1;
+	}
 
-	default:
-		abort();
+	for (; i < end; i++)
+		gamma_ramps_apply(&output->table_sums[i], output->table_filters[i].ramps, output->depth, &output->table_sums[i - 1]);
+
+	output->table_sums_valid = end;
+	return 0;
+}
+
+
+/**
+ * Recalculate the resulting gamma of an output, that is
+ * the last element in its result table, if any filter
+ * has been updated since it was last recalculated
+ * 
+ * @param   output  The output, must have at least one filter
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+recompose_filters(struct output *restrict output)
+{
+	const union gamma_ramps *plain;
+	size_t n = output->table_size;
+	uint64_t start;
+
+	if (!output->last_updated)
+		return 0;
+
+	start = stats_clock();
+
+	if (output->depth < 0) {
+		/* Interpolation between stops does not compose associatively,
+		 * so the segment tree cannot be used for floating-point ramps
+		 * without changing the result. */
+		if (update_sums(output, n) < 0)
+			return -1;
+	} else {
+		if (!(plain = get_plain_ramps(output)))
+			return -1;
+		if (update_tree(output, output->first_updated, output->last_updated) < 0)
+			return -1;
+		gamma_ramps_apply(&output->table_sums[n - 1], output->table_tree[1].u8.red, output->depth, plain);
+		if (output->table_sums_valid == n - 1)
+			output->table_sums_valid = n;
 	}
+
+	output->last_updated = 0;
+	stats_time(&stats, TIMING_COMPOSITION, start);
+	stats.counters[COUNTER_RECOMPOSITIONS] += 1;
+	return 0;
+}
+
+
+/**
+ * Make room for filters on an output, so
+ * that adding them to it cannot fail
+ * 
+ * @param   out  The output
+ * @param   n    The number of filters to make room for
+ * @return       Zero on success, -1 on error
+ */
+static int
+reserve_filters(struct output *restrict out, size_t n)
+{
+	size_t alloc;
+	void *new;
+
+	/* The table is grown geometrically, so that adding
+	 * a filter costs amortised constant reallocation */
+	if (n > out->table_alloc) {
+		alloc = out->table_alloc ? 2 * out->table_alloc : 4;
+		if (alloc < n)
+			alloc = n;
+
+		new = realloc(out->table_filters, alloc * sizeof(*out->table_filters));
+		if (!new)
+			return -1;
+		out->table_filters = new;
+
+		if (output_grow_sums(out, alloc) < 0)
+			return -1;
+
+		out->table_alloc = alloc;
+	}
+
+	return output_reserve_index(out, n);
 }
 
 
@@ -97,9 +245,7 @@ remove_filter(struct output *restrict out, struct filter *restrict filter)
 {
 	size_t i, n = out->table_size;
 
-	for (i = 0; i < n; i++)
-		if (!strcmp(filter->class, out->table_filters[i].class))
-			break;
+	i = output_find_filter(out, filter->class);
 
 	if (i == out->table_size) {
 		fprintf(stderr, "%s: ignoring attempt to removing non-existing filter on CRTC %s: %s\n",
@@ -107,14 +253,18 @@ remove_filter(struct output *restrict out, struct filter *restrict filter)
 		return (ssize_t)(out->table_size);
 	}
 
+	output_unindex_filter(out, filter->class);
 	filter_destroy(&out->table_filters[i]);
-	libgamma_gamma_ramps8_destroy(&out->table_sums[i].u8);
 
+	/* The result table is not shifted, the elements from
+	 * the removed filter and onwards are out of date */
 	n = n - i - 1;
 	memmove(out->table_filters + i, out->table_filters + i + 1, n * sizeof(*(out->table_filters)));
-	memmove(out->table_sums    + i, out->table_sums    + i + 1, n * sizeof(*(out->table_sums)));
 	out->table_size--;
 
+	if (output_index_filters(out, i) < 0)
+		return -1;
+
 	return (ssize_t)i;
 }
 
@@ -123,115 +273,167 @@ remove_filter(struct output *restrict out, struct filter *restrict filter)
  * Add a filter to an output
  * 
  * @param   out     The output
- * @param   filter  The filter
- * @return          The index given to the filter, -1 on error
+ * @param   filter  The filter, its class must be interned
+ * @param   end     Output parameter for the index of the last
+ *                  filter that was added, removed, updated, or
+ *                  moved, plus 1, `out->table_size` if filters
+ *                  were added or removed
+ * @return          The index of the first filter that was added,
+ *                  removed, updated, or moved, -1 on error
  */
 static ssize_t
-add_filter(struct output *restrict out, struct filter *restrict filter)
+add_filter(struct output *restrict out, struct filter *restrict filter, size_t *restrict end)
 {
-	size_t i, n = out->table_size;
-	int r = -1;
-	void *new;
+	size_t i, old = 0, n = out->table_size;
+	int moved = 0;
+	ssize_t removed;
 
 	/* Remove? */
-	if (filter->lifespan == LIFESPAN_REMOVE)
-		return remove_filter(out, filter);
+	if (filter->lifespan == LIFESPAN_REMOVE) {
+		removed = remove_filter(out, filter);
+		*end = out->table_size;
+		return removed;
+	}
 
 	/* Update? */
-	for (i = 0; i < n; i++)
-		if (!strcmp(filter->class, out->table_filters[i].class))
-			break;
-	if (i != n) {
+	i = output_find_filter(out, filter->class);
+	if (i != n && out->table_filters[i].priority == filter->priority) {
 		filter_destroy(&out->table_filters[i]);
 		out->table_filters[i] = *filter;
 		filter->class = NULL;
 		filter->ramps = NULL;
+		filter->ramps_mapped = 0;
+		*end = i + 1;
 		return (ssize_t)i;
 	}
 
-	/* Add! */
-	for (i = 0; i < n; i++)
-		if (filter->priority > out->table_filters[i].priority)
-			break;
-
-	if (n == out->table_alloc) {      
-		new = realloc(out->table_filters, (n + 10) * sizeof(*out->table_filters));
-		if (!new)
+	/* A filter whose priority is changed is moved, so that
+	 * the table remains sorted by priority */
+	if (i != n) {
+		if (remove_filter(out, filter) < 0)
 			return -1;
-		out->table_filters = new;
+		old = i;
+		moved = 1;
+		n -= 1;
+	}
 
-		new = realloc(out->table_sums, (n + 10) * sizeof(*out->table_sums));
-		if (!new)
-			return -1;
-		out->table_sums = new;
+	/* Add! The filter is placed after all filters with the same priority */
+	i = output_bisect_priority(out, filter->priority, 0);
 
-		out->table_alloc += 10;
-	}
+	if (reserve_filters(out, n + 1) < 0)
+		return -1;
 
+	/* The result table is not shifted, the elements from
+	 * the added filter and onwards are out of date */
 	memmove(&out->table_filters[i + 1], &out->table_filters[i], (n - i) * sizeof(*out->table_filters));
-	memmove(&out->table_sums   [i + 1], &out->table_sums   [i], (n - i) * sizeof(*out->table_sums));
 	out->table_size++;
 
 	out->table_filters[i] = *filter;
 	filter->class = NULL;
 	filter->ramps = NULL;
+	filter->ramps_mapped = 0;
 
-	COPY_RAMP_SIZES(&out->table_sums[i].u8, out);
-	switch (out->depth) {
-	case  8: r = libgamma_gamma_ramps8_initialise(&(out->table_sums[i].u8));   break;
-	case 16: r = libgamma_gamma_ramps16_initialise(&(out->table_sums[i].u16)); break;
-	case 32: r = libgamma_gamma_ramps32_initialise(&(out->table_sums[i].u32)); break;
-	case 64: r = libgamma_gamma_ramps64_initialise(&(out->table_sums[i].u64)); break;
-	case -1: r = libgamma_gamma_rampsf_initialise(&(out->table_sums[i].f));    break;
-	case -2: r = libgamma_gamma_rampsd_initialise(&(out->table_sums[i].d));    break;
-	default:
-		abort();
-	}
-	if (r < 0)
+	if (output_index_filters(out, i) < 0)
 		return -1;
 
+	if (moved) {
+		*end = (old > i ? old : i) + 1;
+		return (ssize_t)(old < i ? old : i);
+	}
+
+	*end = out->table_size;
 	return (ssize_t)i;
 }
 
 
+/**
+ * Stop fading a filter, the filter keeps
+ * the ramps it has been faded to so far
+ * 
+ * @param  crtc   The name of the output the filter is applied to
+ * @param  class  The interned class of the filter
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static void
+cancel_transition(const char *restrict crtc, const char *restrict class)
+{
+	size_t i;
+
+	for (i = 0; i < transitions_n; i++) {
+		if (transitions[i].class == class && !strcmp(transitions[i].crtc, crtc)) {
+			transition_destroy(transitions + i);
+			transitions[i] = transitions[--transitions_n];
+			return;
+		}
+	}
+}
+
+
 /**
  * Handle a closed connection
  * 
+ * @param   conn    The index of the connection
  * @param   client  The file descriptor for the client
  * @return          Zero on success, -1 on error
  */
 int
-connection_closed(int client)
+connection_closed(size_t conn, int client)
 {
-	size_t i, j, k;
-	int remove;
-	struct output *output;
-	ssize_t updated;
+	struct ownership *restrict owned = ownerships + conn;
+	struct owned_filter *restrict entry;
+	struct output *restrict output;
+	struct filter *restrict filter;
+	size_t i, j, k, n, first;
+	int r = 0;
+
+	/* The list is sorted by output, so each output's filters are
+	 * adjacent and the output only needs to be looked up once */
+	for (i = 0; i < owned->n; i = n) {
+		entry = owned->filters + i;
+		for (n = i + 1; n < owned->n; n++)
+			if (strcmp(owned->filters[n].crtc, entry->crtc))
+				break;
+
+		output = output_find_by_name(entry->crtc, outputs, outputs_n);
+		if (!output)
+			continue;
+
+		/* Destroy the filters that are still owned, leaving them
+		 * marked as removed, so that the table can be compacted
+		 * in one pass from the first removed filter */
+		first = output->table_size;
+		for (; entry != owned->filters + n; entry++) {
+			j = output_find_filter(output, entry->class);
+			if (j == output->table_size)
+				continue;
+			filter = output->table_filters + j;
+			if (filter->client != client || filter->lifespan != LIFESPAN_UNTIL_DEATH)
+				continue;
+			cancel_transition(output->name, filter->class);
+			output_unindex_filter(output, filter->class);
+			filter_destroy(filter);
+			filter->class = NULL;
+			filter->lifespan = LIFESPAN_REMOVE;
+			if (j < first)
+				first = j;
+		}
+		if (first == output->table_size)
+			continue;
 
-	for (i = 0; i < outputs_n; i++) {
-		output = outputs + i;
-		updated = -1;
-		for (j = k = 0; j < output->table_size; j += !remove, k++) {
-			if (j != k) {
-				output->table_filters[j] = output->table_filters[k];
-				output->table_sums[j]    = output->table_sums[k];
-			}
-			remove = output->table_filters[j].client == client;
-			remove = remove && output->table_filters[j].lifespan == LIFESPAN_UNTIL_DEATH;
-			if (remove) {
-				filter_destroy(&output->table_filters[j]);
-				libgamma_gamma_ramps8_destroy(&output->table_sums[j].u8);
-				output->table_size -= 1;
-				if (updated == -1)
-					updated = (ssize_t)j;
-			}
+		for (j = k = first; k < output->table_size; k++) {
+			if (output->table_filters[k].lifespan == LIFESPAN_REMOVE)
+				continue;
+			output->table_filters[j++] = output->table_filters[k];
 		}
-		if (updated >= 0)
-			if (flush_filters(output, (size_t)updated) < 0)
-				return -1;
+		output->table_size = j;
+
+		if (output_index_filters(output, first) < 0 ||
+		    flush_filters(output, EVENT_FILTER_REMOVED, first, output->table_size) < 0)
+			r = -1;
 	}
 
-	return 0;
+	ownership_destroy(owned);
+	return r;
 }
 
 
@@ -256,6 +458,8 @@ handle_get_gamma(size_t conn, const char *restrict message_id, const char *restr
 	int64_t high, low;
 	int coal;
 	char *restrict buf;
+	const void *cached;
+	const union gamma_ramps *plain;
 	size_t start, end, len, n, i;
 	char depth[3 * sizeof(output->depth) + 2];
 	char tables[sizeof("Tables: \n") + 3 * sizeof(size_t)];
@@ -282,13 +486,10 @@ handle_get_gamma(size_t conn, const char *restrict message_id, const char *restr
 	else if (output->supported == LIBGAMMA_NO)
 		return send_error("selected CRTC does not support gamma adjustments");
 
-	for (start = 0; start < output->table_size; start++)
-		if (output->table_filters[start].priority <= high)
-			break;
-
-	for (end = output->table_size; end > 0; end--)
-		if (output->table_filters[end - 1].priority >= low)
-			break;
+	start = output_bisect_priority(output, high, 1);
+	end   = output_bisect_priority(output, low, 0);
+	if (end < start)
+		end = start;
 
 	switch (output->depth) {
 	case -2: strcpy(depth, "d"); break;
@@ -322,16 +523,32 @@ handle_get_gamma(size_t conn, const char *restrict message_id, const char *restr
 
 	if (coal) {
 		if (!start && start < end) {
+			if ((end == output->table_size ? recompose_filters(output) : update_sums(output, end)) < 0) {
+				pool_free(buf);
+				return -1;
+			}
 			memcpy(&buf[n], output->table_sums[end - 1].u8.red, output->ramps_size);
+		} else if (start == end) {
+			if (!(plain = get_plain_ramps(output))) {
+				pool_free(buf);
+				return -1;
+			}
+			memcpy(&buf[n], plain->u8.red, output->ramps_size);
+		} else if ((cached = output_find_window(output, start, end))) {
+			memcpy(&buf[n], cached, output->ramps_size);
+			stats.counters[COUNTER_WINDOW_CACHE_HITS] += 1;
 		} else {
 			if (make_plain_ramps(&ramps, output)) {
-				free(buf);
+				pool_free(buf);
 				return -1;
 			}
 			for (i = start; i < end; i++)
-				apply_filter(&ramps, output->table_filters[i].ramps, output->depth, &ramps);
+				gamma_ramps_apply(&ramps, output->table_filters[i].ramps, output->depth, &ramps);
 			memcpy(&buf[n], ramps.u8.red, output->ramps_size);
+			/* Failure to cache the window only costs a recomposition */
+			output_cache_window(output, start, end, ramps.u8.red);
 			libgamma_gamma_ramps8_destroy(&(ramps.u8));
+			stats.counters[COUNTER_WINDOW_CACHE_MISSES] += 1;
 		}
 		n += output->ramps_size;
 	} else {
@@ -357,47 +574,439 @@ handle_get_gamma(size_t conn, const char *restrict message_id, const char *restr
 }
 
 
+/**
+ * Check that a filter class is well-formatted, that is,
+ * that it has the format ‘$PACKAGE::$COMMAND::$RULE’
+ * where ‘$PACKAGE’ is not empty
+ * 
+ * @param   class  The class
+ * @return         1 if the class is well-formatted, 0 otherwise
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static int
+check_class(const char *restrict class)
+{
+	const char *restrict p;
+	const char *restrict q;
+
+	p = strstr(class, "::");
+	if (!p || p == class)
+		return 0;
+	q = strstr(p + 2, "::");
+	if (!q || q == p)
+		return 0;
+
+	return 1;
+}
+
+
+/**
+ * Map the ramps of a filter from a memfd that a client has sent
+ * 
+ * The memfd must be sealed against writing and shrinking, so
+ * that the ramps cannot change, and cannot be truncated away,
+ * while they are in use
+ * 
+ * @param   fd    The file descriptor
+ * @param   size  The byte-size of the ramps
+ * @return        The ramps, mapped read-only, `NULL` on error
+ */
+static void *
+map_ramps(int fd, size_t size)
+{
+#if defined(F_GET_SEALS)
+	struct stat attr;
+	void *ramps;
+	int seals;
+
+	seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0)
+		return NULL;
+	if ((seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) != (F_SEAL_WRITE | F_SEAL_SHRINK)) {
+		errno = EPERM;
+		return NULL;
+	}
+
+	if (fstat(fd, &attr) < 0)
+		return NULL;
+	if (attr.st_size < 0 || (size_t)attr.st_size < size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ramps = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	return ramps == MAP_FAILED ? NULL : ramps;
+#else
+	(void) fd;
+	(void) size;
+	errno = ENOTSUP;
+	return NULL;
+#endif
+}
+
+
+/**
+ * Check whether two outputs have the same gamma ramp layout,
+ * so that the same filter ramps can be applied to both
+ * 
+ * @param   a  One of the outputs
+ * @param   b  The other output
+ * @return     1 if the outputs have the same layout, 0 otherwise
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static int
+same_layout(const struct output *restrict a, const struct output *restrict b)
+{
+	return a->depth      == b->depth      &&
+	       a->red_size   == b->red_size   &&
+	       a->green_size == b->green_size &&
+	       a->blue_size  == b->blue_size;
+}
+
+
+/**
+ * Add, update, or remove a filter on an output, and
+ * update the ownership list of the requesting connection
+ * 
+ * @param   conn    The index of the connection that sent the request
+ * @param   output  The output
+ * @param   filter  The filter, with an interned class, the ownership
+ *                  of its class and ramps is transferred to this function
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+change_filter(size_t conn, struct output *restrict output, struct filter *restrict filter)
+{
+	int saved_errno, owned_before, owned_after;
+	const char *class = filter->class;
+	enum lifespan lifespan = filter->lifespan;
+	enum event event;
+	ssize_t r;
+	size_t i, end;
+
+	/* A filter that is replaced or removed is no longer faded */
+	cancel_transition(output->name, class);
+
+	/* The ownership is recorded before the filter is added, so
+	 * that a failure leaves the filter table unchanged; a stale
+	 * entry is harmless as entries are verified on disconnection */
+	i = output_find_filter(output, class);
+	owned_before = i < output->table_size;
+	owned_before = owned_before && output->table_filters[i].client == filter->client;
+	owned_before = owned_before && output->table_filters[i].lifespan == LIFESPAN_UNTIL_DEATH;
+	owned_after = lifespan == LIFESPAN_UNTIL_DEATH;
+	if (owned_after && !owned_before && ownership_add(&ownerships[conn], output->name, class) < 0) {
+		r = -1;
+		goto out;
+	}
+
+	i = output->table_size;
+	r = add_filter(output, filter, &end);
+	if (r >= 0 && owned_before && !owned_after)
+		ownership_remove(&ownerships[conn], output->name, class);
+
+out:
+	saved_errno = errno;
+	filter_destroy(filter);
+	errno = saved_errno;
+	if (r < 0)
+		return -1;
+
+	/* Nothing has changed if a non-existing filter was removed */
+	if (i == output->table_size && lifespan == LIFESPAN_REMOVE)
+		return 0;
+	event = i < output->table_size ? EVENT_FILTER_ADDED :
+	        i > output->table_size ? EVENT_FILTER_REMOVED : EVENT_FILTER_UPDATED;
+	return flush_filters(output, event, (size_t)r, end);
+}
+
+
+/**
+ * Add, update, or remove a filter as requested with
+ * ‘Command: set-gamma’, the filter's class is interned,
+ * and the caller keeps its ownership of it
+ * 
+ * If the filter is applied to multiple outputs, they
+ * will share one copy of the ramps, and if an error
+ * occurs the filter may have been applied to some
+ * of the outputs
+ * 
+ * If the connection has begun a transaction, the
+ * change is staged rather than applied
+ * 
+ * @param   conn     The index of the connection that sent the request
+ * @param   targets  The outputs to apply the filter to, they
+ *                   must all have the same gamma ramp layout
+ *                   unless `filter->lifespan == LIFESPAN_REMOVE`
+ * @param   n        The number of elements in `targets`, at least 1
+ * @param   filter   The filter, `filter->ramps` is ignored
+ * @param   ramps    The filter's ramps, ignored if
+ *                   `filter->lifespan == LIFESPAN_REMOVE`,
+ *                   must be `targets[0]->ramps_size` bytes
+ * @param   mapped   0 if the ramps shall be copied, otherwise
+ *                   the size of the memory mapping `ramps` is
+ *                   the beginning of, the ownership of which is
+ *                   then transferred to this function, must be
+ *                   0 if `filter->lifespan == LIFESPAN_REMOVE`
+ * @return           Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__(2, 4))))
+static int
+set_filter(size_t conn, struct output *const *restrict targets, size_t n, struct filter *restrict filter,
+           const void *restrict ramps, size_t mapped)
+{
+	struct transaction *restrict transaction = transactions + conn;
+	struct filter copy;
+	size_t i, ramps_size;
+	int saved_errno;
+
+	filter->ramps = NULL;
+	filter->ramps_mapped = 0;
+	filter->class = class_intern(filter->class);
+	if (!filter->class)
+		goto fail;
+
+	ramps_size = 0;
+	if (filter->lifespan != LIFESPAN_REMOVE) {
+		ramps_size = targets[0]->ramps_size;
+		/* Mapped ramps are used as is, unless they must be
+		 * shared between outputs or identical ramps are
+		 * already stored, in which case they are interned */
+		if (mapped && n == 1 && !(filter->ramps = blob_find(ramps, ramps_size))) {
+			filter->ramps = (void *)ramps;
+			filter->ramps_mapped = mapped;
+			mapped = 0;
+		} else if (!filter->ramps) {
+			filter->ramps = blob_intern(ramps, ramps_size);
+			if (!filter->ramps)
+				goto fail;
+		}
+		if (mapped) {
+			munmap((void *)ramps, mapped);
+			mapped = 0;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		/* Every output but the last gets its own reference
+		 * to the class and the ramps, the last output gets
+		 * the caller's references */
+		copy = *filter;
+		if (i + 1 < n) {
+			if (!(copy.class = class_intern(filter->class)))
+				goto fail;
+			if (copy.ramps)
+				blob_ref(copy.ramps);
+		} else {
+			filter->class = NULL;
+			filter->ramps = NULL;
+			filter->ramps_mapped = 0;
+		}
+
+		if (transaction->open) {
+			if (transaction_stage(transaction, targets[i], &copy) < 0)
+				goto fail;
+		} else {
+			if (change_filter(conn, targets[i], &copy) < 0)
+				goto fail;
+		}
+	}
+
+	return 0;
+
+fail:
+	saved_errno = errno;
+	filter_destroy(filter);
+	if (mapped)
+		munmap((void *)ramps, mapped);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Get a copy of the ramps a filter has on an output
+ * 
+ * @param   output  The output
+ * @param   class   The class of the filter
+ * @return          A copy of the filter's ramps, or of identity
+ *                  mapping ramps if the output has no such filter,
+ *                  `output->ramps_size` bytes, `NULL` on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static void *
+current_ramps(struct output *restrict output, const char *restrict class)
+{
+	const union gamma_ramps *plain;
+	char *interned, *ramps;
+	size_t i, red, green;
+
+	if (!(interned = class_intern(class)))
+		return NULL;
+	i = output_find_filter(output, interned);
+	class_release(interned);
+	if (i < output->table_size)
+		return memdup(output->table_filters[i].ramps, output->ramps_size);
+
+	if (!(plain = get_plain_ramps(output)))
+		return NULL;
+	if (!(ramps = malloc(output->ramps_size)))
+		return NULL;
+	red   = output->ramps_size / (output->red_size + output->green_size + output->blue_size);
+	green = red * output->green_size;
+	red   = red * output->red_size;
+	memcpy(ramps, plain->u8.red, red);
+	memcpy(&ramps[red], plain->u8.green, green);
+	memcpy(&ramps[red + green], plain->u8.blue, output->ramps_size - red - green);
+	return ramps;
+}
+
+
+/**
+ * Fade filters that have just been set from the
+ * ramps they had before, to the ramps they were set to
+ * 
+ * @param   targets   The outputs the filter was applied to
+ * @param   n         The number of elements in `targets`
+ * @param   class     The class of the filter
+ * @param   starts    For each output, the ramps the filter had before
+ *                    it was set, as returned by `current_ramps`, the
+ *                    ownership of each is transferred to this function
+ *                    and the element is set to `NULL` when it is
+ * @param   duration  The duration of the fade, in nanoseconds
+ * @param   easing    The easing curve of the fade
+ * @return            Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+begin_transitions(struct output *const *restrict targets, size_t n, const char *restrict class,
+                  void **restrict starts, uint64_t duration, enum easing easing)
+{
+	struct transition *restrict transition;
+	struct output *restrict output;
+	struct filter *restrict filter, old;
+	uint64_t begin = stats_clock();
+	size_t i, j, alloc;
+	void *new;
+
+	for (i = 0; i < n; i++) {
+		output = targets[i];
+
+		if (transitions_n == transitions_alloc) {
+			alloc = transitions_alloc ? 2 * transitions_alloc : 4;
+			new = realloc(transitions, alloc * sizeof(*transitions));
+			if (!new)
+				return -1;
+			transitions = new;
+			transitions_alloc = alloc;
+		}
+
+		transition = transitions + transitions_n;
+		transition->crtc = NULL;
+		transition->start = NULL;
+		transition->target = NULL;
+		if (!(transition->class = class_intern(class)))
+			return -1;
+		j = output_find_filter(output, transition->class);
+		if (j == output->table_size) {
+			transition_destroy(transition);
+			continue;
+		}
+		filter = output->table_filters + j;
+
+		transition->crtc = memdup(output->name, strlen(output->name) + 1);
+		transition->target = memdup(filter->ramps, output->ramps_size);
+		if (!transition->crtc || !transition->target) {
+			transition_destroy(transition);
+			return -1;
+		}
+
+		/* The filter is faded in place, so it needs ramps of its own */
+		if (!(new = blob_private(starts[i], output->ramps_size))) {
+			transition_destroy(transition);
+			return -1;
+		}
+		old = *filter;
+		old.class = NULL;
+		filter_destroy(&old);
+		filter->ramps = new;
+		filter->ramps_mapped = 0;
+
+		transition->start = starts[i];
+		starts[i] = NULL;
+		transition->ramps_size = output->ramps_size;
+		transition->depth = output->depth;
+		transition->begin = begin;
+		transition->duration = duration;
+		transition->easing = easing;
+		transitions_n += 1;
+
+		/* The filter has already been flushed by `change_filter` */
+	}
+
+	return 0;
+}
+
+
 /**
  * Handle a ‘Command: set-gamma’ message
  * 
  * @param   conn        The index of the connection
  * @param   message_id  The value of the ‘Message ID’ header
- * @param   crtc        The value of the ‘CRTC’ header
+ * @param   crtcs       The values of the ‘CRTC’ headers, in order, a
+ *                      single ‘*’ selects all CRTC:s that have the
+ *                      same gamma ramp layout as the first CRTC
+ * @param   crtcs_n     The number of elements in `crtcs`
  * @param   priority    The value of the ‘Priority’ header
  * @param   class       The value of the ‘Class’ header
  * @param   lifespan    The value of the ‘Lifespan’ header
+ * @param   function    The value of the ‘Function’ header, if set, the
+ *                      filter is described by a function rather than
+ *                      by ramps in the payload
+ * @param   parameters  The value of the ‘Parameters’ header
+ * @param   duration    The value of the ‘Duration’ header, if set, the
+ *                      filter is faded from its current ramps, or from
+ *                      identity mapping ramps if it is new, over this
+ *                      many seconds
+ * @param   easing      The value of the ‘Easing’ header
+ * @param   memfd       The memfd with the ramps if sent with
+ *                      ‘Transport: memfd’, -1 otherwise;
+ *                      the caller keeps its ownership of it
  * @return              Zero on success (even if ignored), -1 on error,
  *                      1 if connection closed
  */
 int
-handle_set_gamma(size_t conn, const char *restrict message_id, const char *restrict crtc,
-                 const char *restrict priority, const char *restrict class, const char *restrict lifespan)
+handle_set_gamma(size_t conn, const char *restrict message_id, const char *const *restrict crtcs, size_t crtcs_n,
+                 const char *restrict priority, const char *restrict class, const char *restrict lifespan,
+                 const char *restrict function, const char *restrict parameters,
+                 const char *restrict duration, const char *restrict easing, int memfd)
 {
 	struct message *restrict msg = inbound + conn;
-	struct output *restrict output = NULL;
+	struct output *output = NULL;
+	struct output **targets = &output;
 	struct filter filter;
-	char *restrict p;
-	char *restrict q;
-	int saved_errno;
-	ssize_t r;
-
-	if (!crtc)     return send_error("protocol error: 'CRTC' header omitted");
+	struct function fn;
+	const void *ramps = msg->payload;
+	void *evaluated = NULL;
+	void *start = NULL;
+	void **starts = &start;
+	size_t i, n = 0, mapped = 0, starts_n = 0;
+	uint64_t fade = 0;
+	enum easing ease = EASING_LINEAR;
+	double seconds;
+	char *end;
+	int saved_errno, wildcard, r;
+
+	if (!crtcs_n)  return send_error("protocol error: 'CRTC' header omitted");
 	if (!class)    return send_error("protocol error: 'Class' header omitted");
 	if (!lifespan) return send_error("protocol error: 'Lifespan' header omitted");
 
 	filter.client   = connections[conn];
 	filter.priority = !priority ? 0 : (int64_t)atoll(priority);
-	filter.ramps    = NULL;
+	filter.class    = (char *)class;
 
-	output = output_find_by_name(crtc, outputs, outputs_n);
-	if (!output)
-		return send_error("CRTC does not exists");
-
-	p = strstr(class, "::");
-	if (!p || p == class)
-		return send_error("protocol error: malformatted value for 'Class' header");
-	q = strstr(p + 2, "::");
-	if (!q || q == p)
+	if (!check_class(class))
 		return send_error("protocol error: malformatted value for 'Class' header");
 
 	if (!strcmp(lifespan, "until-removal"))
@@ -410,83 +1019,585 @@ handle_set_gamma(size_t conn, const char *restrict message_id, const char *restr
 		return send_error("protocol error: recognised value for 'Lifespan' header");
 
 	if (filter.lifespan == LIFESPAN_REMOVE) {
-		if (msg->payload_size)
+		if (msg->payload_size || memfd >= 0)
 			fprintf(stderr, "%s: ignoring superfluous payload on Command: set-gamma message with "
 			                "Lifespan: remove\n", argv0);
 		if (priority)
 			fprintf(stderr, "%s: ignoring superfluous Priority header on Command: set-gamma message with "
 			                "Lifespan: remove\n", argv0);
-	} else if (msg->payload_size != output->ramps_size) {
-		return send_error("invalid payload: size of message payload does matched the expectancy");
+		if (function || parameters)
+			fprintf(stderr, "%s: ignoring superfluous Function and Parameters headers on Command: set-gamma "
+			                "message with Lifespan: remove\n", argv0);
+		if (duration || easing)
+			fprintf(stderr, "%s: ignoring superfluous Duration and Easing headers on Command: set-gamma "
+			                "message with Lifespan: remove\n", argv0);
+		duration = easing = NULL;
 	} else if (!priority) {
 		return send_error("protocol error: 'Priority' header omitted");
+	} else if (function) {
+		if (!parameters)
+			return send_error("protocol error: 'Parameters' header omitted");
+		switch (function_parse(&fn, function, parameters)) {
+		case 0:
+			break;
+		case -1:
+			return send_error("protocol error: unrecognised value for 'Function' header");
+		default:
+			return send_error("protocol error: malformatted value for 'Parameters' header");
+		}
+		if (msg->payload_size || memfd >= 0)
+			return send_error("invalid payload: a filter described by a function must not have ramps");
+	} else if (parameters) {
+		fprintf(stderr, "%s: ignoring superfluous Parameters header on Command: set-gamma message "
+		                "without Function header\n", argv0);
 	}
 
-	filter.class = memdup(class, strlen(class) + 1);
-	if (!filter.class)
-		goto fail;
+	if (duration) {
+		seconds = strtod(duration, &end);
+		if (end == duration || *end || !(seconds >= 0) || seconds > (double)(UINT64_MAX / 1000000000ULL))
+			return send_error("protocol error: malformatted value for 'Duration' header");
+		if (easing && easing_parse(easing, &ease) < 0)
+			return send_error("protocol error: unrecognised value for 'Easing' header");
+		if (transactions[conn].open)
+			return send_error("protocol error: filters cannot be faded in a transaction");
+		fade = (uint64_t)(seconds * 1000000000.);
+	} else if (easing) {
+		fprintf(stderr, "%s: ignoring superfluous Easing header on Command: set-gamma message "
+		                "without Duration header\n", argv0);
+	}
 
-	if (filter.lifespan != LIFESPAN_REMOVE) {
-		filter.ramps = memdup(msg->payload, msg->payload_size);
-		if (!filter.ramps)
+	/* Look up all CRTC:s before anything is changed */
+	wildcard = crtcs_n == 1 && !strcmp(crtcs[0], "*");
+	if (wildcard ? outputs_n > 1 : crtcs_n > 1) {
+		targets = pool_alloc((wildcard ? outputs_n : crtcs_n) * sizeof(*targets));
+		if (!targets)
 			goto fail;
 	}
+	for (i = 0; i < (wildcard ? outputs_n : crtcs_n); i++) {
+		output = wildcard ? outputs + i : output_find_by_name(crtcs[i], outputs, outputs_n);
+		if (!output) {
+			r = send_error("CRTC does not exists");
+			goto out;
+		}
+		/* All outputs must be able to use the same ramps */
+		if (filter.lifespan != LIFESPAN_REMOVE && n && !same_layout(targets[0], output)) {
+			if (wildcard)
+				continue;
+			r = send_error("invalid payload: the CRTCs have different gamma ramp layouts");
+			goto out;
+		}
+		targets[n++] = output;
+	}
+	if (!n) {
+		r = send_error("CRTC does not exists");
+		goto out;
+	}
+	if (transactions[conn].open && transactions[conn].n + n > TRANSACTION_STAGED_MAX) {
+		r = send_error("too many changes have been staged in the transaction");
+		goto out;
+	}
 
-	if ((r = add_filter(output, &filter)) < 0)
+	if (filter.lifespan == LIFESPAN_REMOVE) {
+		/* No ramps */
+	} else if (function) {
+		/* The ramps are evaluated for the layout all targets share */
+		if (!(evaluated = pool_alloc(targets[0]->ramps_size)))
+			goto fail;
+		function_evaluate(&fn, targets[0], evaluated);
+		ramps = evaluated;
+	} else if (msg->payload_size != (memfd >= 0 ? 0 : targets[0]->ramps_size)) {
+		r = send_error("invalid payload: size of message payload does matched the expectancy");
+		goto out;
+	} else if (memfd >= 0) {
+		if (!(ramps = map_ramps(memfd, targets[0]->ramps_size))) {
+			r = send_error("invalid payload: file descriptor is not a sealed memfd with the expected size");
+			goto out;
+		}
+		mapped = targets[0]->ramps_size;
+	}
+
+	/* The ramps filters are faded from must be
+	 * copied before the filters are changed */
+	if (fade) {
+		if (n > 1 && !(starts = calloc(n, sizeof(*starts))))
+			goto fail;
+		for (starts_n = n, i = 0; i < n; i++)
+			if (!(starts[i] = current_ramps(targets[i], class)))
+				goto fail;
+	}
+
+	if (set_filter(conn, targets, n, &filter, ramps, mapped) < 0) {
+		mapped = 0;
 		goto fail;
-	if (flush_filters(output, (size_t)r))
+	}
+	mapped = 0;
+
+	if (fade && begin_transitions(targets, n, class, starts, fade, ease) < 0)
 		goto fail;
 
-	free(filter.class);
-	free(filter.ramps);
+	r = send_errno(0);
+out:
+	for (i = 0; i < starts_n; i++)
+		free(starts[i]);
+	if (starts != &start)
+		free(starts);
+	if (targets != &output)
+		pool_free(targets);
+	pool_free(evaluated);
+	return r;
+
+fail:
+	saved_errno = errno;
+	if (mapped)
+		munmap((void *)ramps, mapped);
+	for (i = 0; i < starts_n; i++)
+		free(starts[i]);
+	if (starts != &start)
+		free(starts);
+	if (targets != &output)
+		pool_free(targets);
+	pool_free(evaluated);
+	send_errno(saved_errno);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Handle a set-gamma message sent with binary framing,
+ * its fixed-size part is in `inbound[conn].frame`
+ * 
+ * @param   conn   The index of the connection
+ * @param   memfd  The memfd with the ramps if the command is
+ *                 `BINARY_COMMAND_SET_GAMMA_MEMFD`, -1 otherwise;
+ *                 the caller keeps its ownership of it
+ * @return         Zero on success (even if ignored), -1 on error,
+ *                 1 if connection closed
+ */
+int
+handle_binary_set_gamma(size_t conn, int memfd)
+{
+	struct message *restrict msg = inbound + conn;
+	const struct binary_frame *restrict frame = &msg->frame;
+	uint32_t message_id = frame->message_id;
+	struct output *output;
+	struct filter filter;
+	const char *restrict class = msg->payload;
+	const void *ramps = NULL;
+	size_t mapped = 0;
+	int saved_errno;
+
+	if (frame->crtc >= outputs_n)
+		return send_binary_error(conn, message_id, "CRTC does not exists");
+	output = outputs + frame->crtc;
+
+	if (transactions[conn].open && transactions[conn].n >= TRANSACTION_STAGED_MAX)
+		return send_binary_error(conn, message_id, "too many changes have been staged in the transaction");
+
+	if (!frame->class_length || strlen(class) != (size_t)frame->class_length - 1 || !check_class(class))
+		return send_binary_error(conn, message_id, "protocol error: malformatted class");
+
+	switch (frame->lifespan) {
+	case LIFESPAN_REMOVE:
+		if (frame->payload_length || memfd >= 0)
+			fprintf(stderr, "%s: ignoring superfluous payload on binary set-gamma message with "
+			                "lifespan remove\n", argv0);
+		break;
+	case LIFESPAN_UNTIL_REMOVAL:
+	case LIFESPAN_UNTIL_DEATH:
+		if (frame->payload_length != (memfd >= 0 ? 0 : output->ramps_size))
+			return send_binary_error(conn, message_id,
+			                         "invalid payload: size of message payload does matched the expectancy");
+		if (memfd < 0) {
+			ramps = &msg->payload[frame->class_length];
+		} else if (!(ramps = map_ramps(memfd, output->ramps_size))) {
+			return send_binary_error(conn, message_id,
+			                         "invalid payload: file descriptor is not a sealed memfd with the expected size");
+		} else {
+			mapped = output->ramps_size;
+		}
+		break;
+	default:
+		return send_binary_error(conn, message_id, "protocol error: unrecognised lifespan");
+	}
+
+	filter.client   = connections[conn];
+	filter.priority = frame->priority;
+	filter.class    = (char *)class;
+	filter.lifespan = (enum lifespan)frame->lifespan;
+
+	if (set_filter(conn, &output, 1, &filter, ramps, mapped) < 0)
+		goto fail;
+
+	return send_binary_errno(conn, message_id, 0);
+
+fail:
+	saved_errno = errno;
+	send_binary_errno(conn, message_id, saved_errno);
+	errno = saved_errno;
+	return -1;
+}
+
+
+/**
+ * Handle a ‘Command: subscribe’ message
+ * 
+ * After a successful subscription, the client will be sent a
+ * ‘Command: event’ message with an ‘Event’ header and a ‘CRTC’
+ * header each time one of the selected events occurs. If events
+ * cannot be sent in time, they are instead reported in a single
+ * message, with a ‘Coalesced: yes’ header and all events that
+ * have occurred listed in the ‘Event’ header, but without the
+ * ‘CRTC’ header. A new subscription replaces the old one.
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The value of the ‘Message ID’ header
+ * @param   crtc        The value of the ‘CRTC’ header, `NULL`
+ *                      to subscribe to events on all CRTC:s
+ * @param   events      The value of the ‘Events’ header
+ * @return              Zero on success (even if ignored), -1 on error,
+ *                      1 if connection closed
+ */
+int
+handle_subscribe(size_t conn, const char *restrict message_id, const char *restrict crtc, const char *restrict events)
+{
+	struct subscription *restrict sub = subscriptions + conn;
+	unsigned mask;
+	char *restrict crtc_dup = NULL;
+
+	if (!events)
+		return send_error("protocol error: 'Events' header omitted");
+	if (events_parse(events, &mask) < 0)
+		return send_error("protocol error: unrecognised value for 'Events' header");
+
+	if (mask && crtc && !(crtc_dup = memdup(crtc, strlen(crtc) + 1)))
+		return -1;
+
+	subscription_destroy(sub);
+	sub->events = mask;
+	sub->crtc = crtc_dup;
+
+	return send_errno(0);
+}
+
+/**
+ * Handle a ‘Command: begin’ message
+ * 
+ * Until the next ‘Command: commit’, changes requested with
+ * ‘Command: set-gamma’ are validated and staged, rather than
+ * applied, and the replies to them only acknowledge that
+ * they were staged
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The value of the ‘Message ID’ header
+ * @return              Zero on success (even if ignored), -1 on error,
+ *                      1 if connection closed
+ */
+int
+handle_begin(size_t conn, const char *restrict message_id)
+{
+	if (transactions[conn].open)
+		return send_error("a transaction has already been begun");
+	transactions[conn].open = 1;
+	return send_errno(0);
+}
+
+
+/**
+ * Handle a ‘Command: commit’ message
+ * 
+ * The changes staged since ‘Command: begin’ are applied in
+ * order, and since outputs are recomposed and written only
+ * once the message has been handled, they take effect
+ * together, with one write per affected CRTC. If any CRTC
+ * has been removed, or its gamma ramp layout has changed,
+ * since the changes were staged, none of the changes are
+ * applied, and neither are they if room for them cannot
+ * be made; either way, the transaction is ended
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The value of the ‘Message ID’ header
+ * @return              Zero on success (even if ignored), -1 on error,
+ *                      1 if connection closed
+ */
+int
+handle_commit(size_t conn, const char *restrict message_id)
+{
+	struct transaction *restrict transaction = transactions + conn;
+	struct staged_filter *restrict staged;
+	struct output *restrict output;
+	struct output **restrict targets = NULL;
+	size_t *restrict counts = NULL;
+	int saved_errno = 0, r = 0;
+	size_t i;
+
+	if (!transaction->open)
+		return send_error("no transaction has been begun");
+
+	if (transaction->n) {
+		targets = pool_alloc(transaction->n * sizeof(*targets));
+		counts = calloc(outputs_n, sizeof(*counts));
+		if (!targets || !counts)
+			goto fail;
+	}
+
+	/* Every change is validated before any is applied */
+	for (i = 0; i < transaction->n; i++) {
+		staged = &transaction->filters[i];
+		output = output_find_by_name(staged->crtc, outputs, outputs_n);
+		if (!output || (staged->filter.ramps &&
+		                (output->depth      != staged->depth      ||
+		                 output->red_size   != staged->red_size   ||
+		                 output->green_size != staged->green_size ||
+		                 output->blue_size  != staged->blue_size))) {
+			pool_free(targets);
+			free(counts);
+			transaction_destroy(transaction);
+			return send_error("transaction discarded: a CRTC has been removed or "
+			                  "its gamma ramp layout has changed since the changes were staged");
+		}
+		targets[i] = output;
+		counts[output - outputs] += 1;
+	}
+
+	/* Room is made for all changes, so that applying
+	 * them cannot fail once the first one is applied,
+	 * stale ownership entries are harmless */
+	for (i = 0; i < transaction->n; i++) {
+		staged = &transaction->filters[i];
+		output = targets[i];
+		if (reserve_filters(output, output->table_size + counts[output - outputs]) < 0)
+			goto fail;
+		if (staged->filter.lifespan == LIFESPAN_UNTIL_DEATH &&
+		    ownership_add(&ownerships[conn], output->name, staged->filter.class) < 0)
+			goto fail;
+	}
+
+	/* Only reporting the changes can fail now, in which
+	 * case the remaining changes are still applied */
+	for (i = 0; i < transaction->n; i++) {
+		staged = &transaction->filters[i];
+		if (change_filter(conn, targets[i], &staged->filter) < 0 && !r) {
+			saved_errno = errno;
+			r = -1;
+		}
+		free(staged->crtc);
+	}
+	free(transaction->filters);
+	transaction_initialise(transaction);
+	pool_free(targets);
+	free(counts);
+
+	if (r < 0) {
+		send_errno(saved_errno);
+		errno = saved_errno;
+		return -1;
+	}
 	return send_errno(0);
 
 fail:
 	saved_errno = errno;
+	pool_free(targets);
+	free(counts);
+	transaction_destroy(transaction);
 	send_errno(saved_errno);
-	free(filter.class);
-	free(filter.ramps);
 	errno = saved_errno;
 	return -1;
 }
 
 
 /**
- * Recalculate the resulting gamma and
- * update push the new gamma ramps to the CRTC
+ * Mark filters on an output as updated, the resulting
+ * gamma is recalculated and pushed to the CRTC by
+ * `flush_outputs` at the end of the current iteration
+ * of the main loop, and report the change to subscribers
  * 
  * @param   output         The output
- * @param   first_updated  The index of the first added or removed filter
+ * @param   event          How the filters were changed
+ * @param   first_updated  The index of the first added, removed, or updated filter
+ * @param   last_updated   The index of the last added, removed, or updated filter,
+ *                         plus 1, `output->table_size` if filters were added
+ *                         or removed, causing following filters to be moved
  * @return                 Zero on success, -1 on error
  */
 int
-flush_filters(struct output *restrict output, size_t first_updated)
+flush_filters(struct output *restrict output, enum event event, size_t first_updated, size_t last_updated)
 {
-	union gamma_ramps plain, *last;
-	size_t i;
+	if (last_updated <= first_updated)
+		last_updated = first_updated + 1;
 
-	if (!first_updated) {
-		if (make_plain_ramps(&plain, output) < 0)
-			return -1;
-		last = &plain;
+	if (!output->last_updated) {
+		output->first_updated = first_updated;
+		output->last_updated  = last_updated;
 	} else {
-		last = output->table_sums + (first_updated - 1);
+		if (output->first_updated > first_updated)
+			output->first_updated = first_updated;
+		if (output->last_updated < last_updated)
+			output->last_updated = last_updated;
 	}
 
-	for (i = first_updated; i < output->table_size; i++) {
-		apply_filter(&output->table_sums[i], output->table_filters[i].ramps, output->depth, last);
-		last = output->table_sums + i;
+	if (output->table_sums_valid > first_updated)
+		output->table_sums_valid = first_updated;
+
+	output->flush_pending = 1;
+	output->generation += 1;
+
+	return notify_subscribers(event, output->name);
+}
+
+
+/**
+ * Find an output whose resulting gamma is up to date
+ * and composed of the same filters as that of an output
+ * 
+ * Filters that are applied to several outputs, or that
+ * have the same ramps, share interned ramps, so outputs
+ * with the same filters can be recognised by comparing
+ * the addresses of the filters' ramps
+ * 
+ * @param   output  The output, must have at least one filter
+ * @return          An output whose resulting gamma is the
+ *                  resulting gamma of `output` with the
+ *                  filters it has now, `NULL` if none
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static const struct output *
+find_same_composition(const struct output *restrict output)
+{
+	const struct output *other;
+	size_t i, j, n = output->table_size;
+
+	for (i = 0; i < outputs_n; i++) {
+		other = outputs + i;
+		if (other == output || other->last_updated || other->table_size != n)
+			continue;
+		if (other->depth != output->depth || other->red_size != output->red_size ||
+		    other->green_size != output->green_size || other->blue_size != output->blue_size)
+			continue;
+		for (j = 0; j < n; j++)
+			if (other->table_filters[j].ramps != output->table_filters[j].ramps)
+				break;
+		if (j == n)
+			return other;
 	}
 
-	set_gamma(output, last);
+	return NULL;
+}
 
-	if (!first_updated)
-		libgamma_gamma_ramps8_destroy(&plain.u8);
+
+/**
+ * Recalculate and push the resulting gamma to the CRTC
+ * of each output whose filters have been updated
+ * 
+ * For outputs with integral stops, only the updated filters are
+ * recomposed, along with their ancestors in the output's segment tree,
+ * which is O(log n) compositions when a single filter is updated; the
+ * elements in `output->table_sums` are not updated (except for the last
+ * one), but are marked as out of date
+ * 
+ * Outputs that have the same gamma ramp layout and the same
+ * filters, as is common when a filter is applied to all
+ * outputs, are composed only once: the other outputs copy
+ * the resulting gamma, and their filters remain marked as
+ * updated so that they are recomposed when they are needed
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int
+flush_outputs(void)
+{
+	const union gamma_ramps *plain;
+	const struct output *same;
+	struct output *output;
+	size_t i, n;
+
+	for (i = 0; i < outputs_n; i++) {
+		output = outputs + i;
+		if (!output->flush_pending)
+			continue;
+		if ((n = output->table_size)) {
+			if (output->last_updated && (same = find_same_composition(output))) {
+				memcpy(output->table_sums[n - 1].u8.red, same->table_sums[n - 1].u8.red, output->ramps_size);
+				stats.counters[COUNTER_SHARED_COMPOSITIONS] += 1;
+			} else if (recompose_filters(output) < 0) {
+				return -1;
+			}
+			if (set_gamma(output, &output->table_sums[n - 1]) < 0)
+				return -1;
+		} else {
+			output->last_updated = 0;
+			if (!(plain = get_plain_ramps(output)))
+				return -1;
+			if (set_gamma(output, plain) < 0)
+				return -1;
+		}
+		output->flush_pending = 0;
+	}
 
 	return 0;
 }
 
 
+/**
+ * Update all filters that are being faded, and stop
+ * fading filters that have reached their target
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int
+advance_transitions(void)
+{
+	struct transition *restrict transition;
+	struct output *restrict output;
+	struct filter *restrict filter;
+	uint64_t now = stats_clock();
+	double progress;
+	size_t i = 0, j;
+	void *ramps;
+	int r = 0;
+
+	while (i < transitions_n) {
+		transition = transitions + i;
+		output = output_find_by_name(transition->crtc, outputs, outputs_n);
+		progress = 1;
+
+		/* The output may have been unplugged, or replaced by
+		 * one with another layout, which drops its filters */
+		if (output && output->ramps_size == transition->ramps_size && output->depth == transition->depth &&
+		    (j = output_find_filter(output, transition->class)) < output->table_size) {
+			filter = output->table_filters + j;
+			progress = transition_progress(transition, now);
+			if (progress < 1) {
+				/* The ramps are interned if the state has been
+				 * unmarshalled since the transition began */
+				if ((ramps = blob_unshare(filter->ramps))) {
+					filter->ramps = ramps;
+					transition_interpolate(transition, progress, ramps);
+				} else {
+					r = -1;
+				}
+			} else if ((ramps = blob_intern(transition->target, transition->ramps_size))) {
+				blob_release(filter->ramps);
+				filter->ramps = ramps;
+			} else {
+				r = -1;
+			}
+			if (flush_filters(output, EVENT_FILTER_UPDATED, j, j + 1) < 0)
+				r = -1;
+		}
+
+		if (progress < 1) {
+			i++;
+		} else {
+			transition_destroy(transition);
+			*transition = transitions[--transitions_n];
+		}
+	}
+
+	return r;
+}
+
+
 /**
  * Preserve current gamma ramps at priority 0 for all outputs
  * 
@@ -504,19 +1615,22 @@ preserve_gamma(void)
 		filter.class    = NULL;
 		filter.lifespan = LIFESPAN_UNTIL_REMOVAL;
 		filter.ramps    = NULL;
+		filter.ramps_mapped = 0;
 		outputs[i].table_filters = calloc(4, sizeof(*outputs[i].table_filters));
-		outputs[i].table_sums    = calloc(4, sizeof(*outputs[i].table_sums));
+		if (!outputs[i].table_filters || output_grow_sums(outputs + i, 4) < 0)
+			return -1;
 		outputs[i].table_alloc   = 4;
 		outputs[i].table_size    = 1;
-		filter.class = memdup(PKGNAME"::"COMMAND"::preserved", sizeof(PKGNAME"::"COMMAND"::preserved"));
+		outputs[i].table_sums_valid = 1;
+		filter.class = class_intern(PKGNAME"::"COMMAND"::preserved");
 		if (!filter.class)
 			return -1;
-		filter.ramps = memdup(outputs[i].saved_ramps.u8.red, outputs[i].ramps_size);
+		filter.ramps = blob_intern(outputs[i].saved_ramps.u8.red, outputs[i].ramps_size);
 		if (!filter.ramps)
 			return -1;
 		outputs[i].table_filters[0] = filter;
-		COPY_RAMP_SIZES(&outputs[i].table_sums[0].u8, outputs + i);
-		if (!gamma_ramps_unmarshal(outputs[i].table_sums, outputs[i].saved_ramps.u8.red, outputs[i].ramps_size))
+		memcpy(outputs[i].table_sums[0].u8.red, outputs[i].saved_ramps.u8.red, outputs[i].ramps_size);
+		if (output_index_filters(outputs + i, 0) < 0)
 			return -1;
 	}
 
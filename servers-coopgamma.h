@@ -3,6 +3,7 @@
 #define SERVERS_COOPGAMMA_H
 
 #include "types-output.h"
+#include "types-subscription.h"
 
 #include <stddef.h>
 
@@ -17,10 +18,11 @@
 /**
  * Handle a closed connection
  * 
+ * @param   conn    The index of the connection
  * @param   client  The file descriptor for the client
  * @return          Zero on success, -1 on error
  */
-int connection_closed(int client);
+int connection_closed(size_t conn, int client);
 
 /**
  * Handle a ‘Command: get-gamma’ message
@@ -44,27 +46,115 @@ int handle_get_gamma(size_t conn, const char *restrict message_id, const char *r
  * 
  * @param   conn        The index of the connection
  * @param   message_id  The value of the ‘Message ID’ header
- * @param   crtc        The value of the ‘CRTC’ header
+ * @param   crtcs       The values of the ‘CRTC’ headers, in order, a
+ *                      single ‘*’ selects all CRTC:s that have the
+ *                      same gamma ramp layout as the first CRTC
+ * @param   crtcs_n     The number of elements in `crtcs`
  * @param   priority    The value of the ‘Priority’ header
  * @param   class       The value of the ‘Class’ header
  * @param   lifespan    The value of the ‘Lifespan’ header
+ * @param   function    The value of the ‘Function’ header, if set, the
+ *                      filter is described by a function rather than
+ *                      by ramps in the payload
+ * @param   parameters  The value of the ‘Parameters’ header
+ * @param   duration    The value of the ‘Duration’ header, if set, the
+ *                      filter is faded from its current ramps, or from
+ *                      identity mapping ramps if it is new, over this
+ *                      many seconds
+ * @param   easing      The value of the ‘Easing’ header
+ * @param   memfd       The memfd with the ramps if sent with
+ *                      ‘Transport: memfd’, -1 otherwise;
+ *                      the caller keeps its ownership of it
  * @return              Zero on success (even if ignored), -1 on error,
  *                      1 if connection closed
  */
 GCC_ONLY(__attribute__((__nonnull__(2))))
-int handle_set_gamma(size_t conn, const char *restrict message_id, const char *restrict crtc,
-                     const char *restrict priority, const char *restrict class, const char *restrict lifespan);
+int handle_set_gamma(size_t conn, const char *restrict message_id, const char *const *restrict crtcs, size_t crtcs_n,
+                     const char *restrict priority, const char *restrict class, const char *restrict lifespan,
+                     const char *restrict function, const char *restrict parameters,
+                     const char *restrict duration, const char *restrict easing, int memfd);
 
 /**
- * Recalculate the resulting gamma and
- * update push the new gamma ramps to the CRTC
+ * Handle a set-gamma message sent with binary framing,
+ * its fixed-size part is in `inbound[conn].frame`
+ * 
+ * @param   conn   The index of the connection
+ * @param   memfd  The memfd with the ramps if the command is
+ *                 `BINARY_COMMAND_SET_GAMMA_MEMFD`, -1 otherwise;
+ *                 the caller keeps its ownership of it
+ * @return         Zero on success (even if ignored), -1 on error,
+ *                 1 if connection closed
+ */
+int handle_binary_set_gamma(size_t conn, int memfd);
+
+/**
+ * Handle a ‘Command: subscribe’ message
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The value of the ‘Message ID’ header
+ * @param   crtc        The value of the ‘CRTC’ header, `NULL`
+ *                      to subscribe to events on all CRTC:s
+ * @param   events      The value of the ‘Events’ header
+ * @return              Zero on success (even if ignored), -1 on error,
+ *                      1 if connection closed
+ */
+GCC_ONLY(__attribute__((__nonnull__(2))))
+int handle_subscribe(size_t conn, const char *restrict message_id, const char *restrict crtc, const char *restrict events);
+
+/**
+ * Handle a ‘Command: begin’ message
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The value of the ‘Message ID’ header
+ * @return              Zero on success (even if ignored), -1 on error,
+ *                      1 if connection closed
+ */
+GCC_ONLY(__attribute__((__nonnull__(2))))
+int handle_begin(size_t conn, const char *restrict message_id);
+
+/**
+ * Handle a ‘Command: commit’ message
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The value of the ‘Message ID’ header
+ * @return              Zero on success (even if ignored), -1 on error,
+ *                      1 if connection closed
+ */
+GCC_ONLY(__attribute__((__nonnull__(2))))
+int handle_commit(size_t conn, const char *restrict message_id);
+
+/**
+ * Mark filters on an output as updated, the resulting
+ * gamma is recalculated and pushed to the CRTC by
+ * `flush_outputs` at the end of the current iteration
+ * of the main loop, and report the change to subscribers
  * 
  * @param   output         The output
- * @param   first_updated  The index of the first added or removed filter
+ * @param   event          How the filters were changed
+ * @param   first_updated  The index of the first added, removed, or updated filter
+ * @param   last_updated   The index of the last added, removed, or updated filter,
+ *                         plus 1, `output->table_size` if filters were added
+ *                         or removed, causing following filters to be moved
  * @return                 Zero on success, -1 on error
  */
 GCC_ONLY(__attribute__((__nonnull__)))
-int flush_filters(struct output *restrict output, size_t first_updated);
+int flush_filters(struct output *restrict output, enum event event, size_t first_updated, size_t last_updated);
+
+/**
+ * Recalculate and push the resulting gamma to the CRTC
+ * of each output whose filters have been updated
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int flush_outputs(void);
+
+/**
+ * Update all filters that are being faded, and stop
+ * fading filters that have reached their target
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int advance_transitions(void);
 
 /**
  * Preserve current gamma ramps at priority 0 for all outputs
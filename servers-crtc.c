@@ -7,6 +7,7 @@
 #include "util.h"
 
 #include <errno.h>
+#include <stdio.h>
 #include <string.h>
 
 
@@ -148,9 +149,15 @@ fail:
 /**
  * Merge the new state with an old state
  * 
+ * Outputs that have been added, removed, or
+ * changed are reported to subscribers, once
+ * each; a failure to report a change is
+ * printed but does not prevent the merge
+ * 
  * @param   old_outputs    The old `outputs`
  * @param   old_outputs_n  The old `outputs_n`
- * @return                 Zero on success, -1 on error
+ * @return                 Zero on success, -1 on error,
+ *                         in which case nothing is merged
  */
 int
 merge_state(struct output *restrict old_outputs, size_t old_outputs_n)
@@ -164,10 +171,10 @@ merge_state(struct output *restrict old_outputs, size_t old_outputs_n)
 	i = j = new_outputs_n = 0;
 	while (i < old_outputs_n && j < outputs_n) {
 		cmp = strcmp(old_outputs[i].name, outputs[j].name);
-		if (cmp <= 0)
+		if (cmp >= 0)
 			new_outputs_n++;
-		i += cmp >= 0;
-		j += cmp <= 0;
+		i += cmp <= 0;
+		j += cmp >= 0;
 	}
 	new_outputs_n += outputs_n - j;
 
@@ -196,14 +203,28 @@ merge_state(struct output *restrict old_outputs, size_t old_outputs_n)
 			outputs[j].crtc = NULL;
 			output_destroy(&outputs[j]);
 			new_outputs_n++;
-		} else if (cmp <= 0) {
+		} else if (cmp < 0) {
+			/* The old output is dropped */
+			if (notify_subscribers(EVENT_OUTPUT_HOTPLUGGED, old_outputs[i].name) < 0)
+				perror(argv0); /* Not fatal */
+		} else {
+			/* The new output is inserted, replacing the
+			 * old output of the same name if `!cmp` */
+			if (notify_subscribers(EVENT_OUTPUT_HOTPLUGGED, outputs[j].name) < 0)
+				perror(argv0); /* Not fatal */
 			new_outputs[new_outputs_n++] = outputs[j];
 		}
-		i += cmp >= 0;
-		j += cmp <= 0;
+		i += cmp <= 0;
+		j += cmp >= 0;
+	}
+	for (; i < old_outputs_n; i++)
+		if (notify_subscribers(EVENT_OUTPUT_HOTPLUGGED, old_outputs[i].name) < 0)
+			perror(argv0); /* Not fatal */
+	for (; j < outputs_n; j++) {
+		if (notify_subscribers(EVENT_OUTPUT_HOTPLUGGED, outputs[j].name) < 0)
+			perror(argv0); /* Not fatal */
+		new_outputs[new_outputs_n++] = outputs[j];
 	}
-	while (j < outputs_n)
-		new_outputs[new_outputs_n++] = outputs[j++];
 
 	/* Commit merge */
 	free(outputs);
@@ -300,7 +321,8 @@ reconnect(void)
 	old_outputs_n = 0;
 
 	/* Reapply gamma ramps */
-	reapply_gamma();
+	if (reapply_gamma() < 0)
+		goto fail;
 
 	return 0;
 
@@ -54,7 +54,8 @@ int initialise_crtcs(void);
  * 
  * @param   old_outputs    The old `outputs`
  * @param   old_outputs_n  The old `outputs_n`
- * @return                 Zero on success, -1 on error
+ * @return                 Zero on success, -1 on error,
+ *                         in which case nothing is merged
  */
 int merge_state(struct output *restrict old_outputs, size_t old_outputs_n);
 
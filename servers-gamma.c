@@ -1,8 +1,10 @@
 /* See LICENSE file for copyright and license details. */
 #include "servers-gamma.h"
 #include "servers-crtc.h"
+#include "servers-coopgamma.h"
 #include "state.h"
 #include "communication.h"
+#include "types-stats.h"
 #include "util.h"
 
 #include <errno.h>
@@ -108,17 +110,23 @@ handle_get_gamma_info(size_t conn, const char *restrict message_id, const char *
 /**
  * Set the gamma ramps on an output
  * 
- * @param  output  The output
- * @param  ramps   The gamma ramps
+ * A failure to set the gamma ramps is reported to
+ * subscribers, but is not considered an error
+ * 
+ * @param   output  The output
+ * @param   ramps   The gamma ramps
+ * @return          Zero on success, -1 on error
  */
-void
+int
 set_gamma(const struct output *restrict output, const union gamma_ramps *restrict ramps)
 {
 	int r = 0;
+	uint64_t start;
 
 	if (!connected)
-		return;
+		return 0;
 
+	start = stats_clock();
 	switch (output->depth) {
 	case  8: r = libgamma_crtc_set_gamma_ramps8(output->crtc,  &ramps->u8);  break;
 	case 16: r = libgamma_crtc_set_gamma_ramps16(output->crtc, &ramps->u16); break;
@@ -130,8 +138,16 @@ set_gamma(const struct output *restrict output, const union gamma_ramps *restric
 		abort();
 	}
 
-	if (r)
+	stats_time(&stats, TIMING_HARDWARE_WRITE, start);
+	stats.counters[COUNTER_HARDWARE_WRITES] += 1;
+
+	if (r) {
+		stats.counters[COUNTER_HARDWARE_WRITE_ERRORS] += 1;
 		libgamma_perror(argv0, r); /* Not fatal */
+		return notify_subscribers(EVENT_WRITE_FAILED, output->name);
+	}
+
+	return 0;
 }
 
 
@@ -361,21 +377,18 @@ restore_gamma(void)
 
 /**
  * Reapplu all gamma ramps
+ * 
+ * @return  Zero on success, -1 on error
  */
-void
+int
 reapply_gamma(void)
 {
-	union gamma_ramps plain;
 	size_t i;
 
-	/* Reapply gamma ramps */
-	for (i = 0; i < outputs_n; i++) {
-		if (outputs[i].table_size > 0) {
-			set_gamma(&outputs[i], &outputs[i].table_sums[outputs[i].table_size - 1]);
-		} else {
-			make_plain_ramps(&plain, &outputs[i]);
-			set_gamma(&outputs[i], &plain);
-			libgamma_gamma_ramps8_destroy(&plain.u8);
-		}
-	}
+	/* Flushing the outputs also recomposes those whose result
+	 * tables are out of date, as they are after re-execution */
+	for (i = 0; i < outputs_n; i++)
+		outputs[i].flush_pending = 1;
+
+	return flush_outputs();
 }
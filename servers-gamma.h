@@ -29,11 +29,15 @@ int handle_get_gamma_info(size_t conn, const char *restrict message_id, const ch
 /**
  * Set the gamma ramps on an output
  * 
- * @param  output  The output
- * @param  ramps   The gamma ramps
+ * A failure to set the gamma ramps is reported to
+ * subscribers, but is not considered an error
+ * 
+ * @param   output  The output
+ * @param   ramps   The gamma ramps
+ * @return          Zero on success, -1 on error
  */
 GCC_ONLY(__attribute__((__nonnull__)))
-void set_gamma(const struct output *restrict output, const union gamma_ramps *restrict ramps);
+int set_gamma(const struct output *restrict output, const union gamma_ramps *restrict ramps);
 
 /**
  * Store all current gamma ramps
@@ -54,7 +58,9 @@ void restore_gamma(void);
 
 /**
  * Reapplu all gamma ramps
+ * 
+ * @return  Zero on success, -1 on error
  */
-void reapply_gamma(void);
+int reapply_gamma(void);
 
 #endif
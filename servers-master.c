@@ -6,22 +6,449 @@
 #include "util.h"
 #include "communication.h"
 #include "state.h"
+#include "types-blob.h"
+#include "types-stats.h"
 
+#if !defined(USE_POLL) && defined(__linux__)
+# define USE_EPOLL
+#endif
+
+#if defined(USE_EPOLL)
+# include <sys/epoll.h>
+# include <sys/timerfd.h>
+#else
+# include <poll.h>
+#endif
 #include <sys/socket.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 
+#ifndef OUTBOUND_HIGH_WATER_MARK
+/**
+ * The number of bytes that may be queued for a
+ * client before the server stops reading messages
+ * from the client
+ */
+# define OUTBOUND_HIGH_WATER_MARK (1 << 20)
+#endif
+
+
+/**
+ * For each connection, whether reading from the client
+ * has been suspended because too much was queued for it
+ */
+static char *restrict read_suspended = NULL;
+
+/**
+ * The number of elements allocated for `read_suspended`
+ */
+static size_t read_suspended_alloc = 0;
+
+/**
+ * Whether any element in `read_suspended` is set
+ */
+static int reading_suspended = 0;
+
+
+#if defined(USE_EPOLL)
+
+/**
+ * The value of `.data.u64` for events on the server socket,
+ * for connections `.data.u64` is the index of the connection
+ */
+#define SERVER_EPOLL_DATA UINT64_MAX
+
+/**
+ * The value of `.data.u64` for events on `timerfd`
+ */
+#define TIMER_EPOLL_DATA (UINT64_MAX - 1)
+
+/**
+ * The maximum number of events to fetch with each epoll_wait(2)
+ */
+#define EPOLL_EVENTS_MAX 64
+
+/**
+ * The events all connections are watched for, except for writing
+ */
+#define CONNECTION_EPOLL_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLET)
+
+/**
+ * The epoll(7) file descriptor, -1 when not in `main_loop`
+ */
+static int epollfd = -1;
+
+/**
+ * For each connection, whether EPOLLOUT is currently
+ * in the connection's interest list
+ */
+static char *restrict write_interest = NULL;
+
+/**
+ * The number of elements allocated for `write_interest`
+ */
+static size_t write_interest_alloc = 0;
+
+/**
+ * The timerfd(2) that paces transitions, -1 when not in `main_loop`
+ */
+static int timerfd = -1;
+
+/**
+ * Whether `timerfd` is armed
+ */
+static int timer_armed = 0;
+
+#else
+
 /**
  * All poll(3p) events that are not for writing
  */
 #define NON_WR_POLL_EVENTS (POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI | POLLERR | POLLHUP | POLLNVAL)
 
+#endif
+
+
+/**
+ * Get the time between updates of filters that are being faded
+ * 
+ * @return  The time between updates, in nanoseconds
+ */
+static uint64_t
+frame_period(void)
+{
+	return 1000000000ULL / frame_rate;
+}
+
+
+/**
+ * Lists all recognised headers, will call macro X
+ * with the value of `enum header` for the header
+ * as the first argument and the header's name as
+ * the second argument
+ */
+#define LIST_HEADERS\
+	X(HEADER_COMMAND,       "Command")\
+	X(HEADER_CRTC,          "CRTC")\
+	X(HEADER_COALESCE,      "Coalesce")\
+	X(HEADER_HIGH_PRIORITY, "High priority")\
+	X(HEADER_LOW_PRIORITY,  "Low priority")\
+	X(HEADER_PRIORITY,      "Priority")\
+	X(HEADER_CLASS,         "Class")\
+	X(HEADER_LIFESPAN,      "Lifespan")\
+	X(HEADER_FUNCTION,      "Function")\
+	X(HEADER_PARAMETERS,    "Parameters")\
+	X(HEADER_DURATION,      "Duration")\
+	X(HEADER_EASING,        "Easing")\
+	X(HEADER_MESSAGE_ID,    "Message ID")\
+	X(HEADER_FRAMING,       "Framing")\
+	X(HEADER_TRANSPORT,     "Transport")\
+	X(HEADER_EVENTS,        "Events")\
+	X(HEADER_LENGTH,        "Length")
+
+/**
+ * Lists all recognised commands, will call macro X
+ * with the value of `enum command` for the command
+ * as the first argument and the command's name as
+ * the second argument
+ */
+#define LIST_COMMANDS\
+	X(COMMAND_ENUMERATE_CRTCS, "enumerate-crtcs")\
+	X(COMMAND_GET_GAMMA_INFO,  "get-gamma-info")\
+	X(COMMAND_GET_GAMMA,       "get-gamma")\
+	X(COMMAND_SET_GAMMA,       "set-gamma")\
+	X(COMMAND_GET_STATS,       "get-stats")\
+	X(COMMAND_SET_FRAMING,     "set-framing")\
+	X(COMMAND_SUBSCRIBE,       "subscribe")\
+	X(COMMAND_BEGIN,           "begin")\
+	X(COMMAND_COMMIT,          "commit")
+
+
+/**
+ * Recognised headers
+ */
+enum header {
+#define X(C, N) C,
+	LIST_HEADERS
+#undef X
+
+	/**
+	 * The number of recognised headers
+	 */
+	HEADER_COUNT,
+
+	/**
+	 * Unrecognised header
+	 */
+	HEADER_UNRECOGNISED = HEADER_COUNT
+};
+
+/**
+ * Recognised commands
+ */
+enum command {
+#define X(C, N) C,
+	LIST_COMMANDS
+#undef X
+
+	/**
+	 * Unrecognised command
+	 */
+	COMMAND_UNRECOGNISED
+};
+
+
+/**
+ * The names of the recognised headers,
+ * indexed by `enum header`
+ */
+static const char *const header_names[] = {
+#define X(C, N) N,
+	LIST_HEADERS
+#undef X
+};
+
+/**
+ * The names of the recognised commands,
+ * indexed by `enum command`
+ */
+static const char *const command_names[] = {
+#define X(C, N) N,
+	LIST_COMMANDS
+#undef X
+};
+
+/**
+ * The number of received messages with each command,
+ * indexed by `enum command`, unrecognised commands
+ * are counted at `COMMAND_UNRECOGNISED`
+ */
+static uint64_t command_counts[COMMAND_UNRECOGNISED + 1];
+
+
+/**
+ * Identify a header by its name
+ * 
+ * Only one comparison against a known name is made:
+ * the candidate is selected by the length of the
+ * name, and by the first character when the length
+ * is shared
+ * 
+ * @param   name  The name of the header, need not be NUL-terminated
+ * @param   len   The length of `name`
+ * @return        The header, `HEADER_UNRECOGNISED` if not recognised
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static enum header
+get_header(const char *restrict name, size_t len)
+{
+	enum header h;
+
+	switch (len) {
+	case 4:  h = HEADER_CRTC;          break;
+	case 5:  h = HEADER_CLASS;         break;
+	case 6:  h = *name == 'L' ? HEADER_LENGTH : name[1] == 'v' ? HEADER_EVENTS : HEADER_EASING; break;
+	case 7:  h = *name == 'F' ? HEADER_FRAMING : HEADER_COMMAND; break;
+	case 9:  h = HEADER_TRANSPORT;     break;
+	case 10: h = *name == 'P' ? HEADER_PARAMETERS : HEADER_MESSAGE_ID; break;
+	case 12: h = HEADER_LOW_PRIORITY;  break;
+	case 13: h = HEADER_HIGH_PRIORITY; break;
+	case 8:
+		switch (*name) {
+		case 'C': h = HEADER_COALESCE; break;
+		case 'D': h = HEADER_DURATION; break;
+		case 'F': h = HEADER_FUNCTION; break;
+		case 'L': h = HEADER_LIFESPAN; break;
+		case 'P': h = HEADER_PRIORITY; break;
+		default:
+			return HEADER_UNRECOGNISED;
+		}
+		break;
+	default:
+		return HEADER_UNRECOGNISED;
+	}
+
+	return memcmp(name, header_names[h], len) ? HEADER_UNRECOGNISED : h;
+}
+
+
+/**
+ * Identify a command by its name
+ * 
+ * @param   name  The name of the command, need not be NUL-terminated
+ * @param   len   The length of `name`
+ * @return        The command, `COMMAND_UNRECOGNISED` if not recognised
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static enum command
+get_command(const char *restrict name, size_t len)
+{
+	enum command c;
+
+	switch (len) {
+	case 15: c = COMMAND_ENUMERATE_CRTCS; break;
+	case 14: c = COMMAND_GET_GAMMA_INFO;  break;
+	case 11: c = COMMAND_SET_FRAMING;     break;
+	case 9:
+		switch (*name) {
+		case 'g': c = name[4] == 's' ? COMMAND_GET_STATS : COMMAND_GET_GAMMA; break;
+		case 's': c = name[1] == 'u' ? COMMAND_SUBSCRIBE : COMMAND_SET_GAMMA; break;
+		default:
+			return COMMAND_UNRECOGNISED;
+		}
+		break;
+	case 6:  c = COMMAND_COMMIT;          break;
+	case 5:  c = COMMAND_BEGIN;           break;
+	default:
+		return COMMAND_UNRECOGNISED;
+	}
+
+	return memcmp(name, command_names[c], len) ? COMMAND_UNRECOGNISED : c;
+}
+
+
+/**
+ * Handle a ‘Command: get-stats’ message
+ * 
+ * The response has a line for each command with the number of
+ * received messages with that command, followed by three lines
+ * with the number of distinct stored ramps, the number of bytes
+ * they use, and the number of bytes saved by sharing them between
+ * filters, followed by a line for
+ * each counter in `enum counter`, followed by two lines for
+ * each operation in `enum timing`: one with the number of
+ * measurements, their sum, their maximum, and their 50th, 99th,
+ * and 99.9th percentiles; and one that lists each non-empty
+ * histogram bucket as its lowest value and its number of
+ * measurements, separated by a colon; all durations are in
+ * nanoseconds
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The value of the ‘Message ID’ header
+ * @return              Zero on success (even if ignored), -1 on error,
+ *                      1 if connection closed
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+handle_get_stats(size_t conn, const char *restrict message_id)
+{
+	struct blob_usage usage;
+	size_t i, n = 0;
+	char *restrict buf;
+
+	blob_usage(&usage);
+
+	for (i = 0; i <= COMMAND_UNRECOGNISED; i++)
+		n += (size_t)snprintf(NULL, 0, "Messages %s: %llu\n",
+		                      i < COMMAND_UNRECOGNISED ? command_names[i] : "unrecognised",
+		                      (unsigned long long int)command_counts[i]);
+	n += (size_t)snprintf(NULL, 0, "Stored ramps: %zu\nStored ramp bytes: %zu\nRamp bytes saved: %zu\n",
+	                      usage.blobs, usage.stored, usage.referenced - usage.stored);
+	n += stats_format(&stats, NULL);
+
+	MAKE_MESSAGE(&buf, &n, n,
+	             "Command: stats\n"
+	             "In response to: %s\n"
+	             "Length: %zu\n"
+	             "\n",
+	             message_id, n);
+
+	for (i = 0; i <= COMMAND_UNRECOGNISED; i++)
+		n += (size_t)sprintf(&buf[n], "Messages %s: %llu\n",
+		                     i < COMMAND_UNRECOGNISED ? command_names[i] : "unrecognised",
+		                     (unsigned long long int)command_counts[i]);
+	n += (size_t)sprintf(&buf[n], "Stored ramps: %zu\nStored ramp bytes: %zu\nRamp bytes saved: %zu\n",
+	                     usage.blobs, usage.stored, usage.referenced - usage.stored);
+	n += stats_format(&stats, &buf[n]);
+
+	return send_message(conn, buf, n);
+}
+
+
+/**
+ * Handle a ‘Command: set-framing’ message
+ * 
+ * With ‘Framing: binary’, all following messages on the
+ * connection, in both directions, are sent with binary
+ * framing, see `struct binary_frame` and `struct binary_reply`;
+ * the response to this message is however sent with text
+ * framing. With ‘Framing: text’, nothing changes.
+ * 
+ * @param   conn        The index of the connection
+ * @param   message_id  The value of the ‘Message ID’ header
+ * @param   framing     The value of the ‘Framing’ header
+ * @return              Zero on success (even if ignored), -1 on error,
+ *                      1 if connection closed
+ */
+GCC_ONLY(__attribute__((__nonnull__(2))))
+static int
+handle_set_framing(size_t conn, const char *restrict message_id, const char *restrict framing)
+{
+	int r;
+
+	if (!framing)
+		return send_error("protocol error: 'Framing' header omitted");
+
+	if (!strcmp(framing, "text"))
+		return send_errno(0);
+	if (strcmp(framing, "binary"))
+		return send_error("protocol error: unrecognised value for 'Framing' header");
+
+	r = send_errno(0);
+	if (!r)
+		inbound[conn].framing = FRAMING_BINARY;
+	return r;
+}
+
+
+/**
+ * Pass on an inbound message with binary
+ * framing to appropriate message handling function
+ * 
+ * @param   conn  The index of the connection
+ * @param   msg   The inbound message
+ * @return        1: The connection as closed
+ *                0: Successful
+ *                -1: Failure
+ */
+static int
+dispatch_binary_message(size_t conn, struct message *restrict msg)
+{
+	int r, memfd;
+
+	switch (msg->frame.command) {
+	case BINARY_COMMAND_SET_GAMMA:
+		command_counts[COMMAND_SET_GAMMA] += 1;
+		return handle_binary_set_gamma(conn, -1);
+
+	case BINARY_COMMAND_SET_GAMMA_MEMFD:
+		command_counts[COMMAND_SET_GAMMA] += 1;
+		memfd = message_take_fd(msg);
+		if (memfd < 0)
+			return send_binary_error(conn, msg->frame.message_id,
+			                         "protocol error: no file descriptor was sent with the message");
+		r = handle_binary_set_gamma(conn, memfd);
+		close(memfd);
+		return r;
+
+	case BINARY_COMMAND_TEXT_FRAMING:
+		command_counts[COMMAND_SET_FRAMING] += 1;
+		msg->framing = FRAMING_TEXT;
+		return send_binary_errno(conn, msg->frame.message_id, 0);
+
+	default:
+		command_counts[COMMAND_UNRECOGNISED] += 1;
+		fprintf(stderr, "%s: ignoring unrecognised binary command: %u\n", argv0, (unsigned)msg->frame.command);
+		return 0;
+	}
+}
+
 
 /**
  * Extract headers from an inbound message and pass
@@ -36,70 +463,333 @@
 static int
 dispatch_message(size_t conn, struct message *restrict msg)
 {
-	size_t i;
-	int r = 0;
+	size_t i, command_len = 0, crtcs_n = 0;
+	int r = 0, memfd = -1;
+	enum header h;
+	enum command c;
 	const char *header;
-	const char *value;
-	const char *command       = NULL;
-	const char *crtc          = NULL;
-	const char *coalesce      = NULL;
-	const char *high_priority = NULL;
-	const char *low_priority  = NULL;
-	const char *priority      = NULL;
-	const char *class         = NULL;
-	const char *lifespan      = NULL;
-	const char *message_id    = NULL;
+	const char *values[HEADER_COUNT] = {NULL};
+	const char **crtcs = NULL;
+	const char *command;
+	const char *crtc;
+	const char *coalesce;
+	const char *high_priority;
+	const char *low_priority;
+	const char *priority;
+	const char *class;
+	const char *lifespan;
+	const char *function;
+	const char *parameters;
+	const char *duration;
+	const char *easing;
+	const char *message_id;
+	const char *framing;
+	const char *transport;
+	const char *events;
 
 	for (i = 0; i < msg->header_count; i++) {
-		value = strstr((header = msg->headers[i]), ": ") + 2;
-		if      (strstr(header, "Command: ")       == header)  command       = value;
-		else if (strstr(header, "CRTC: ")          == header)  crtc          = value;
-		else if (strstr(header, "Coalesce: ")      == header)  coalesce      = value;
-		else if (strstr(header, "High priority: ") == header)  high_priority = value;
-		else if (strstr(header, "Low priority: ")  == header)  low_priority  = value;
-		else if (strstr(header, "Priority: ")      == header)  priority      = value;
-		else if (strstr(header, "Class: ")         == header)  class         = value;
-		else if (strstr(header, "Lifespan: ")      == header)  lifespan      = value;
-		else if (strstr(header, "Message ID: ")    == header)  message_id    = value;
-		else if (strstr(header, "Length: ")        == header)  ;/* Handled transparently */
-		else
+		header = message_get_header(msg, i);
+		h = get_header(header, msg->headers[i].name_length);
+		if (h == HEADER_UNRECOGNISED) {
 			fprintf(stderr, "%s: ignoring unrecognised header: %s\n", argv0, header);
+			continue;
+		}
+		values[h] = &header[msg->headers[i].name_length + 2];
+		if (h == HEADER_COMMAND)
+			command_len = msg->headers[i].length - msg->headers[i].name_length - 2;
+		else if (h == HEADER_CRTC)
+			crtcs_n += 1;
 	}
 
+	command       = values[HEADER_COMMAND];
+	crtc          = values[HEADER_CRTC];
+	coalesce      = values[HEADER_COALESCE];
+	high_priority = values[HEADER_HIGH_PRIORITY];
+	low_priority  = values[HEADER_LOW_PRIORITY];
+	priority      = values[HEADER_PRIORITY];
+	class         = values[HEADER_CLASS];
+	lifespan      = values[HEADER_LIFESPAN];
+	function      = values[HEADER_FUNCTION];
+	parameters    = values[HEADER_PARAMETERS];
+	duration      = values[HEADER_DURATION];
+	easing        = values[HEADER_EASING];
+	message_id    = values[HEADER_MESSAGE_ID];
+	framing       = values[HEADER_FRAMING];
+	transport     = values[HEADER_TRANSPORT];
+	events        = values[HEADER_EVENTS];
+	/* The ‘Length’ header is handled transparently */
+
+	/* A file descriptor that is not claimed is closed
+	 * once the message has been dispatched */
+	if (transport && !strcmp(transport, "memfd"))
+		memfd = message_take_fd(msg);
+
 	if (!command) {
 		fprintf(stderr, "%s: ignoring message without Command header\n", argv0);
-
+		goto out;
 	} else if (!message_id) {
 		fprintf(stderr, "%s: ignoring message without Message ID header\n", argv0);
+		goto out;
+	}
+
+	c = get_command(command, command_len);
+	command_counts[c] += 1;
 
-	} else if (!strcmp(command, "enumerate-crtcs")) {
-		if (crtc || coalesce || high_priority || low_priority || priority || class || lifespan)
+	if (transport && strcmp(transport, "memfd")) {
+		r = send_error("protocol error: unrecognised value for 'Transport' header");
+		goto out;
+	} else if (transport && memfd < 0) {
+		r = send_error("protocol error: no file descriptor was sent with the message");
+		goto out;
+	}
+
+	switch (c) {
+	case COMMAND_ENUMERATE_CRTCS:
+		if (crtc || coalesce || high_priority || low_priority || priority || class || lifespan || function || parameters || duration || easing || framing || transport || events)
 			fprintf(stderr, "%s: ignoring superfluous headers in Command: enumerate-crtcs message\n", argv0);
 		r = handle_enumerate_crtcs(conn, message_id);
+		break;
 
-	} else if (!strcmp(command, "get-gamma-info")) {
-		if (coalesce || high_priority || low_priority || priority || class || lifespan)
+	case COMMAND_GET_GAMMA_INFO:
+		if (coalesce || high_priority || low_priority || priority || class || lifespan || function || parameters || duration || easing || framing || transport || events)
 			fprintf(stderr, "%s: ignoring superfluous headers in Command: get-gamma-info message\n", argv0);
 		r = handle_get_gamma_info(conn, message_id, crtc);
+		break;
 
-	} else if (!strcmp(command, "get-gamma")) {
-		if (priority || class || lifespan)
+	case COMMAND_GET_GAMMA:
+		if (priority || class || lifespan || function || parameters || duration || easing || framing || transport || events)
 			fprintf(stderr, "%s: ignoring superfluous headers in Command: get-gamma message\n", argv0);
 		r = handle_get_gamma(conn, message_id, crtc, coalesce, high_priority, low_priority);
+		break;
 
-	} else if (!strcmp(command, "set-gamma")) {
-		if (coalesce || high_priority || low_priority)
+	case COMMAND_SET_GAMMA:
+		if (coalesce || high_priority || low_priority || framing || events)
 			fprintf(stderr, "%s: ignoring superfluous headers in Command: set-gamma message\n", argv0);
-		r = handle_set_gamma(conn, message_id, crtc, priority, class, lifespan);
+		/* ‘set-gamma’ may be sent with multiple ‘CRTC’ headers */
+		if (crtcs_n > 1) {
+			crtcs = pool_alloc(crtcs_n * sizeof(*crtcs));
+			if (!crtcs) {
+				r = -1;
+				goto out;
+			}
+			for (i = crtcs_n = 0; i < msg->header_count; i++) {
+				header = message_get_header(msg, i);
+				if (get_header(header, msg->headers[i].name_length) == HEADER_CRTC)
+					crtcs[crtcs_n++] = &header[msg->headers[i].name_length + 2];
+			}
+		}
+		r = handle_set_gamma(conn, message_id, crtcs ? crtcs : &crtc, crtcs_n, priority, class, lifespan,
+		                     function, parameters, duration, easing, memfd);
+		break;
 
-	} else {
+	case COMMAND_GET_STATS:
+		if (crtc || coalesce || high_priority || low_priority || priority || class || lifespan || function || parameters || duration || easing || framing || transport || events)
+			fprintf(stderr, "%s: ignoring superfluous headers in Command: get-stats message\n", argv0);
+		r = handle_get_stats(conn, message_id);
+		break;
+
+	case COMMAND_SET_FRAMING:
+		if (crtc || coalesce || high_priority || low_priority || priority || class || lifespan || function || parameters || duration || easing || transport || events)
+			fprintf(stderr, "%s: ignoring superfluous headers in Command: set-framing message\n", argv0);
+		r = handle_set_framing(conn, message_id, framing);
+		break;
+
+	case COMMAND_SUBSCRIBE:
+		if (coalesce || high_priority || low_priority || priority || class || lifespan || function || parameters || duration || easing || framing || transport)
+			fprintf(stderr, "%s: ignoring superfluous headers in Command: subscribe message\n", argv0);
+		r = handle_subscribe(conn, message_id, crtc, events);
+		break;
+
+	case COMMAND_BEGIN:
+		if (crtc || coalesce || high_priority || low_priority || priority || class || lifespan || function || parameters || duration || easing || framing || transport || events)
+			fprintf(stderr, "%s: ignoring superfluous headers in Command: begin message\n", argv0);
+		r = handle_begin(conn, message_id);
+		break;
+
+	case COMMAND_COMMIT:
+		if (crtc || coalesce || high_priority || low_priority || priority || class || lifespan || function || parameters || duration || easing || framing || transport || events)
+			fprintf(stderr, "%s: ignoring superfluous headers in Command: commit message\n", argv0);
+		r = handle_commit(conn, message_id);
+		break;
+
+	case COMMAND_UNRECOGNISED:
+	default:
 		fprintf(stderr, "%s: ignoring unrecognised command: Command: %s\n", argv0, command);
+		break;
 	}
 
+out:
+	if (memfd >= 0)
+		close(memfd);
+	pool_free(crtcs);
 	return r;
 }
 
 
+#if defined(USE_EPOLL)
+
+/**
+ * Add a connection to the epoll(7) interest list
+ * 
+ * @param   conn  The index of the connection
+ * @return        Zero on success, -1 on error
+ */
+static int
+watch_connection(size_t conn)
+{
+	struct epoll_event event;
+	void *new;
+
+	if (conn >= write_interest_alloc) {
+		new = realloc(write_interest, connections_alloc * sizeof(*write_interest));
+		if (!new)
+			return -1;
+		write_interest = new;
+		write_interest_alloc = connections_alloc;
+	}
+
+	write_interest[conn] = ring_have_more(outbound + conn);
+	event.events = CONNECTION_EPOLL_EVENTS | (write_interest[conn] ? EPOLLOUT : 0);
+	event.data.u64 = (uint64_t)conn;
+	return epoll_ctl(epollfd, EPOLL_CTL_ADD, connections[conn], &event);
+}
+
+
+/**
+ * Add or remove EPOLLOUT from a connection's interest list
+ * if the connection's outbound buffer has changed between
+ * empty and non-empty
+ * 
+ * @param   conn  The index of the connection
+ * @return        Zero on success, -1 on error
+ */
+static int
+update_write_interest(size_t conn)
+{
+	struct epoll_event event;
+	char want;
+
+	if (connections[conn] < 0)
+		return 0;
+
+	want = ring_have_more(outbound + conn);
+	if (want == write_interest[conn])
+		return 0;
+
+	event.events = CONNECTION_EPOLL_EVENTS | (want ? EPOLLOUT : 0);
+	event.data.u64 = (uint64_t)conn;
+	if (epoll_ctl(epollfd, EPOLL_CTL_MOD, connections[conn], &event) < 0)
+		return -1;
+	write_interest[conn] = want;
+	return 0;
+}
+
+
+/**
+ * Create the epoll(7) instance and add the
+ * server socket and all connections to it
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int
+initialise_epoll(void)
+{
+	struct epoll_event event;
+	size_t i;
+
+	epollfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollfd < 0)
+		return -1;
+
+	event.events = EPOLLIN;
+	event.data.u64 = SERVER_EPOLL_DATA;
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, socketfd, &event) < 0)
+		return -1;
+
+	for (i = 0; i < connections_used; i++)
+		if (connections[i] >= 0 && watch_connection(i) < 0)
+			return -1;
+
+	timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timerfd < 0)
+		return -1;
+	timer_armed = 0;
+
+	event.events = EPOLLIN;
+	event.data.u64 = TIMER_EPOLL_DATA;
+	if (epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &event) < 0)
+		return -1;
+
+	return 0;
+}
+
+
+/**
+ * Arm `timerfd` if there are filters that are
+ * being faded, and disarm it if there are none
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int
+update_timer(void)
+{
+	struct itimerspec spec;
+	uint64_t period = frame_period();
+	int want = transitions_n > 0;
+
+	if (want == timer_armed)
+		return 0;
+
+	memset(&spec, 0, sizeof(spec));
+	if (want) {
+		spec.it_interval.tv_sec  = (time_t)(period / 1000000000ULL);
+		spec.it_interval.tv_nsec = (long)(period % 1000000000ULL);
+		spec.it_value = spec.it_interval;
+	}
+	if (timerfd_settime(timerfd, 0, &spec, NULL) < 0)
+		return -1;
+	timer_armed = want;
+	return 0;
+}
+
+
+/**
+ * Handle expiration of `timerfd`
+ * 
+ * @return  Zero on success, -1 on error
+ */
+static int
+handle_timer(void)
+{
+	uint64_t expirations;
+
+	/* Missed frames are not caught up on, the filters
+	 * are updated to where they should be now */
+	if (read(timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN && errno != EINTR)
+		return -1;
+	return advance_transitions();
+}
+
+
+/**
+ * Close the epoll(7) instance
+ */
+static void
+destroy_epoll(void)
+{
+	if (epollfd >= 0)
+		close(epollfd);
+	epollfd = -1;
+	if (timerfd >= 0)
+		close(timerfd);
+	timerfd = -1;
+	free(write_interest);
+	write_interest = NULL;
+	write_interest_alloc = 0;
+}
+
+#else
+
 /**
  * Sets the file descriptor set that includes
  * the server socket and all connections
@@ -144,16 +834,20 @@ update_fdset(struct pollfd **restrict fds, nfds_t *restrict fdn, nfds_t *restric
 	return 0;
 }
 
+#endif
+
 
 /**
  * Handle event on the server socket
  * 
- * @return  1: New connection accepted
- *          0: Successful
- *          -1: Failure
+ * @param   conn  Output parameter for the index of the
+ *                new connection, set only if 1 is returned
+ * @return        1: New connection accepted
+ *                0: Successful
+ *                -1: Failure
  */
 static int
-handle_server(void)
+handle_server(size_t *restrict conn)
 {
 	int fd, flags, saved_errno;
 	void *new;
@@ -189,6 +883,24 @@ handle_server(void)
 		outbound = new;
 		ring_initialise(&outbound[connections_ptr]);
 
+		new = realloc(subscriptions, (connections_alloc + 10) * sizeof(*subscriptions));
+		if (!new)
+			goto fail;
+		subscriptions = new;
+		subscription_initialise(&subscriptions[connections_ptr]);
+
+		new = realloc(ownerships, (connections_alloc + 10) * sizeof(*ownerships));
+		if (!new)
+			goto fail;
+		ownerships = new;
+		ownership_initialise(&ownerships[connections_ptr]);
+
+		new = realloc(transactions, (connections_alloc + 10) * sizeof(*transactions));
+		if (!new)
+			goto fail;
+		transactions = new;
+		transaction_initialise(&transactions[connections_ptr]);
+
 		new = realloc(inbound, (connections_alloc + 10) * sizeof(*inbound));
 		if (!new)
 			goto fail;
@@ -199,11 +911,14 @@ handle_server(void)
 	} else {
 		connections[connections_ptr] = fd;
 		ring_initialise(&outbound[connections_ptr]);
+		subscription_initialise(&subscriptions[connections_ptr]);
+		ownership_initialise(&ownerships[connections_ptr]);
+		transaction_initialise(&transactions[connections_ptr]);
 		if (message_initialise(&inbound[connections_ptr]))
 			goto fail;
 	}
 
-	connections_ptr++;
+	*conn = connections_ptr++;
 	while (connections_ptr < connections_used && connections[connections_ptr] >= 0)
 		connections_ptr++;
 	if (connections_used < connections_ptr)
@@ -232,16 +947,43 @@ handle_connection(size_t conn)
 {
 	struct message *restrict msg = &inbound[conn];
 	int r, fd = connections[conn];
+	uint64_t start;
+	void *new;
 
 again:
+	/* Stop reading from the client while too much is queued for
+	 * it, reading is resumed by `resume_reading` when the queue
+	 * has been sent. */
+	if (outbound[conn].bytes >= OUTBOUND_HIGH_WATER_MARK) {
+		if (read_suspended_alloc < connections_alloc) {
+			new = realloc(read_suspended, connections_alloc * sizeof(*read_suspended));
+			if (!new)
+				return -1;
+			read_suspended = new;
+			memset(&read_suspended[read_suspended_alloc], 0,
+			       (connections_alloc - read_suspended_alloc) * sizeof(*read_suspended));
+			read_suspended_alloc = connections_alloc;
+		}
+		read_suspended[conn] = 1;
+		reading_suspended = 1;
+		return 0;
+	}
+
 	errno = 0;
+	start = stats_clock();
 	switch (message_read(msg, fd)) {
 	default:
+		stats_time(&stats, TIMING_PARSE, start);
 		break;
 
 	case -1:
 		switch (errno) {
 		case EINTR:
+#if defined(USE_EPOLL)
+			/* The connection is edge-triggered, so we will not be
+			 * notified about the data again if we do not read it now. */
+			goto again;
+#endif
 #if defined(EAGAIN)
 		case EAGAIN:
 #endif
@@ -259,24 +1001,119 @@ again:
 		shutdown(fd, SHUT_RDWR);
 		close(fd);
 		connections[conn] = -1;
+		if (conn < read_suspended_alloc)
+			read_suspended[conn] = 0;
 		if (conn < connections_ptr)
 			connections_ptr = conn;
 		while (connections_used > 0 && connections[connections_used - 1] < 0)
 			connections_used -= 1;
+		message_close_fds(msg);
 		message_destroy(msg);
 		ring_destroy(&outbound[conn]);
-		if (connection_closed(fd) < 0)
+		subscription_destroy(&subscriptions[conn]);
+		transaction_destroy(&transactions[conn]);
+		if (connection_closed(conn, fd) < 0)
 			return -1;
 		return 1;
 	}
 
-	if ((r = dispatch_message(conn, msg)))
+	start = stats_clock();
+	if (msg->framing == FRAMING_BINARY)
+		r = dispatch_binary_message(conn, msg);
+	else
+		r = dispatch_message(conn, msg);
+	stats_time(&stats, TIMING_DISPATCH, start);
+	if (r)
 		return r;
+	message_discard_fds(msg);
 
 	goto again;
 }
 
 
+/**
+ * Check whether reading from any client has been suspended,
+ * and less than `OUTBOUND_HIGH_WATER_MARK` bytes are now
+ * queued for it
+ * 
+ * @return  Whether `resume_reading` should be called
+ *          without waiting for the next event
+ */
+static int
+reading_resumable(void)
+{
+	size_t conn;
+
+	if (reading_suspended)
+		for (conn = 0; conn < read_suspended_alloc; conn++)
+			if (read_suspended[conn] && outbound[conn].bytes < OUTBOUND_HIGH_WATER_MARK)
+				return 1;
+
+	return 0;
+}
+
+
+/**
+ * Resume reading from clients for which reading has been
+ * suspended, if enough of their queues has been sent
+ * 
+ * The queue may have been sent when subscribers were
+ * notified, rather than when the client's connection
+ * became writable, and the client may have nothing more
+ * to send, so messages that were already received are
+ * dispatched here, as they would otherwise wait until
+ * the client sends more
+ * 
+ * @return  1: A connection was closed
+ *          0: Successful
+ *          -1: Failure
+ */
+static int
+resume_reading(void)
+{
+	size_t conn;
+	int r, ret = 0;
+
+	if (!reading_suspended)
+		return 0;
+	reading_suspended = 0;
+
+	for (conn = 0; conn < read_suspended_alloc; conn++) {
+		if (!read_suspended[conn])
+			continue;
+		if (outbound[conn].bytes >= OUTBOUND_HIGH_WATER_MARK) {
+			reading_suspended = 1;
+			continue;
+		}
+		read_suspended[conn] = 0;
+		r = handle_connection(conn);
+		if (r < 0)
+			return -1;
+#if defined(USE_EPOLL)
+		if (!r && update_write_interest(conn) < 0)
+			return -1;
+#endif
+		ret |= r;
+	}
+
+	return ret;
+}
+
+
+/**
+ * Forget for which clients reading has been
+ * suspended, done when the main loop exits
+ */
+static void
+forget_suspended_reading(void)
+{
+	free(read_suspended);
+	read_suspended = NULL;
+	read_suspended_alloc = 0;
+	reading_suspended = 0;
+}
+
+
 /**
  * Disconnect all clients
  */
@@ -293,6 +1130,8 @@ disconnect_all(void)
 }
 
 
+#if defined(USE_EPOLL)
+
 /**
  * The program's main loop
  * 
@@ -301,15 +1140,49 @@ disconnect_all(void)
 int
 main_loop(void)
 {
-	struct pollfd *fds = NULL;
-	nfds_t i, fdn = 0, fds_alloc = 0;
-	int r, update, do_read, do_write, fd;
-	size_t j;
+	struct epoll_event events[EPOLL_EVENTS_MAX];
+	int i, n, r;
+	size_t conn;
 
-	if (update_fdset(&fds, &fdn, &fds_alloc) < 0)
+	if (initialise_epoll() < 0)
 		goto fail;
 
 	while (!reexec && !terminate) {
+		n = epoll_wait(epollfd, events, EPOLL_EVENTS_MAX, reading_resumable() ? 0 : -1);
+		if (n < 0) {
+			if (errno != EINTR)
+				goto fail;
+			n = 0;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.u64 == SERVER_EPOLL_DATA) {
+				r = handle_server(&conn);
+				if (r > 0 && watch_connection(conn) < 0)
+					goto fail;
+			} else if (events[i].data.u64 == TIMER_EPOLL_DATA) {
+				r = handle_timer();
+			} else {
+				conn = (size_t)(events[i].data.u64);
+				r = 0;
+				/* Send before reading, in case reading has been
+				 * suspended because too much is queued. */
+				if (events[i].events & EPOLLOUT)
+					r = continue_send(conn);
+				if (r >= 0)
+					r = handle_connection(conn);
+				if (r >= 0 && update_write_interest(conn) < 0)
+					goto fail;
+			}
+			if (r < 0)
+				goto fail;
+		}
+		if (resume_reading() < 0)
+			goto fail;
+
+		/* The site is disconnected from or reconnected to after the
+		 * events, so that hotplugged outputs are reported before
+		 * waiting for the next event */
 		if (connection) {
 			if ((connection == 1 ? disconnect() : reconnect()) < 0) {
 				connection = 0;
@@ -317,19 +1190,70 @@ main_loop(void)
 			}
 			connection = 0;
 		}
+		if (flush_outputs() < 0 || send_events() < 0)
+			goto fail;
+		for (conn = 0; conn < connections_used; conn++)
+			if (subscriptions[conn].events && update_write_interest(conn) < 0)
+				goto fail;
+		if (update_timer() < 0)
+			goto fail;
+	}
+
+	destroy_epoll();
+	forget_suspended_reading();
+	return 0;
+
+fail:
+	destroy_epoll();
+	forget_suspended_reading();
+	return -1;
+}
 
+#else
+
+/**
+ * The program's main loop
+ * 
+ * @return  Zero on success, -1 on error
+ */
+int
+main_loop(void)
+{
+	struct pollfd *fds = NULL;
+	nfds_t i, fdn = 0, fds_alloc = 0;
+	int r, update, do_read, do_write, fd, timeout;
+	uint64_t now, next_frame = 0;
+	size_t j;
+
+	if (update_fdset(&fds, &fdn, &fds_alloc) < 0)
+		goto fail;
+
+	while (!reexec && !terminate) {
 		for (j = 0, i = 0; j < connections_used; j++) {
 			if (connections[j] >= 0) {
 				fds[i].revents = 0;
+				fds[i].events = NON_WR_POLL_EVENTS;
+				if (outbound[j].bytes >= OUTBOUND_HIGH_WATER_MARK)
+					fds[i].events &= ~(POLLIN | POLLRDNORM | POLLRDBAND | POLLPRI);
 				if (ring_have_more(outbound + j))
-					fds[(size_t)i++ + j].events |= POLLOUT;
-				else
-					fds[(size_t)i++ + j].events &= ~POLLOUT;
+					fds[i].events |= POLLOUT;
+				i++;
 			}
 		}
 		fds[i].revents = 0;
 
-		if (poll(fds, fdn, -1) < 0) {
+		/* Without timerfd(2), transitions are paced with the timeout */
+		timeout = -1;
+		if (transitions_n) {
+			now = stats_clock();
+			if (!next_frame)
+				next_frame = now + frame_period();
+			timeout = next_frame <= now ? 0 : (int)((next_frame - now + 999999ULL) / 1000000ULL);
+		}
+		if (reading_resumable())
+			timeout = 0;
+
+		if (poll(fds, fdn, timeout) < 0) {
 			if (errno == EAGAIN)
 				perror(argv0);
 			else if (errno != EINTR)
@@ -345,7 +1269,7 @@ main_loop(void)
 				continue;
 
 			if (fd == socketfd) {
-				r = handle_server();
+				r = handle_server(&j);
 			} else {
 				for (j = 0; connections[j] != fd; j++);
 				r = do_read ? handle_connection(j) : 0;
@@ -357,14 +1281,41 @@ main_loop(void)
 				goto fail;
 			update |= r > 0;
 		}
+		if ((r = resume_reading()) < 0)
+			goto fail;
+		update |= r;
+		if (next_frame && (now = stats_clock()) >= next_frame) {
+			/* Missed frames are not caught up on */
+			next_frame = now + frame_period();
+			if (advance_transitions() < 0)
+				goto fail;
+		}
+		if (!transitions_n)
+			next_frame = 0;
+		/* The site is disconnected from or reconnected to after the
+		 * events, so that hotplugged outputs are reported before
+		 * waiting for the next event */
+		if (connection) {
+			if ((connection == 1 ? disconnect() : reconnect()) < 0) {
+				connection = 0;
+				goto fail;
+			}
+			connection = 0;
+		}
+		if (flush_outputs() < 0 || send_events() < 0)
+			goto fail;
 		if (update && update_fdset(&fds, &fdn, &fds_alloc) < 0)
 			goto fail;
 	}
 
 	free(fds);
+	forget_suspended_reading();
 	return 0;
 
 fail:
 	free(fds);
+	forget_suspended_reading();
 	return -1;
 }
+
+#endif
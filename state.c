@@ -1,5 +1,7 @@
 /* See LICENSE file for copyright and license details. */
 #include "state.h"
+#include "types-blob.h"
+#include "types-pool.h"
 #include "util.h"
 
 #include <inttypes.h>
@@ -87,6 +89,36 @@ struct message *restrict inbound = NULL;
  */
 struct ring *restrict outbound = NULL;
 
+/**
+ * The clients' subscriptions to events
+ */
+struct subscription *restrict subscriptions = NULL;
+
+/**
+ * The filters owned by each client
+ */
+struct ownership *restrict ownerships = NULL;
+
+/**
+ * The clients' transactions
+ */
+struct transaction *restrict transactions = NULL;
+
+/**
+ * The filters that are being faded by the server
+ */
+struct transition *restrict transitions = NULL;
+
+/**
+ * The number of elements in `transitions`
+ */
+size_t transitions_n = 0;
+
+/**
+ * The number of elements allocated to `transitions`
+ */
+size_t transitions_alloc = 0;
+
 /**
  * Is the server connect to the display?
  * 
@@ -124,6 +156,12 @@ struct libgamma_crtc_state *restrict crtcs = NULL; /* do not marshal */
  */
 int preserve = 0;
 
+/**
+ * The number of times per second filters
+ * that are being faded are updated
+ */
+unsigned frame_rate = 60;
+
 
 /**
  * As part of a state dump, dump one or two gamma ramp-trios
@@ -195,6 +233,7 @@ state_dump(void)
 	const char *str;
 	struct filter *restrict filter;
 	union gamma_ramps left;
+	struct blob_usage usage;
 	size_t depth;
 		
 	fprintf(stderr, "argv0: %s\n", argv0 ? argv0 : "(null)");
@@ -211,6 +250,15 @@ state_dump(void)
 		fprintf(stderr, "Pending connection change: %i (CORRUPT STATE)\n", connection);
 	fprintf(stderr, "Adjustment method: %i\n", method);
 	fprintf(stderr, "Site name: %s\n", sitename ? sitename : "(automatic)");
+	blob_usage(&usage);
+	fprintf(stderr, "Stored ramps: %zu\n", usage.blobs);
+	fprintf(stderr, "Stored ramp bytes: %zu\n", usage.stored);
+	fprintf(stderr, "Ramp bytes saved: %zu\n", usage.referenced - usage.stored);
+	fprintf(stderr, "Transition frame rate: %u\n", frame_rate);
+	fprintf(stderr, "Transitions: %zu\n", transitions_n);
+	for (i = 0; i < transitions_n; i++)
+		fprintf(stderr, "  %s: %s, %"PRIu64" ns from %"PRIu64"\n", transitions[i].crtc,
+		        transitions[i].class, transitions[i].duration, transitions[i].begin);
 	fprintf(stderr, "Clients:\n");
 	fprintf(stderr, "  Next empty slot: %zu\n", connections_ptr);
 	fprintf(stderr, "  Initialised slots: %zu\n", connections_used);
@@ -231,21 +279,48 @@ state_dump(void)
 				fprintf(stderr, "    Inbound message:\n");
 				fprintf(stderr, "      Header array: %s\n", inbound[i].headers ? "non-null" : "null");
 				fprintf(stderr, "      Headers: %zu\n", inbound[i].header_count);
-				fprintf(stderr, "      Payload buffer: %s\n", inbound[i].payload ? "non-null" : "null");
+				fprintf(stderr, "      Header slots allocated: %zu\n", inbound[i].headers_alloc);
+				fprintf(stderr, "      Payload: %s\n", inbound[i].payload ? "non-null" : "null");
 				fprintf(stderr, "      Payload size: %zu\n", inbound[i].payload_size);
-				fprintf(stderr, "      Payload write pointer: %zu\n", inbound[i].payload_ptr);
+				fprintf(stderr, "      Payload offset: %zu\n", inbound[i].payload_offset);
 				fprintf(stderr, "      Message buffer: %s\n", inbound[i].buffer ? "non-null" : "null");
 				fprintf(stderr, "      Message buffer size: %zu\n", inbound[i].buffer_size);
 				fprintf(stderr, "      Message buffer write pointer: %zu\n", inbound[i].buffer_ptr);
+				fprintf(stderr, "      Message start: %zu\n", inbound[i].message_start);
+				fprintf(stderr, "      Message parse pointer: %zu\n", inbound[i].parse_ptr);
 				fprintf(stderr, "      Read stage: %i\n", inbound[i].stage);
 			}
 			if (!outbound) {
 				fprintf(stderr, "    Outbound message array is null\n");
 			} else {
-				fprintf(stderr, "      Ring buffer: %s\n", outbound[i].buffer ? "non-null" : "null");
-				fprintf(stderr, "      Head: %zu\n", outbound[i].end);
+				fprintf(stderr, "      Ring buffer: %s\n", outbound[i].messages ? "non-null" : "null");
 				fprintf(stderr, "      Tail: %zu\n", outbound[i].start);
+				fprintf(stderr, "      Messages: %zu\n", outbound[i].count);
 				fprintf(stderr, "      Size: %zu\n", outbound[i].size);
+				fprintf(stderr, "      Sent of first message: %zu bytes\n", outbound[i].offset);
+				fprintf(stderr, "      Queued: %zu bytes\n", outbound[i].bytes);
+			}
+			if (!subscriptions) {
+				fprintf(stderr, "    Subscription array is null\n");
+			} else {
+				fprintf(stderr, "    Subscription:\n");
+				fprintf(stderr, "      Events: %#x\n", subscriptions[i].events);
+				fprintf(stderr, "      Coalesced events: %#x\n", subscriptions[i].coalesced);
+				fprintf(stderr, "      CRTC: %s\n", subscriptions[i].crtc ? subscriptions[i].crtc : "(all)");
+			}
+			if (!ownerships) {
+				fprintf(stderr, "    Ownership array is null\n");
+			} else {
+				fprintf(stderr, "    Owned filters: %zu\n", ownerships[i].n);
+				for (j = 0; j < ownerships[i].n; j++)
+					fprintf(stderr, "      %s: %s\n", ownerships[i].filters[j].crtc,
+					        ownerships[i].filters[j].class);
+			}
+			if (!transactions) {
+				fprintf(stderr, "    Transaction array is null\n");
+			} else {
+				fprintf(stderr, "    Transaction: %s\n", transactions[i].open ? "begun" : "none");
+				fprintf(stderr, "      Staged changes: %zu\n", transactions[i].n);
 			}
 		}
 	}
@@ -308,6 +383,18 @@ state_dump(void)
 				fprintf(stderr, "    Filter table:\n");
 				fprintf(stderr, "      Filter count: %zu\n", out->table_size);
 				fprintf(stderr, "      Slots allocated: %zu\n", out->table_alloc);
+				fprintf(stderr, "      Up-to-date results: %zu\n", out->table_sums_valid);
+				fprintf(stderr, "      Result table stride: %zu\n", output_sums_stride(out));
+				fprintf(stderr, "      Composition tree leaves: %zu\n", out->tree_leaves);
+				fprintf(stderr, "      Class index slots: %zu\n", out->class_index_size);
+				if (out->last_updated)
+					fprintf(stderr, "      Updated filters: %zu to %zu\n", out->first_updated, out->last_updated - 1);
+				fprintf(stderr, "      Flush pending: %s\n", out->flush_pending ? "yes" : "no");
+				fprintf(stderr, "      Generation: %"PRIu64"\n", out->generation);
+				for (j = 0; j < WINDOW_CACHE_SIZE; j++)
+					if (out->windows[j].last_used && out->windows[j].generation == out->generation)
+						fprintf(stderr, "      Cached window: [%zu, %zu)\n",
+						        out->windows[j].start, out->windows[j].end);
 				if (out->table_size > 0) {
 					if (!out->table_filters)
 						fprintf(stderr, "      Filter table is null\n");
@@ -392,12 +479,22 @@ state_destroy(void)
 		if (connections[i] >= 0) {
 			message_destroy(inbound + i);
 			ring_destroy(outbound + i);
+			subscription_destroy(subscriptions + i);
+			ownership_destroy(ownerships + i);
+			transaction_destroy(transactions + i);
 		}
 	}
 	free(inbound);
 	free(outbound);
+	free(subscriptions);
+	free(ownerships);
+	free(transactions);
 	free(connections);
 
+	for (i = 0; i < transitions_n; i++)
+		transition_destroy(transitions + i);
+	free(transitions);
+
 	if (outputs)
 		for (i = 0; i < outputs_n; i++)
 			output_destroy(outputs + i);
@@ -415,6 +512,9 @@ state_destroy(void)
 
 	libgamma_site_destroy(&site);
 	free(sitename);
+
+	pool_trim();
+	blob_trim();
 }
 
 
@@ -484,6 +584,9 @@ state_marshal(void *restrict buf)
 		if (connections[i] >= 0) {
 			off += message_marshal(&inbound[i], bs ? &bs[off] : NULL);
 			off += ring_marshal(&outbound[i], bs ? &bs[off] : NULL);
+			off += subscription_marshal(&subscriptions[i], bs ? &bs[off] : NULL);
+			off += ownership_marshal(&ownerships[i], bs ? &bs[off] : NULL);
+			off += transaction_marshal(&transactions[i], bs ? &bs[off] : NULL);
 		}
 	}
 
@@ -505,6 +608,17 @@ state_marshal(void *restrict buf)
 		*(int *)&bs[off] = preserve;
 	off += sizeof(int);
 
+	if (bs)
+		*(unsigned *)&bs[off] = frame_rate;
+	off += sizeof(unsigned);
+
+	if (bs)
+		*(size_t *)&bs[off] = transitions_n;
+	off += sizeof(size_t);
+
+	for (i = 0; i < transitions_n; i++)
+		off += transition_marshal(transitions + i, bs ? &bs[off] : NULL);
+
 	return off;
 }
 
@@ -574,6 +688,18 @@ state_unmarshal(const void *restrict buf)
 		outbound = malloc(connections_used * sizeof(*outbound));
 		if (!outbound)
 			return 0;
+
+		subscriptions = malloc(connections_used * sizeof(*subscriptions));
+		if (!subscriptions)
+			return 0;
+
+		ownerships = malloc(connections_used * sizeof(*ownerships));
+		if (!ownerships)
+			return 0;
+
+		transactions = malloc(connections_used * sizeof(*transactions));
+		if (!transactions)
+			return 0;
 	}
 
 	for (i = 0; i < connections_used; i++) {
@@ -584,6 +710,15 @@ state_unmarshal(const void *restrict buf)
 			off += n = ring_unmarshal(&outbound[i], &bs[off]);
 			if (!n)
 				return 0;
+			off += n = subscription_unmarshal(&subscriptions[i], &bs[off]);
+			if (!n)
+				return 0;
+			off += n = ownership_unmarshal(&ownerships[i], &bs[off]);
+			if (!n)
+				return 0;
+			off += n = transaction_unmarshal(&transactions[i], &bs[off]);
+			if (!n)
+				return 0;
 		}
 	}
 
@@ -603,6 +738,24 @@ state_unmarshal(const void *restrict buf)
 	preserve = *(const int *)&bs[off];
 	off += sizeof(int);
 
+	frame_rate = *(const unsigned *)&bs[off];
+	off += sizeof(unsigned);
+
+	transitions_alloc = *(const size_t *)&bs[off];
+	off += sizeof(size_t);
+
+	if (transitions_alloc > 0) {
+		transitions = malloc(transitions_alloc * sizeof(*transitions));
+		if (!transitions)
+			return 0;
+	}
+
+	for (; transitions_n < transitions_alloc; transitions_n++) {
+		off += n = transition_unmarshal(transitions + transitions_n, &bs[off]);
+		if (!n)
+			return 0;
+	}
+
 	return off;
 }
 
@@ -5,6 +5,10 @@
 #include "types-message.h"
 #include "types-ring.h"
 #include "types-output.h"
+#include "types-ownership.h"
+#include "types-subscription.h"
+#include "types-transaction.h"
+#include "types-transition.h"
 
 #include <libgamma.h>
 
@@ -98,6 +102,36 @@ extern struct message *restrict inbound;
  */
 extern struct ring *restrict outbound;
 
+/**
+ * The clients' subscriptions to events
+ */
+extern struct subscription *restrict subscriptions;
+
+/**
+ * The filters owned by each client
+ */
+extern struct ownership *restrict ownerships;
+
+/**
+ * The clients' transactions
+ */
+extern struct transaction *restrict transactions;
+
+/**
+ * The filters that are being faded by the server
+ */
+extern struct transition *restrict transitions;
+
+/**
+ * The number of elements in `transitions`
+ */
+extern size_t transitions_n;
+
+/**
+ * The number of elements allocated to `transitions`
+ */
+extern size_t transitions_alloc;
+
 /**
  * Is the server connect to the display?
  * 
@@ -135,6 +169,12 @@ extern struct libgamma_crtc_state *restrict crtcs;
  */
 extern int preserve;
 
+/**
+ * The number of times per second filters
+ * that are being faded are updated
+ */
+extern unsigned frame_rate;
+
 /**
  * Dump the state to stderr
  */
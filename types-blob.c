@@ -0,0 +1,521 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-blob.h"
+#include "types-stats.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic ignored "-Wcast-align"
+#endif
+
+
+/**
+ * The smallest number of slots in `blobs`
+ */
+#define BLOBS_MIN_ALLOC 64
+
+/**
+ * The largest number of blob sizes for which
+ * freed blobs are kept, usually one per gamma
+ * ramp layout
+ */
+#define BLOB_POOLS 8
+
+/**
+ * The largest number of freed blobs kept of each size
+ */
+#define BLOB_POOL_MAX 16
+
+
+/**
+ * A blob
+ */
+struct blob {
+	/**
+	 * The number of references to the blob
+	 */
+	size_t refs;
+
+	/**
+	 * The hash of the blob, unused
+	 * unless the blob is interned
+	 */
+	size_t hash;
+
+	/**
+	 * The byte-size of the blob
+	 */
+	size_t size;
+
+	/**
+	 * The next freed blob of the same size,
+	 * used while the blob is in a pool
+	 */
+	struct blob *next;
+
+	/**
+	 * Whether the blob is interned
+	 */
+	char interned;
+
+	/**
+	 * The content of the blob, aligned so
+	 * that it can hold ramps of any depth
+	 */
+	_Alignas(max_align_t) unsigned char data[];
+};
+
+
+/**
+ * Freed blobs of one size, kept so that ramps
+ * that replace ramps of the same size do not
+ * need to be allocated
+ */
+struct blob_pool {
+	/**
+	 * The size of the blobs in the pool
+	 */
+	size_t size;
+
+	/**
+	 * The number of blobs in the pool
+	 */
+	size_t count;
+
+	/**
+	 * The first blob in the pool
+	 */
+	struct blob *first;
+};
+
+
+/**
+ * Open-addressing hash table, with linear
+ * probing, of all interned blobs, unused
+ * slots are `NULL`
+ */
+static struct blob **blobs = NULL;
+
+/**
+ * The number of slots in `blobs`, always
+ * a power of two (or 0)
+ */
+static size_t blobs_alloc = 0;
+
+/**
+ * The number of used slots in `blobs`
+ */
+static size_t blobs_used = 0;
+
+/**
+ * Pools of freed blobs, a pool with no blobs
+ * may be reused for blobs of another size
+ */
+static struct blob_pool pools[BLOB_POOLS];
+
+/**
+ * The number of bytes stored in interned blobs
+ */
+static size_t bytes_stored = 0;
+
+/**
+ * The number of bytes referenced in interned
+ * blobs, counting each reference
+ */
+static size_t bytes_referenced = 0;
+
+
+/**
+ * Get the blob a blob's content belongs to
+ * 
+ * @param   data  The content of the blob
+ * @return        The blob
+ */
+GCC_ONLY(__attribute__((__const__, __nonnull__)))
+static inline struct blob *
+get_blob(const void *restrict data)
+{
+	return (struct blob *)(void *)((const char *)data - offsetof(struct blob, data));
+}
+
+
+/**
+ * Allocate a blob, preferably from the pool
+ * of freed blobs of the same size
+ * 
+ * @param   size  The byte-size of the blob's content
+ * @return        The blob, with only `.size` set; `NULL` on error
+ */
+static struct blob *
+allocate_blob(size_t size)
+{
+	struct blob *blob;
+	size_t i;
+
+	for (i = 0; i < BLOB_POOLS; i++) {
+		if (pools[i].size == size && pools[i].count) {
+			blob = pools[i].first;
+			pools[i].first = blob->next;
+			pools[i].count -= 1;
+			stats.counters[COUNTER_RAMP_POOL_HITS] += 1;
+			return blob;
+		}
+	}
+
+	blob = malloc(offsetof(struct blob, data) + size);
+	if (!blob)
+		return NULL;
+	blob->size = size;
+	stats.counters[COUNTER_RAMP_POOL_MISSES] += 1;
+	return blob;
+}
+
+
+/**
+ * Free a blob, or keep it in the pool of
+ * freed blobs of the same size
+ * 
+ * @param  blob  The blob
+ */
+static void
+free_blob(struct blob *restrict blob)
+{
+	struct blob_pool *pool = NULL;
+	size_t i;
+
+	for (i = 0; i < BLOB_POOLS; i++) {
+		if (pools[i].size == blob->size) {
+			pool = pools + i;
+			break;
+		}
+		if (!pool && !pools[i].count)
+			pool = pools + i;
+	}
+
+	if (!pool || pool->count == BLOB_POOL_MAX) {
+		free(blob);
+		return;
+	}
+
+	pool->size = blob->size;
+	blob->next = pool->first;
+	pool->first = blob;
+	pool->count += 1;
+}
+
+
+/**
+ * Calculate the hash of a blob
+ * 
+ * The blob is hashed a word at a time, rather than a
+ * byte at a time, as ramps are several kilobytes
+ * 
+ * @param   data  The content of the blob
+ * @param   size  The byte-size of `data`
+ * @return        The hash of the blob
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static size_t
+calculate_hash(const void *restrict data, size_t size)
+{
+	const unsigned char *restrict bs = data;
+	uint64_t hash = 14695981039346656037ULL ^ (uint64_t)size, word;
+
+	for (; size >= sizeof(word); size -= sizeof(word), bs += sizeof(word)) {
+		memcpy(&word, bs, sizeof(word));
+		hash = (hash ^ word) * 1099511628211ULL;
+		hash ^= hash >> 32;
+	}
+	while (size--) {
+		hash ^= (uint64_t)*bs++;
+		hash *= 1099511628211ULL;
+	}
+
+	return (size_t)(hash ^ (hash >> 29));
+}
+
+
+/**
+ * Resize the hash table of interned blobs
+ * 
+ * @param   alloc  The new number of slots, must be a power of two
+ * @return         Zero on success, -1 on error
+ */
+static int
+resize_blobs(size_t alloc)
+{
+	struct blob **new;
+	size_t i, j;
+
+	new = calloc(alloc, sizeof(*new));
+	if (!new)
+		return -1;
+
+	for (i = 0; i < blobs_alloc; i++) {
+		if (!blobs[i])
+			continue;
+		for (j = blobs[i]->hash & (alloc - 1); new[j]; j = (j + 1) & (alloc - 1));
+		new[j] = blobs[i];
+	}
+
+	free(blobs);
+	blobs = new;
+	blobs_alloc = alloc;
+	return 0;
+}
+
+
+/**
+ * Look up an interned blob
+ * 
+ * @param   data  The content of the blob
+ * @param   size  The byte-size of `data`
+ * @param   hash  The hash of the blob
+ * @return        The blob, with a new reference;
+ *                `NULL` if it has not been interned
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static struct blob *
+lookup(const void *restrict data, size_t size, size_t hash)
+{
+	struct blob *blob;
+	size_t i;
+
+	if (!blobs_alloc)
+		return NULL;
+
+	for (i = hash & (blobs_alloc - 1); (blob = blobs[i]); i = (i + 1) & (blobs_alloc - 1)) {
+		if (blob->hash == hash && blob->size == size && !memcmp(blob->data, data, size)) {
+			blob->refs += 1;
+			bytes_referenced += size;
+			return blob;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Get the interned copy of a blob
+ * 
+ * The same ramps are often applied to several
+ * identical outputs, or by several clients,
+ * interning lets all of the filters share one
+ * copy of them, and lets them be compared by
+ * their addresses
+ * 
+ * @param   data  The content of the blob
+ * @param   size  The byte-size of `data`
+ * @return        The interned copy of the blob, it shall be
+ *                released with `blob_release`, and must not
+ *                be modified; `NULL` on error
+ */
+void *
+blob_intern(const void *restrict data, size_t size)
+{
+	size_t hash = calculate_hash(data, size), i;
+	struct blob *blob;
+
+	if ((blob = lookup(data, size, hash)))
+		return blob->data;
+
+	/* Keep the table at most half full */
+	if (2 * (blobs_used + 1) > blobs_alloc)
+		if (resize_blobs(blobs_alloc ? 2 * blobs_alloc : BLOBS_MIN_ALLOC) < 0)
+			return NULL;
+
+	blob = allocate_blob(size);
+	if (!blob)
+		return NULL;
+	blob->refs = 1;
+	blob->hash = hash;
+	blob->interned = 1;
+	memcpy(blob->data, data, size);
+
+	for (i = hash & (blobs_alloc - 1); blobs[i]; i = (i + 1) & (blobs_alloc - 1));
+	blobs[i] = blob;
+	blobs_used += 1;
+	bytes_stored += size;
+	bytes_referenced += size;
+
+	return blob->data;
+}
+
+
+/**
+ * Get the interned copy of a blob, if there is one
+ * 
+ * @param   data  The content of the blob
+ * @param   size  The byte-size of `data`
+ * @return        The interned copy of the blob, with a new
+ *                reference, as returned by `blob_intern`;
+ *                `NULL` if the blob has not been interned
+ */
+void *
+blob_find(const void *restrict data, size_t size)
+{
+	struct blob *blob = lookup(data, size, calculate_hash(data, size));
+	return blob ? blob->data : NULL;
+}
+
+
+/**
+ * Get a copy of a blob that is not interned, and
+ * that may therefore be modified
+ * 
+ * @param   data  The content of the blob
+ * @param   size  The byte-size of `data`
+ * @return        The blob, it shall be released with
+ *                `blob_release`; `NULL` on error
+ */
+void *
+blob_private(const void *restrict data, size_t size)
+{
+	struct blob *blob;
+
+	blob = allocate_blob(size);
+	if (!blob)
+		return NULL;
+	blob->refs = 1;
+	blob->hash = 0;
+	blob->interned = 0;
+	memcpy(blob->data, data, size);
+
+	return blob->data;
+}
+
+
+/**
+ * Get a blob that may be modified in place of a blob
+ * 
+ * @param   blob  The blob, its reference is transferred
+ *                to this function on success
+ * @return        `blob` if it is not interned and has no
+ *                other references, otherwise a copy of it
+ *                as returned by `blob_private`; `NULL` on
+ *                error, in which case `blob` is kept
+ */
+void *
+blob_unshare(void *restrict blob)
+{
+	struct blob *b = get_blob(blob);
+	void *copy;
+
+	if (!b->interned && b->refs == 1)
+		return blob;
+
+	copy = blob_private(blob, b->size);
+	if (copy)
+		blob_release(blob);
+	return copy;
+}
+
+
+/**
+ * Add a reference to a blob
+ * 
+ * @param   blob  The blob
+ * @return        `blob`
+ */
+void *
+blob_ref(void *restrict blob)
+{
+	struct blob *b = get_blob(blob);
+
+	b->refs += 1;
+	if (b->interned)
+		bytes_referenced += b->size;
+
+	return blob;
+}
+
+
+/**
+ * Release a reference to a blob
+ * 
+ * @param  blob  The blob, may be `NULL`
+ */
+void
+blob_release(void *restrict blob)
+{
+	struct blob *b;
+	size_t i, j, k, mask = blobs_alloc - 1;
+
+	if (!blob)
+		return;
+
+	b = get_blob(blob);
+	if (b->interned)
+		bytes_referenced -= b->size;
+	if (--b->refs)
+		return;
+
+	if (!b->interned) {
+		free_blob(b);
+		return;
+	}
+
+	for (i = b->hash & mask; blobs[i] != b; i = (i + 1) & mask);
+
+	/* Move back following blobs in the probe sequence, so
+	 * that no blob is separated from its home slot by the
+	 * slot that is being freed */
+	for (j = i;;) {
+		j = (j + 1) & mask;
+		if (!blobs[j])
+			break;
+		k = blobs[j]->hash & mask;
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			blobs[i] = blobs[j];
+			i = j;
+		}
+	}
+	blobs[i] = NULL;
+	blobs_used -= 1;
+	bytes_stored -= b->size;
+
+	free_blob(b);
+
+	if (!blobs_used) {
+		free(blobs);
+		blobs = NULL;
+		blobs_alloc = 0;
+	}
+}
+
+
+/**
+ * Get how much memory interned blobs use
+ * 
+ * @param  usage  Output parameter for the memory usage
+ */
+void
+blob_usage(struct blob_usage *restrict usage)
+{
+	usage->blobs = blobs_used;
+	usage->stored = bytes_stored;
+	usage->referenced = bytes_referenced;
+}
+
+
+/**
+ * Free all freed blobs that are kept for reuse
+ */
+void
+blob_trim(void)
+{
+	struct blob *blob;
+	size_t i;
+
+	for (i = 0; i < BLOB_POOLS; i++) {
+		while ((blob = pools[i].first)) {
+			pools[i].first = blob->next;
+			free(blob);
+		}
+		pools[i].count = 0;
+	}
+}
@@ -0,0 +1,122 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_BLOB_H
+#define TYPES_BLOB_H
+
+#include <stddef.h>
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+/**
+ * Memory used by interned blobs
+ */
+struct blob_usage {
+	/**
+	 * The number of interned blobs
+	 */
+	size_t blobs;
+
+	/**
+	 * The number of bytes stored in interned blobs
+	 */
+	size_t stored;
+
+	/**
+	 * The number of bytes that would have been stored
+	 * if each reference to an interned blob had its
+	 * own copy of it
+	 */
+	size_t referenced;
+};
+
+
+/**
+ * Get the interned copy of a blob
+ * 
+ * The same ramps are often applied to several
+ * identical outputs, or by several clients,
+ * interning lets all of the filters share one
+ * copy of them, and lets them be compared by
+ * their addresses
+ * 
+ * @param   data  The content of the blob
+ * @param   size  The byte-size of `data`
+ * @return        The interned copy of the blob, it shall be
+ *                released with `blob_release`, and must not
+ *                be modified; `NULL` on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void *blob_intern(const void *restrict data, size_t size);
+
+/**
+ * Get the interned copy of a blob, if there is one
+ * 
+ * @param   data  The content of the blob
+ * @param   size  The byte-size of `data`
+ * @return        The interned copy of the blob, with a new
+ *                reference, as returned by `blob_intern`;
+ *                `NULL` if the blob has not been interned
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void *blob_find(const void *restrict data, size_t size);
+
+/**
+ * Get a copy of a blob that is not interned, and
+ * that may therefore be modified
+ * 
+ * @param   data  The content of the blob
+ * @param   size  The byte-size of `data`
+ * @return        The blob, it shall be released with
+ *                `blob_release`; `NULL` on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void *blob_private(const void *restrict data, size_t size);
+
+/**
+ * Get a blob that may be modified in place of a blob
+ * 
+ * @param   blob  The blob, its reference is transferred
+ *                to this function on success
+ * @return        `blob` if it is not interned and has no
+ *                other references, otherwise a copy of it
+ *                as returned by `blob_private`; `NULL` on
+ *                error, in which case `blob` is kept
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void *blob_unshare(void *restrict blob);
+
+/**
+ * Add a reference to a blob
+ * 
+ * @param   blob  The blob
+ * @return        `blob`
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void *blob_ref(void *restrict blob);
+
+/**
+ * Release a reference to a blob
+ * 
+ * @param  blob  The blob, may be `NULL`
+ */
+void blob_release(void *restrict blob);
+
+/**
+ * Get how much memory interned blobs use
+ * 
+ * @param  usage  Output parameter for the memory usage
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void blob_usage(struct blob_usage *restrict usage);
+
+/**
+ * Free all freed blobs that are kept for reuse
+ */
+void blob_trim(void);
+
+#endif
@@ -0,0 +1,227 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-class.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic ignored "-Wcast-align"
+#endif
+
+
+/**
+ * The smallest number of slots in `classes`
+ */
+#define CLASSES_MIN_ALLOC 64
+
+
+/**
+ * An interned class
+ */
+struct interned_class {
+	/**
+	 * The number of references to the class
+	 */
+	size_t refs;
+
+	/**
+	 * The hash of the class
+	 */
+	size_t hash;
+
+	/**
+	 * The class, NUL-terminated
+	 */
+	char class[];
+};
+
+
+/**
+ * Open-addressing hash table, with linear
+ * probing, of all interned classes, unused
+ * slots are `NULL`
+ */
+static struct interned_class **classes = NULL;
+
+/**
+ * The number of slots in `classes`, always
+ * a power of two (or 0)
+ */
+static size_t classes_alloc = 0;
+
+/**
+ * The number of used slots in `classes`
+ */
+static size_t classes_used = 0;
+
+
+/**
+ * Get the interned class a class string belongs to
+ * 
+ * @param   class  The interned class string
+ * @return         The interned class
+ */
+GCC_ONLY(__attribute__((__const__, __nonnull__)))
+static inline struct interned_class *
+get_interned(const char *restrict class)
+{
+	return (struct interned_class *)(void *)(class - offsetof(struct interned_class, class));
+}
+
+
+/**
+ * Calculate the hash of a class
+ * 
+ * @param   class  The class
+ * @return         The hash of the class
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static size_t
+calculate_hash(const char *restrict class)
+{
+	size_t hash = (size_t)14695981039346656037ULL;
+	while (*class) {
+		hash ^= (size_t)(unsigned char)*class++;
+		hash *= (size_t)1099511628211ULL;
+	}
+	return hash;
+}
+
+
+/**
+ * Resize the hash table of interned classes
+ * 
+ * @param   alloc  The new number of slots, must be a power of two
+ * @return         Zero on success, -1 on error
+ */
+static int
+resize_classes(size_t alloc)
+{
+	struct interned_class **new;
+	size_t i, j;
+
+	new = calloc(alloc, sizeof(*new));
+	if (!new)
+		return -1;
+
+	for (i = 0; i < classes_alloc; i++) {
+		if (!classes[i])
+			continue;
+		for (j = classes[i]->hash & (alloc - 1); new[j]; j = (j + 1) & (alloc - 1));
+		new[j] = classes[i];
+	}
+
+	free(classes);
+	classes = new;
+	classes_alloc = alloc;
+	return 0;
+}
+
+
+/**
+ * Get the interned copy of a filter class
+ * 
+ * The same class is usually applied to every
+ * output, interning lets all of the filters
+ * share one copy of it, and lets classes be
+ * compared by their addresses
+ * 
+ * @param   class  The class
+ * @return         The interned copy of the class, it shall
+ *                 be released with `class_release`, and
+ *                 must not be modified; `NULL` on error
+ */
+char *
+class_intern(const char *restrict class)
+{
+	size_t hash = calculate_hash(class), i, n;
+	struct interned_class *interned;
+
+	if (classes_alloc) {
+		for (i = hash & (classes_alloc - 1); classes[i]; i = (i + 1) & (classes_alloc - 1)) {
+			if (classes[i]->hash == hash && !strcmp(classes[i]->class, class)) {
+				classes[i]->refs += 1;
+				return classes[i]->class;
+			}
+		}
+	}
+
+	/* Keep the table at most half full */
+	if (2 * (classes_used + 1) > classes_alloc)
+		if (resize_classes(classes_alloc ? 2 * classes_alloc : CLASSES_MIN_ALLOC) < 0)
+			return NULL;
+
+	n = strlen(class) + 1;
+	interned = malloc(offsetof(struct interned_class, class) + n);
+	if (!interned)
+		return NULL;
+	interned->refs = 1;
+	interned->hash = hash;
+	memcpy(interned->class, class, n);
+
+	for (i = hash & (classes_alloc - 1); classes[i]; i = (i + 1) & (classes_alloc - 1));
+	classes[i] = interned;
+	classes_used += 1;
+
+	return interned->class;
+}
+
+
+/**
+ * Release a reference to an interned class
+ * 
+ * @param  class  The interned class, may be `NULL`
+ */
+void
+class_release(char *restrict class)
+{
+	struct interned_class *interned;
+	size_t i, j, k, mask = classes_alloc - 1;
+
+	if (!class)
+		return;
+
+	interned = get_interned(class);
+	if (--interned->refs)
+		return;
+
+	for (i = interned->hash & mask; classes[i] != interned; i = (i + 1) & mask);
+
+	/* Move back following classes in the probe sequence, so
+	 * that no class is separated from its home slot by the
+	 * slot that is being freed */
+	for (j = i;;) {
+		j = (j + 1) & mask;
+		if (!classes[j])
+			break;
+		k = classes[j]->hash & mask;
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			classes[i] = classes[j];
+			i = j;
+		}
+	}
+	classes[i] = NULL;
+	classes_used -= 1;
+
+	free(interned);
+
+	if (!classes_used) {
+		free(classes);
+		classes = NULL;
+		classes_alloc = 0;
+	}
+}
+
+
+/**
+ * Get the hash of an interned class
+ * 
+ * @param   class  The interned class
+ * @return         The hash of the class
+ */
+size_t
+class_hash(const char *restrict class)
+{
+	return get_interned(class)->hash;
+}
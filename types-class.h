@@ -0,0 +1,47 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_CLASS_H
+#define TYPES_CLASS_H
+
+#include <stddef.h>
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+/**
+ * Get the interned copy of a filter class
+ * 
+ * The same class is usually applied to every
+ * output, interning lets all of the filters
+ * share one copy of it, and lets classes be
+ * compared by their addresses
+ * 
+ * @param   class  The class
+ * @return         The interned copy of the class, it shall
+ *                 be released with `class_release`, and
+ *                 must not be modified; `NULL` on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+char *class_intern(const char *restrict class);
+
+/**
+ * Release a reference to an interned class
+ * 
+ * @param  class  The interned class, may be `NULL`
+ */
+void class_release(char *restrict class);
+
+/**
+ * Get the hash of an interned class
+ * 
+ * @param   class  The interned class
+ * @return         The hash of the class
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+size_t class_hash(const char *restrict class);
+
+#endif
@@ -1,7 +1,9 @@
 /* See LICENSE file for copyright and license details. */
 #include "types-filter.h"
-#include "util.h"
+#include "types-blob.h"
+#include "types-class.h"
 
+#include <sys/mman.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -15,8 +17,11 @@
 void
 filter_destroy(struct filter *restrict this)
 {
-	free(this->class);
-	free(this->ramps);
+	class_release(this->class);
+	if (this->ramps_mapped)
+		munmap(this->ramps, this->ramps_mapped);
+	else
+		blob_release(this->ramps);
 }
 
 
@@ -51,6 +56,10 @@ filter_marshal(const struct filter *restrict this, void *restrict buf, size_t ra
 	}
 	off += 1;
 
+	if (bs)
+		*(int *)&bs[off] = this->client;
+	off += sizeof(int);
+
 	if (bs)
 		*(int64_t *)&bs[off] = this->priority;
 	off += sizeof(int64_t);
@@ -96,6 +105,10 @@ filter_unmarshal(struct filter *restrict this, const void *restrict buf, size_t
 
 	this->class = NULL;
 	this->ramps = NULL;
+	this->ramps_mapped = 0;
+
+	this->client = *(const int *)&bs[off];
+	off += sizeof(int);
 
 	this->priority = *(const int64_t *)&bs[off];
 	off += sizeof(int64_t);
@@ -105,13 +118,13 @@ filter_unmarshal(struct filter *restrict this, const void *restrict buf, size_t
 
 	if (nonnulls & 1) {
 		n = strlen(&bs[off]) + 1;
-		if (!(this->class = memdup(&bs[off], n)))
+		if (!(this->class = class_intern(&bs[off])))
 			goto fail;
 		off += n;
 	}
 
 	if (nonnulls & 2) {
-		if (!(this->ramps = memdup(&bs[off], ramps_size)))
+		if (!(this->ramps = blob_intern(&bs[off], ramps_size)))
 			goto fail;
 		off += ramps_size;
 	}
@@ -119,7 +132,7 @@ filter_unmarshal(struct filter *restrict this, const void *restrict buf, size_t
 	return off;
 
 fail:
-	free(this->class);
-	free(this->ramps);
+	class_release(this->class);
+	blob_release(this->ramps);
 	return 0;
 }
@@ -59,16 +59,28 @@ struct filter {
 	int64_t priority;
 
 	/**
-	 * Identifier for the filter
+	 * Identifier for the filter, interned
+	 * with `class_intern`
 	 */
 	char *class;
 
 	/**
 	 * The gamma ramp adjustments for the filter.
 	 * This is raw binary data. `NULL` iff
-	 * `lifespan == LIFESPAN_REMOVE`.
+	 * `lifespan == LIFESPAN_REMOVE`. Unless
+	 * `.ramps_mapped` is set, this is a blob,
+	 * usually interned with `blob_intern`, and
+	 * it must not be modified unless it has been
+	 * made private with `blob_unshare`
 	 */
 	void *ramps;
+
+	/**
+	 * The size of the memory mapping `.ramps`
+	 * is the beginning of, 0 if `.ramps`
+	 * is a blob
+	 */
+	size_t ramps_mapped;
 };
 
 /**
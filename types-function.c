@@ -0,0 +1,178 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-function.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * The names of the functions,
+ * indexed by `enum function_type`
+ */
+static const char *const function_names[] = {
+#define X(C, N) N,
+	LIST_FUNCTIONS
+#undef X
+};
+
+
+/**
+ * Parse the parametric description of a filter
+ * 
+ * @param   this        Output parameter for the function
+ * @param   name        The name of the function
+ * @param   parameters  The space-separated parameters, either
+ *                      one for all channels or one for each
+ *                      of the red, green, and blue channels
+ * @return              Zero on success, -1 if the function is not
+ *                      recognised, -2 if the parameters are invalid
+ */
+int
+function_parse(struct function *restrict this, const char *restrict name, const char *restrict parameters)
+{
+	char *end;
+	size_t n;
+	int i;
+
+	for (i = 0; i < FUNCTION_COUNT; i++)
+		if (!strcmp(name, function_names[i]))
+			break;
+	if (i == FUNCTION_COUNT)
+		return -1;
+	this->type = (enum function_type)i;
+
+	for (n = 0;; n++) {
+		while (*parameters == ' ')
+			parameters++;
+		if (!*parameters)
+			break;
+		if (n == 3)
+			return -2;
+		this->parameters[n] = strtod(parameters, &end);
+		if (end == parameters || (*end && *end != ' ') || !isfinite(this->parameters[n]))
+			return -2;
+		if (this->type == FUNCTION_GAMMA && !(this->parameters[n] > 0))
+			return -2;
+		parameters = end;
+	}
+
+	if (n == 1)
+		this->parameters[1] = this->parameters[2] = this->parameters[0];
+	else if (n != 3)
+		return -2;
+
+	return 0;
+}
+
+
+/**
+ * Evaluate a function for one value
+ * 
+ * @param   type       The function
+ * @param   parameter  The parameter of the function
+ * @param   x          The input value, in [0, 1]
+ * @return             The output value, in [0, 1]
+ */
+static inline double
+evaluate(enum function_type type, double parameter, double x)
+{
+	double y;
+
+	switch (type) {
+	case FUNCTION_GAMMA:
+		y = pow(x, 1 / parameter);
+		break;
+	case FUNCTION_BRIGHTNESS:
+		y = x * parameter;
+		break;
+	case FUNCTION_CONTRAST:
+	default:
+		y = (x - 0.5) * parameter + 0.5;
+		break;
+	}
+
+	return y < 0 ? 0 : y > 1 ? 1 : y;
+}
+
+
+/**
+ * Evaluate a function into ramps with integral stops
+ * 
+ * @param  TYPE  The type of the stops
+ * @param  MAX   The maximum value of a stop
+ */
+#define EVALUATE_INTEGRAL(TYPE, MAX)\
+	do {\
+		TYPE *restrict out = ramps;\
+		double d;\
+		for (c = 0; c < 3; c++) {\
+			for (i = 0; i < sizes[c]; i++) {\
+				d = evaluate(this->type, this->parameters[c], (double)i * scales[c]);\
+				d = d * (double)(MAX) + 0.5;\
+				out[i] = d >= (double)(MAX) ? (TYPE)(MAX) : (TYPE)d;\
+			}\
+			out += sizes[c];\
+		}\
+	} while (0)
+
+
+/**
+ * Evaluate a function into ramps with floating-point stops
+ * 
+ * @param  TYPE  The type of the stops
+ */
+#define EVALUATE_FLOATING(TYPE)\
+	do {\
+		TYPE *restrict out = ramps;\
+		for (c = 0; c < 3; c++) {\
+			for (i = 0; i < sizes[c]; i++)\
+				out[i] = (TYPE)evaluate(this->type, this->parameters[c], (double)i * scales[c]);\
+			out += sizes[c];\
+		}\
+	} while (0)
+
+
+/**
+ * Evaluate a function into ramps for an output
+ * 
+ * @param  this    The function
+ * @param  output  The output, its gamma ramp layout is used
+ * @param  ramps   Output buffer for the ramps, `output->ramps_size`
+ *                 bytes, in the same format as filter ramps
+ */
+void
+function_evaluate(const struct function *restrict this, const struct output *restrict output, void *restrict ramps)
+{
+	size_t sizes[3] = {output->red_size, output->green_size, output->blue_size};
+	double scales[3];
+	size_t i;
+	int c;
+
+	for (c = 0; c < 3; c++)
+		scales[c] = sizes[c] > 1 ? 1 / (double)(sizes[c] - 1) : 0;
+
+	switch (output->depth) {
+	case 8:
+		EVALUATE_INTEGRAL(uint8_t, UINT8_MAX);
+		break;
+	case 16:
+		EVALUATE_INTEGRAL(uint16_t, UINT16_MAX);
+		break;
+	case 32:
+		EVALUATE_INTEGRAL(uint32_t, UINT32_MAX);
+		break;
+	case 64:
+		EVALUATE_INTEGRAL(uint64_t, UINT64_MAX);
+		break;
+	case -1:
+		EVALUATE_FLOATING(float);
+		break;
+	case -2:
+		EVALUATE_FLOATING(double);
+		break;
+	default:
+		abort();
+	}
+}
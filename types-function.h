@@ -0,0 +1,92 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_FUNCTION_H
+#define TYPES_FUNCTION_H
+
+#include "types-output.h"
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+/**
+ * Lists all functions a filter can be described by
+ * instead of ramps, will call macro X with the value
+ * of `enum function_type` for the function as the
+ * first argument and the function's name, as used
+ * in the protocol, as the second argument
+ * 
+ * For each channel, with the input value `x` and the
+ * channel's parameter `p`, the functions map:
+ * 
+ *   gamma:       x ↦ x^(1/p), `p` must be positive
+ *   brightness:  x ↦ x·p
+ *   contrast:    x ↦ (x − 1/2)·p + 1/2
+ * 
+ * and the result is clipped to [0, 1]
+ */
+#define LIST_FUNCTIONS\
+	X(FUNCTION_GAMMA,      "gamma")\
+	X(FUNCTION_BRIGHTNESS, "brightness")\
+	X(FUNCTION_CONTRAST,   "contrast")
+
+/**
+ * Functions a filter can be described by
+ */
+enum function_type {
+#define X(C, N) C,
+	LIST_FUNCTIONS
+#undef X
+
+	/**
+	 * The number of functions
+	 */
+	FUNCTION_COUNT
+};
+
+/**
+ * A parametric description of a filter
+ */
+struct function {
+	/**
+	 * The function
+	 */
+	enum function_type type;
+
+	/**
+	 * The parameter for the red,
+	 * green, and blue channel, in order
+	 */
+	double parameters[3];
+};
+
+
+/**
+ * Parse the parametric description of a filter
+ * 
+ * @param   this        Output parameter for the function
+ * @param   name        The name of the function
+ * @param   parameters  The space-separated parameters, either
+ *                      one for all channels or one for each
+ *                      of the red, green, and blue channels
+ * @return              Zero on success, -1 if the function is not
+ *                      recognised, -2 if the parameters are invalid
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int function_parse(struct function *restrict this, const char *restrict name, const char *restrict parameters);
+
+/**
+ * Evaluate a function into ramps for an output
+ * 
+ * @param  this    The function
+ * @param  output  The output, its gamma ramp layout is used
+ * @param  ramps   Output buffer for the ramps, `output->ramps_size`
+ *                 bytes, in the same format as filter ramps
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void function_evaluate(const struct function *restrict this, const struct output *restrict output, void *restrict ramps);
+
+#endif
@@ -1,5 +1,6 @@
 /* See LICENSE file for copyright and license details. */
 #include "types-message.h"
+#include "types-stats.h"
 #include "util.h"
 
 #include <sys/socket.h>
@@ -7,6 +8,22 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+
+/**
+ * The maximum number of file descriptors
+ * that are received in one system call
+ */
+#define RECEIVE_FDS_MAX 16
+
+/**
+ * The maximum number of unclaimed file descriptors
+ * that may be queued on a connection, at most one
+ * is sent with each message, so any more can only
+ * be sent by a misbehaving client
+ */
+#define QUEUED_FDS_MAX 4
 
 
 /**
@@ -21,12 +38,20 @@ message_initialise(struct message *restrict this)
 {
 	this->headers = NULL;
 	this->header_count = 0;
+	this->headers_alloc = 0;
 	this->payload = NULL;
 	this->payload_size = 0;
-	this->payload_ptr = 0;
+	this->payload_offset = 0;
 	this->buffer_size = 128;
 	this->buffer_ptr = 0;
+	this->message_start = 0;
+	this->parse_ptr = 0;
 	this->stage = 0;
+	this->framing = FRAMING_TEXT;
+	this->fds = NULL;
+	this->fds_at = NULL;
+	this->fds_count = 0;
+	this->fds_alloc = 0;
 	this->buffer = malloc(this->buffer_size);
 	if (!this->buffer)
 		return -1;
@@ -38,19 +63,17 @@ message_initialise(struct message *restrict this)
  * Release all resources in a message, should
  * be done even if initialisation fails
  * 
+ * Unclaimed file descriptors are not closed,
+ * so that they survive re-execution
+ * 
  * @param  this  The message
  */
 void
 message_destroy(struct message *restrict this)
 {
-	size_t i;
-
-	if (this->headers) {
-		for (i = 0; i < this->header_count; i++)
-			free(this->headers[i]);
-		free(this->headers);
-	}
-	free(this->payload);
+	free(this->fds);
+	free(this->fds_at);
+	free(this->headers);
 	free(this->buffer);
 }
 
@@ -73,7 +96,7 @@ message_destroy(struct message *restrict this)
 size_t
 message_marshal(const struct message *restrict this, void *restrict buf)
 {
-	size_t i, n, off = 0;
+	size_t off = 0, n;
 	char *bs = buf;
 
 	if (bs)
@@ -85,31 +108,52 @@ message_marshal(const struct message *restrict this, void *restrict buf)
 	off += sizeof(size_t);
 
 	if (bs)
-		*(size_t *)&bs[off] = this->payload_ptr;
+		*(size_t *)&bs[off] = this->payload_offset;
+	off += sizeof(size_t);
+
+	if (bs)
+		*(size_t *)&bs[off] = this->parse_ptr;
 	off += sizeof(size_t);
 
 	if (bs)
-		*(size_t *)&bs[off] = this->buffer_ptr;
+		*(size_t *)&bs[off] = this->buffer_ptr - this->message_start;
 	off += sizeof(size_t);
 
 	if (bs)
 		*(int *)&bs[off] = this->stage;
 	off += sizeof(int);
 
-	for (i = 0; i < this->header_count; i++) {
-		n = strlen(this->headers[i]) + 1;
-		if (bs)
-			memcpy(&bs[off], this->headers[i], n);
-		off += n;
-	}
+	if (bs)
+		*(int *)&bs[off] = this->framing;
+	off += sizeof(int);
 
 	if (bs)
-		memcpy(&bs[off], this->payload, this->payload_ptr);
-	off += this->payload_ptr;
+		memcpy(&bs[off], &this->frame, sizeof(this->frame));
+	off += sizeof(this->frame);
 
 	if (bs)
-		memcpy(&bs[off], this->buffer, this->buffer_ptr);
-	off += this->buffer_ptr;
+		*(size_t *)&bs[off] = this->fds_count;
+	off += sizeof(size_t);
+
+	n = this->fds_count * sizeof(*this->fds);
+	if (bs && n)
+		memcpy(&bs[off], this->fds, n);
+	off += n;
+
+	n = this->fds_count * sizeof(*this->fds_at);
+	if (bs && n)
+		memcpy(&bs[off], this->fds_at, n);
+	off += n;
+
+	n = this->header_count * sizeof(*this->headers);
+	if (bs && n)
+		memcpy(&bs[off], this->headers, n);
+	off += n;
+
+	n = this->buffer_ptr - this->message_start;
+	if (bs && n)
+		memcpy(&bs[off], &this->buffer[this->message_start], n);
+	off += n;
 
 	return off;
 }
@@ -125,18 +169,19 @@ message_marshal(const struct message *restrict this, void *restrict buf)
 size_t
 message_unmarshal(struct message *restrict this, const void *restrict buf)
 {
-	size_t i, n, off = 0, header_count;
+	size_t off = 0, n, fds_off, fds_at_off, fds_count;
 	const char *bs = buf;
 
-	this->header_count = 0;
-
-	header_count = *(const size_t *)&bs[off];
+	this->header_count = this->headers_alloc = *(const size_t *)&bs[off];
 	off += sizeof(size_t);
 
 	this->payload_size = *(const size_t *)&bs[off];
 	off += sizeof(size_t);
 
-	this->payload_ptr = *(const size_t *)&bs[off];
+	this->payload_offset = *(const size_t *)&bs[off];
+	off += sizeof(size_t);
+
+	this->parse_ptr = *(const size_t *)&bs[off];
 	off += sizeof(size_t);
 
 	this->buffer_size = this->buffer_ptr = *(const size_t *)&bs[off];
@@ -145,12 +190,30 @@ message_unmarshal(struct message *restrict this, const void *restrict buf)
 	this->stage = *(const int *)&bs[off];
 	off += sizeof(int);
 
+	this->framing = *(const int *)&bs[off];
+	off += sizeof(int);
+
+	memcpy(&this->frame, &bs[off], sizeof(this->frame));
+	off += sizeof(this->frame);
+
+	fds_count = *(const size_t *)&bs[off];
+	off += sizeof(size_t);
+	fds_off = off;
+	off += fds_count * sizeof(*this->fds);
+	fds_at_off = off;
+	off += fds_count * sizeof(*this->fds_at);
+
+	this->message_start = 0;
+
 	/* Make sure that the pointers are NULL so that they are
 	   not freed without being allocated when the message is
 	   destroyed if this function fails. */
 	this->headers = NULL;
 	this->payload = NULL;
 	this->buffer  = NULL;
+	this->fds     = NULL;
+	this->fds_at  = NULL;
+	this->fds_count = this->fds_alloc = 0;
 
 	/* To 2-power-multiple of 128 bytes. */
 	this->buffer_size >>= 7;
@@ -170,36 +233,38 @@ message_unmarshal(struct message *restrict this, const void *restrict buf)
 	}
 	this->buffer_size <<= 7;
 
-	/* Allocate header list, payload and read buffer. */
-
-	if (header_count > 0)
-		if (!(this->headers = malloc(header_count * sizeof(char*))))
-			goto fail;
+	/* Allocate header list and read buffer. */
 
-	if (this->payload_size > 0)
-		if (!(this->payload = malloc(this->payload_size)))
+	if (this->header_count > 0)
+		if (!(this->headers = malloc(this->header_count * sizeof(*this->headers))))
 			goto fail;
 
 	if (!(this->buffer = malloc(this->buffer_size)))
 		goto fail;
 
-	/* Fill the header list, payload and read buffer. */
-
-	for (i = 0; i < header_count; i++) {
-		n = strlen(&bs[off]) + 1;
-		this->headers[i] = memdup(&bs[off], n);
-		if (!this->headers[i])
+	if (fds_count > 0) {
+		if (!(this->fds = malloc(fds_count * sizeof(*this->fds))))
+			goto fail;
+		if (!(this->fds_at = malloc(fds_count * sizeof(*this->fds_at))))
 			goto fail;
-		off += n;
-		this->header_count++;
+		memcpy(this->fds, &bs[fds_off], fds_count * sizeof(*this->fds));
+		memcpy(this->fds_at, &bs[fds_at_off], fds_count * sizeof(*this->fds_at));
+		this->fds_count = this->fds_alloc = fds_count;
 	}
 
-	memcpy(this->payload, &bs[off], this->payload_ptr);
-	off += this->payload_ptr;
+	/* Fill the header list and read buffer. */
+
+	n = this->header_count * sizeof(*this->headers);
+	if (n)
+		memcpy(this->headers, &bs[off], n);
+	off += n;
 
 	memcpy(this->buffer, &bs[off], this->buffer_ptr);
 	off += this->buffer_ptr;
 
+	if (this->stage == 2 && this->payload_size > 0)
+		this->payload = &this->buffer[this->payload_offset];
+
 	return off;
 
 fail:
@@ -224,10 +289,12 @@ GCC_ONLY(__attribute__((__nonnull__)))
 static int
 extend_headers(struct message *restrict this, size_t extent)
 {
-	char **new = realloc(this->headers, (this->header_count + extent) * sizeof(char *));
+	struct message_header *new;
+	new = realloc(this->headers, (this->headers_alloc + extent) * sizeof(*this->headers));
 	if (!new)
 		return -1;
 	this->headers = new;
+	this->headers_alloc += extent;
 	return 0;
 }
 
@@ -252,27 +319,31 @@ extend_buffer(struct message *restrict this)
 
 
 /**
- * Reset the header list and the payload
+ * Skip past the last read message and reset the
+ * header list and the payload
  * 
  * @param  this  The message
  */
 GCC_ONLY(__attribute__((__nonnull__)))
 static void
-reset_message(struct message *restrict this)
+next_message(struct message *restrict this)
 {
-	size_t i;
-	if (this->headers) {
-		for (i = 0; i < this->header_count; i++)
-			free(this->headers[i]);
-		free(this->headers);
-		this->headers = NULL;
-	}
+	size_t i, length = this->payload_offset + this->payload_size;
+
+	message_discard_fds(this);
+	for (i = 0; i < this->fds_count; i++)
+		this->fds_at[i] -= length;
+
+	this->message_start += length;
+	if (this->message_start == this->buffer_ptr)
+		this->message_start = this->buffer_ptr = 0;
+	this->parse_ptr = 0;
+
 	this->header_count = 0;
 
-	free(this->payload);
 	this->payload = NULL;
 	this->payload_size = 0;
-	this->payload_ptr = 0;
+	this->payload_offset = 0;
 }
 
 
@@ -286,13 +357,14 @@ GCC_ONLY(__attribute__((__pure__, __nonnull__)))
 static int
 get_payload_length(struct message *restrict this)
 {
-	char *header;
+	const char *header;
 	size_t i;
 
 	for (i = 0; i < this->header_count; i++) {
-		if (strstr(this->headers[i], "Length: ") == this->headers[i]) {
+		if (this->headers[i].name_length == sizeof("Length") - 1 &&
+		    !memcmp(message_get_header(this, i), "Length", sizeof("Length") - 1)) {
 			/* Store the message length. */
-			header = this->headers[i] + strlen("Length: ");
+			header = message_get_header(this, i) + sizeof("Length: ") - 1;
 			this->payload_size = (size_t)atol(header);
 
 			/* Do not except a length that is not correctly formated. */
@@ -312,15 +384,16 @@ get_payload_length(struct message *restrict this)
 /**
  * Verify that a header is correctly formatted
  * 
- * @param   header  The header, must be NUL-terminated
- * @param   length  The length of the header
- * @return          Zero if valid, negative if invalid (malformated message: unrecoverable state)
+ * @param   header       The header, must be NUL-terminated
+ * @param   length       The length of the header
+ * @param   name_length  Output parameter for the length of the header's name
+ * @return               Zero if valid, negative if invalid (malformated message: unrecoverable state)
  */
-GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+GCC_ONLY(__attribute__((__nonnull__)))
 static int
-validate_header(const char *restrict header, size_t length)
+validate_header(const char *restrict header, size_t length, size_t *restrict name_length)
 {
-	char *restrict p = memchr(header, ':', length * sizeof(char));
+	const char *restrict p = memchr(header, ':', length * sizeof(char));
 
 	if (verify_utf8(header) < 0) {
 		/* Either the string is not UTF-8, or your are under an UTF-8 attack,
@@ -332,30 +405,13 @@ validate_header(const char *restrict header, size_t length)
 	    p[1] != ' ') /* Also an invalid format. ' ' is mandated after the ':'. */
 		return -2;
 
+	*name_length = (size_t)(p - header);
 	return 0;
 }
 
 
 /**
- * Remove the beginning of the read buffer
- * 
- * @param  this        The message
- * @param  length      The number of characters to remove  
- * @param  update_ptr  Whether to update the buffer pointer
- */
-GCC_ONLY(__attribute__((__nonnull__)))
-static void
-unbuffer_beginning(struct message *restrict this, size_t length, int update_ptr)
-{
-	memmove(this->buffer, &this->buffer[length], (this->buffer_ptr - length) * sizeof(char));
-	if (update_ptr)
-		this->buffer_ptr -= length;
-}
-
-
-/**
- * Remove the header–payload delimiter from the buffer,
- * get the payload's size and allocate the payload
+ * Skip the header–payload delimiter and get the payload's size
  * 
  * @param   this  The message
  * @return        The return value follows the rules of `message_read`
@@ -364,60 +420,124 @@ GCC_ONLY(__attribute__((__nonnull__)))
 static int
 initialise_payload(struct message *restrict this)
 {
-	/* Remove the \n (end of empty line) we found from the buffer. */
-	unbuffer_beginning(this, 1, 1);
+	/* Skip the \n (end of empty line) we found. */
+	this->parse_ptr += 1;
+	this->payload_offset = this->parse_ptr;
 
 	/* Get the length of the payload. */
 	if (get_payload_length(this) < 0)
 		return -2; /* Malformated value, enters unrecoverable state. */
 
-	/* Allocate the payload buffer. */
-	if (this->payload_size > 0) {
-		this->payload = malloc(this->payload_size);
-		if (!this->payload)
-			return -1;
-	}
-
 	return 0;
 }
 
 
 /**
- * Create a header from the buffer and store it
+ * Store a header that is in the buffer
  * 
  * @param   this    The message
- * @param   length  The length of the header, including LF-termination
+ * @param   length  The length of the header, excluding LF-termination
  * @return          The return value follows the rules of `message_read`
  */
 GCC_ONLY(__attribute__((__nonnull__)))
 static int
 store_header(struct message *restrict this, size_t length)
 {
-	char *restrict header;
-  
-	/* Allocate the header. */
-	header = malloc(length); /* Last char is a LF, which is substituted with NUL. */
-	if (!header)
-		return -1;
-	/* Copy the header data into the allocated header, */
-	memcpy(header, this->buffer, length * sizeof(char));
-	/* and NUL-terminate it. */
-	header[length - 1] = '\0';
-  
-	/* Remove the header data from the read buffer. */
-	unbuffer_beginning(this, length, 1);
-  
+	struct message_header *restrict header;
+	char *restrict data = &this->buffer[this->message_start + this->parse_ptr];
+	int r;
+
+	/* Prepare the header list for eight more headers so that
+	   it does not need to be reallocated again and again. */
+	if (this->header_count == this->headers_alloc)
+		if ((r = extend_headers(this, 8)) < 0)
+			return r;
+
+	/* The header is kept in the read buffer, substitute
+	   the LF-termination with NUL-termination. */
+	data[length] = '\0';
+
+	header = &this->headers[this->header_count];
+	header->offset = this->parse_ptr;
+	header->length = length;
+
 	/* Make sure the the header syntax is correct so that
 	   the program does not need to care about it. */
-	if (validate_header(header, length)) {
-		free(header);
+	if (validate_header(data, length, &header->name_length))
 		return -2;
-	}
-  
+
 	/* Store the header in the header list. */
-	this->headers[this->header_count++] = header;
+	this->header_count++;
+	this->parse_ptr += length + 1;
+
+	return 0;
+}
+
+
+/**
+ * Close file descriptors that have been received
+ * 
+ * @param  cmsg  The control message with the file descriptors
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static void
+close_fds(struct cmsghdr *restrict cmsg)
+{
+	size_t i, n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	const unsigned char *restrict data = CMSG_DATA(cmsg);
+	int fd, saved_errno = errno;
+
+	for (i = 0; i < n; i++) {
+		memcpy(&fd, &data[i * sizeof(int)], sizeof(int));
+		close(fd);
+	}
+	errno = saved_errno;
+}
+
+
+/**
+ * Store file descriptors that have been received,
+ * they are closed on failure
+ * 
+ * @param   this  The message
+ * @param   cmsg  The control message with the file descriptors
+ * @param   at    The offset, from `this->message_start`, of
+ *                the last byte received with the file descriptors
+ * @return        The return value follows the rules of `message_read`
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static int
+store_fds(struct message *restrict this, struct cmsghdr *restrict cmsg, size_t at)
+{
+	size_t i, n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	const unsigned char *restrict data = CMSG_DATA(cmsg);
+	void *new;
 
+	if (this->fds_count + n > QUEUED_FDS_MAX) {
+		close_fds(cmsg);
+		return -2;
+	}
+
+	if (this->fds_count + n > this->fds_alloc) {
+		new = realloc(this->fds, (this->fds_count + n) * sizeof(*this->fds));
+		if (!new)
+			goto fail;
+		this->fds = new;
+		new = realloc(this->fds_at, (this->fds_count + n) * sizeof(*this->fds_at));
+		if (!new)
+			goto fail;
+		this->fds_at = new;
+		this->fds_alloc = this->fds_count + n;
+	}
+
+	memcpy(&this->fds[this->fds_count], data, n * sizeof(int));
+	for (i = 0; i < n; i++)
+		this->fds_at[this->fds_count++] = at;
 	return 0;
+
+fail:
+	close_fds(cmsg);
+	return -1;
 }
 
 
@@ -432,27 +552,69 @@ GCC_ONLY(__attribute__((__nonnull__)))
 static int
 continue_read(struct message *restrict this, int fd)
 {
-	size_t n;
+	union {
+		struct cmsghdr cmsg;
+		char buf[CMSG_SPACE(RECEIVE_FDS_MAX * sizeof(int))];
+	} control;
+	struct msghdr hdr;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	size_t need;
 	ssize_t got;
-	int r;
+	int r = 0;
+
+	/* Discard all messages that have already been read, this is
+	   the only time the read buffer is compacted, so all messages
+	   that are received at the same time can be read without
+	   any copying. */
+	if (this->message_start) {
+		memmove(this->buffer, &this->buffer[this->message_start],
+		        (this->buffer_ptr - this->message_start) * sizeof(char));
+		this->buffer_ptr -= this->message_start;
+		this->message_start = 0;
+	}
 
-	/* Figure out how much space we have left in the read buffer. */
-	n = this->buffer_size - this->buffer_ptr;
+	/* Figure out how much space we need in the read buffer: the
+	   rest of the message if the length is known, otherwise
+	   just some more space. */
+	if (this->stage == 1)
+		need = this->payload_offset + this->payload_size;
+	else
+		need = this->buffer_ptr + 128;
 
-	/* If we do not have too much left, */
-	if (n < 128) {
-		/* grow the buffer, */
+	/* Grow the buffer if we do not have enough space left. */
+	while (this->buffer_size < need)
 		if ((r = extend_buffer(this)) < 0)
 			return r;
 
-		/* and recalculate how much space we have left. */
-		n = this->buffer_size - this->buffer_ptr;
-	}
-
-	/* Then read from the socket. */
+	/* Then read from the socket, file descriptors sent by the
+	   client are queued until a message claims them. The kernel
+	   ends the read with the data the file descriptors were
+	   sent with, so they belong to the message that contains
+	   the last byte that is read. */
+	iov.iov_base = this->buffer + this->buffer_ptr;
+	iov.iov_len = this->buffer_size - this->buffer_ptr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control.buf;
+	hdr.msg_controllen = sizeof(control.buf);
 	errno = 0;
-	got = recv(fd, this->buffer + this->buffer_ptr, n, 0);
+	got = recvmsg(fd, &hdr, 0);
 	this->buffer_ptr += (size_t)(got < 0 ? 0 : got);
+	stats.counters[COUNTER_BYTES_RECEIVED] += (uint64_t)(got < 0 ? 0 : got);
+	if (got > 0) {
+		for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			if (r < 0)
+				close_fds(cmsg);
+			else
+				r = store_fds(this, cmsg, this->buffer_ptr - 1 - this->message_start);
+		}
+		if (r < 0)
+			return r;
+	}
 	if (errno)
 		return -1;
 	if (got == 0) {
@@ -482,71 +644,64 @@ GCC_ONLY(__attribute__((__nonnull__)))
 int
 message_read(struct message *restrict this, int fd)
 {
-	size_t header_commit_buffer = 0;
-	size_t length, need, move;
+	size_t available;
 	int r;
-	char *p;
+	char *msg, *p;
 
 	/* If we are at stage 2, we are done and it is time to start over.
 	   This is important because the function could have been interrupted. */
 	if (this->stage == 2) {
-		reset_message(this);
+		next_message(this);
 		this->stage = 0;
 	}
 
 	/* Read from file descriptor until we have a full message. */
-	for (;;) {      
-		/* Stage 0: headers. */
-		/* Read all headers that we have stored into the read buffer. */
-		while (this->stage == 0 &&
-		       ((p = memchr(this->buffer, '\n', this->buffer_ptr * sizeof(char))))) {
-			length = (size_t)(p - this->buffer);
-			if (length) {
-				/* We have found a header. */
-
-				/* On every eighth header found with this function call,
-				   we prepare the header list for eight more headers so
-				   that it does not need to be reallocated again and again. */
-				if (!header_commit_buffer)
-					if ((r = extend_headers(this, header_commit_buffer = 8)) < 0)
+	for (;;) {
+		msg = &this->buffer[this->message_start];
+		available = this->buffer_ptr - this->message_start;
+
+		/* Stage 0, with binary framing: the fixed-size part. */
+		if (this->framing == FRAMING_BINARY) {
+			if (this->stage == 0 && available >= sizeof(this->frame)) {
+				/* The class and the payload are both read as the payload. */
+				memcpy(&this->frame, msg, sizeof(this->frame));
+				this->parse_ptr = this->payload_offset = sizeof(this->frame);
+				this->payload_size = (size_t)this->frame.class_length + (size_t)this->frame.payload_length;
+				this->stage = 1;
+			}
+		} else {
+			/* Stage 0: headers. */
+			/* Read all headers that we have stored into the read buffer. */
+			while (this->stage == 0 &&
+			       ((p = memchr(&msg[this->parse_ptr], '\n', (available - this->parse_ptr) * sizeof(char))))) {
+				if (p != &msg[this->parse_ptr]) {
+					/* We have found a header. */
+					if ((r = store_header(this, (size_t)(p - &msg[this->parse_ptr]))) < 0)
 						return r;
+				} else {
+					/* We have found an empty line, i.e. the end of the headers. */
 
-				/* Create and store header. */
-				if ((r = store_header(this, length + 1)) < 0)
-					return r;
-				header_commit_buffer -= 1;
-			} else {
-				/* We have found an empty line, i.e. the end of the headers. */
-
-				/* Remove the header–payload delimiter from the buffer,
-				   get the payload's size and allocate the payload. */
-				if ((r = initialise_payload(this)) < 0)
-					return r;
+					/* Skip the header–payload delimiter and get the payload's size. */
+					if ((r = initialise_payload(this)) < 0)
+						return r;
 
-				/* Mark end of stage, next stage is getting the payload. */
-				this->stage = 1;
+					/* Mark end of stage, next stage is getting the payload. */
+					this->stage = 1;
+				}
 			}
 		}
 
 
 		/* Stage 1: payload. */
-		if ((this->stage == 1) && (this->payload_size > 0)) {
-			/* How much of the payload that has not yet been filled. */
-			need = this->payload_size - this->payload_ptr;
-			/* How much we have of that what is needed. */
-			move = this->buffer_ptr < need ? this->buffer_ptr : need;
-
-			/* Copy what we have, and remove it from the the read buffer. */
-			memcpy(&this->payload[this->payload_ptr], this->buffer, move * sizeof(char));
-			unbuffer_beginning(this, move, 1);
-
-			/* Keep track of how much we have read. */
-			this->payload_ptr += move;
-		}
-		if (this->stage == 1 && this->payload_ptr == this->payload_size) {
-			/* If we have filled the payload (or there was no payload),
+		if (this->stage == 1 && available - this->payload_offset >= this->payload_size) {
+			/* If we have the entire payload (or there was no payload),
 			   mark the end of this stage, i.e. that the message is
-			   complete, and return with success. */
+			   complete, and return with success. At most one file
+			   descriptor may be sent with each message. */
+			if (this->fds_count > 1 && this->fds_at[1] < this->payload_offset + this->payload_size)
+				return -2;
+			if (this->payload_size > 0)
+				this->payload = &msg[this->payload_offset];
 			this->stage = 2;
 			return 0;
 		}
@@ -559,3 +714,63 @@ message_read(struct message *restrict this, int fd)
 			return r;
 	}
 }
+
+
+/**
+ * Claim the file descriptor that was received with
+ * a message that has been read, if it has not
+ * already been claimed
+ * 
+ * @param   this  The message
+ * @return        The file descriptor, the caller takes
+ *                over the ownership of it, -1 if there
+ *                is no unclaimed file descriptor
+ */
+int
+message_take_fd(struct message *restrict this)
+{
+	int fd;
+
+	if (this->stage != 2 || !this->fds_count || this->fds_at[0] >= this->payload_offset + this->payload_size)
+		return -1;
+
+	fd = this->fds[0];
+	this->fds_count -= 1;
+	memmove(this->fds, &this->fds[1], this->fds_count * sizeof(*this->fds));
+	memmove(this->fds_at, &this->fds_at[1], this->fds_count * sizeof(*this->fds_at));
+	return fd;
+}
+
+
+/**
+ * Close the file descriptor that was received with
+ * a message that has been read, unless it has been
+ * claimed with `message_take_fd`
+ * 
+ * This should be done once the message has been
+ * dispatched, it is otherwise done when the next
+ * message is read
+ * 
+ * @param  this  The message
+ */
+void
+message_discard_fds(struct message *restrict this)
+{
+	int fd;
+	while ((fd = message_take_fd(this)) >= 0)
+		close(fd);
+}
+
+
+/**
+ * Close all file descriptors that have been received
+ * on a connection, but that have not been claimed
+ * 
+ * @param  this  The message
+ */
+void
+message_close_fds(struct message *restrict this)
+{
+	while (this->fds_count)
+		close(this->fds[--this->fds_count]);
+}
@@ -3,6 +3,7 @@
 #define TYPES_MESSAGE_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <limits.h>
 
 #ifndef GCC_ONLY
@@ -13,19 +14,151 @@
 # endif
 #endif
 
+/**
+ * A header in a message, stored in place
+ * in the message's read buffer
+ */
+struct message_header {
+	/**
+	 * The offset of the header from the beginning of
+	 * the message in the read buffer. The header consists
+	 * of both the header name and its associated value,
+	 * joined by ": ", and is NUL-terminated.
+	 */
+	size_t offset;
+
+	/**
+	 * The length of the header, excluding the NUL-termination
+	 */
+	size_t length;
+
+	/**
+	 * The length of the header's name
+	 */
+	size_t name_length;
+};
+
+/**
+ * How messages on a connection are framed
+ */
+enum framing {
+	/**
+	 * Messages consist of text headers, an empty
+	 * line, and a payload whose size is given by
+	 * the ‘Length’ header
+	 */
+	FRAMING_TEXT = 0,
+
+	/**
+	 * Messages consist of a `struct binary_frame`
+	 * followed by the NUL-terminated class and
+	 * the payload; replies consist of a
+	 * `struct binary_reply` followed by its payload
+	 */
+	FRAMING_BINARY = 1
+};
+
+/**
+ * Commands that can be sent with binary framing
+ */
+enum binary_command {
+	/**
+	 * Switch back to text framing, the reply
+	 * is sent with binary framing
+	 */
+	BINARY_COMMAND_TEXT_FRAMING = 0,
+
+	/**
+	 * Equivalent to ‘Command: set-gamma’
+	 */
+	BINARY_COMMAND_SET_GAMMA = 1,
+
+	/**
+	 * Equivalent to ‘Command: set-gamma’ with
+	 * ‘Transport: memfd’, the payload only
+	 * contains the class
+	 */
+	BINARY_COMMAND_SET_GAMMA_MEMFD = 2
+};
+
+/**
+ * The fixed-size beginning of a message sent with binary framing,
+ * all fields are in the host's byte order
+ */
+struct binary_frame {
+	/**
+	 * Equivalent to the ‘Message ID’ header
+	 */
+	uint32_t message_id;
+
+	/**
+	 * The command, a `enum binary_command`
+	 */
+	uint8_t command;
+
+	/**
+	 * The lifespan of the filter, a `enum lifespan`
+	 */
+	uint8_t lifespan;
+
+	/**
+	 * The size of the class, including its NUL-termination
+	 */
+	uint16_t class_length;
+
+	/**
+	 * The CRTC, as its index in the response
+	 * to ‘Command: enumerate-crtcs’
+	 */
+	uint32_t crtc;
+
+	/**
+	 * The size of the payload following the class,
+	 * 0 if the ramps are sent in a memfd
+	 */
+	uint32_t payload_length;
+
+	/**
+	 * The priority of the filter
+	 */
+	int64_t priority;
+};
+
+/**
+ * The fixed-size beginning of a reply sent with binary framing,
+ * all fields are in the host's byte order
+ */
+struct binary_reply {
+	/**
+	 * The message ID of the message
+	 * the reply is in response to
+	 */
+	uint32_t in_response_to;
+
+	/**
+	 * 0 on success, the error number on failure,
+	 * and -1 on a failure that is described by
+	 * the payload
+	 */
+	int32_t error;
+
+	/**
+	 * The size of the payload
+	 */
+	uint32_t payload_length;
+};
+
 /**
  * Message passed between a server and a client
  */
 struct message {
 	/**
-	 * The headers in the message, each element in this list
-	 * as an unparsed header, it consists of both the header
-	 * name and its associated value, joined by ": ". A header
-	 * cannot be `NULL` (unless its memory allocation failed,)
-	 * but `headers` itself is `NULL` if there are no headers.
-	 * The "Length" header should be included in this list.
+	 * The headers in the message. The "Length" header
+	 * should be included in this list. The headers
+	 * themselves are stored in `.buffer`, use
+	 * `message_get_header` to get a header.
 	 */
-	char **restrict headers;
+	struct message_header *restrict headers;
 
 	/**
 	 * The number of headers in the message
@@ -33,7 +166,14 @@ struct message {
 	size_t header_count;
 
 	/**
-	 * The payload of the message, `NULL` if none (of zero-length)
+	 * The number of elements allocated for `.headers`
+	 */
+	size_t headers_alloc;
+
+	/**
+	 * The payload of the message, `NULL` if none (of zero-length),
+	 * this points into `.buffer` and is only set when the message
+	 * has been read in full
 	 */
 	char *restrict payload;
 
@@ -43,9 +183,10 @@ struct message {
 	size_t payload_size;
 
 	/**
-	 * How much of the payload that has been stored (internal data)
+	 * The offset of the payload from the beginning
+	 * of the message in `.buffer` (internal data)
 	 */
-	size_t payload_ptr;
+	size_t payload_offset;
 
 	/**
 	 * Internal buffer for the reading function (internal data)
@@ -62,14 +203,63 @@ struct message {
 	 */
 	size_t buffer_ptr;
 
+	/**
+	 * The offset in `buffer` of the beginning of the
+	 * message, everything before it has already been
+	 * read, and is discarded before more data is
+	 * received (internal data)
+	 */
+	size_t message_start;
+
+	/**
+	 * How much of the message, from `.message_start`,
+	 * that has been parsed (internal data)
+	 */
+	size_t parse_ptr;
+
+	/**
+	 * File descriptors that have been received with
+	 * the message and any following message, in the
+	 * order they were received, but that have not
+	 * yet been claimed with `message_take_fd`
+	 */
+	int *restrict fds;
+
+	/**
+	 * For each element in `.fds`, the offset, from
+	 * `.message_start`, of the last byte that was
+	 * received with it; a file descriptor belongs
+	 * to the message that contains that byte
+	 */
+	size_t *restrict fds_at;
+
+	/**
+	 * The number of elements in `.fds`
+	 */
+	size_t fds_count;
+
+	/**
+	 * The number of elements allocated for `.fds`
+	 */
+	size_t fds_alloc;
+
+	/**
+	 * The fixed-size part of the message, only
+	 * set when `.framing` is `FRAMING_BINARY`,
+	 * the payload then begins with the class
+	 */
+	struct binary_frame frame;
+
 	/**
 	 * 0 while reading headers, 1 while reading payload, and 2 when done (internal data)
 	 */
 	int stage;
 
-#if INT_MAX != LONG_MAX
-	int padding__;
-#endif
+	/**
+	 * How messages on the connection are framed,
+	 * a `enum framing`
+	 */
+	int framing;
 };
 
 /**
@@ -86,6 +276,9 @@ int message_initialise(struct message *restrict this);
  * Release all resources in a message, should
  * be done even if initialisation fails
  * 
+ * Unclaimed file descriptors are not closed,
+ * so that they survive re-execution
+ * 
  * @param  this  The message
  */
 GCC_ONLY(__attribute__((__nonnull__)))
@@ -130,4 +323,54 @@ size_t message_unmarshal(struct message *restrict this, const void *restrict buf
 GCC_ONLY(__attribute__((__nonnull__)))
 int message_read(struct message *restrict this, int fd);
 
+/**
+ * Claim the file descriptor that was received with
+ * a message that has been read, if it has not
+ * already been claimed
+ * 
+ * @param   this  The message
+ * @return        The file descriptor, the caller takes
+ *                over the ownership of it, -1 if there
+ *                is no unclaimed file descriptor
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int message_take_fd(struct message *restrict this);
+
+/**
+ * Close the file descriptor that was received with
+ * a message that has been read, unless it has been
+ * claimed with `message_take_fd`
+ * 
+ * This should be done once the message has been
+ * dispatched, it is otherwise done when the next
+ * message is read
+ * 
+ * @param  this  The message
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void message_discard_fds(struct message *restrict this);
+
+/**
+ * Close all file descriptors that have been received
+ * on a connection, but that have not been claimed
+ * 
+ * @param  this  The message
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void message_close_fds(struct message *restrict this);
+
+/**
+ * Get a header from a message that has been read
+ * 
+ * @param   this  The message
+ * @param   i     The index of the header
+ * @return        The header, NUL-terminated
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+static inline const char *
+message_get_header(const struct message *restrict this, size_t i)
+{
+	return &this->buffer[this->message_start + this->headers[i].offset];
+}
+
 #endif
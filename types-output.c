@@ -1,11 +1,20 @@
 /* See LICENSE file for copyright and license details. */
 #include "types-output.h"
+#include "types-class.h"
 #include "util.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 
+/**
+ * The size of a cache line, the alignment
+ * of the elements of result tables
+ */
+#define CACHE_LINE_SIZE 64
+
+
 /**
  * Free all resources allocated to an output.
  * The allocation of `output` itself is not freed,
@@ -22,38 +31,26 @@ output_destroy(struct output *restrict this)
 		switch (this->depth) {
 		case 8:
 			libgamma_gamma_ramps8_destroy(&this->saved_ramps.u8);
-			for (i = 0; i < this->table_size; i++)
-				libgamma_gamma_ramps8_destroy(&this->table_sums[i].u8);
 			break;
 
 		case 16:
 			libgamma_gamma_ramps16_destroy(&this->saved_ramps.u16);
-			for (i = 0; i < this->table_size; i++)
-				libgamma_gamma_ramps16_destroy(&this->table_sums[i].u16);
 			break;
 
 		case 32:
 			libgamma_gamma_ramps32_destroy(&this->saved_ramps.u32);
-			for (i = 0; i < this->table_size; i++)
-				libgamma_gamma_ramps32_destroy(&this->table_sums[i].u32);
 			break;
 
 		case 64:
 			libgamma_gamma_ramps64_destroy(&this->saved_ramps.u64);
-			for (i = 0; i < this->table_size; i++)
-				libgamma_gamma_ramps64_destroy(&this->table_sums[i].u64);
 			break;
 
 		case -1:
 			libgamma_gamma_rampsf_destroy(&this->saved_ramps.f);
-			for (i = 0; i < this->table_size; i++)
-				libgamma_gamma_rampsf_destroy(&this->table_sums[i].f);
 			break;
 
 		case -2:
 			libgamma_gamma_rampsd_destroy(&this->saved_ramps.d);
-			for (i = 0; i < this->table_size; i++)
-				libgamma_gamma_rampsd_destroy(&this->table_sums[i].d);
 			break;
 
 		default:
@@ -61,11 +58,20 @@ output_destroy(struct output *restrict this)
 		}
 	}
 
+	for (i = 1; i < this->tree_leaves; i++)
+		libgamma_gamma_ramps8_destroy(&this->table_tree[i].u8);
+
 	for (i = 0; i < this->table_size; i++)
 		filter_destroy(&this->table_filters[i]);
 
 	free(this->table_filters);
 	free(this->table_sums);
+	free(this->table_sums_slab);
+	free(this->table_tree);
+	free(this->class_index);
+	for (i = 0; i < WINDOW_CACHE_SIZE; i++)
+		free(this->windows[i].ramps);
+	release_plain_ramps(this->plain);
 	free(this->name);
 }
 
@@ -166,10 +172,10 @@ output_marshal(const struct output *restrict this, void *restrict buf)
 		*(size_t *)&bs[off] = this->table_size;
 	off += sizeof(size_t);
 
-	for (i = 0; i < this->table_size; i++) {
-		off +=      filter_marshal(this->table_filters + i, bs ? &bs[off] : NULL, this->ramps_size);
-		off += gamma_ramps_marshal(this->table_sums    + i, bs ? &bs[off] : NULL, this->ramps_size);
-	}
+	/* The result table is not marshalled, it is
+	 * recomposed from the filters after unmarshalling */
+	for (i = 0; i < this->table_size; i++)
+		off += filter_marshal(this->table_filters + i, bs ? &bs[off] : NULL, this->ramps_size);
 
 	return off;
 }
@@ -190,6 +196,20 @@ output_unmarshal(struct output *restrict this, const void *restrict buf)
 
 	this->crtc = NULL;
 	this->name = NULL;
+	this->table_sums = NULL;
+	this->table_sums_slab = NULL;
+	this->table_sums_valid = 0;
+	this->table_tree = NULL;
+	this->tree_leaves = 0;
+	this->class_index = NULL;
+	this->class_index_size = 0;
+	this->first_updated = 0;
+	this->last_updated = 0;
+	this->flush_pending = 1;
+	this->generation = 0;
+	this->window_clock = 0;
+	memset(this->windows, 0, sizeof(this->windows));
+	this->plain = NULL;
 
 	this->depth = *(const signed *)&bs[off];
 	off += sizeof(signed);
@@ -250,27 +270,31 @@ output_unmarshal(struct output *restrict this, const void *restrict buf)
 	if (n == 0)
 		return 0;
 
-	this->table_size = this->table_alloc = *(const size_t*)&bs[off];
+	n = *(const size_t*)&bs[off];
 	off += sizeof(size_t);
-	if (this->table_size > 0) {
-		this->table_filters = calloc(this->table_size, sizeof(*this->table_filters));
+	if (n > 0) {
+		this->table_filters = calloc(n, sizeof(*this->table_filters));
 		if (!this->table_filters)
 			return 0;
-		this->table_sums = calloc(this->table_size, sizeof(*this->table_sums));
-		if (!this->table_sums)
+		if (output_grow_sums(this, n) < 0)
 			return 0;
 	}
+	this->table_size = this->table_alloc = n;
 
 	for (i = 0; i < this->table_size; i++) {
 		off += n = filter_unmarshal(&this->table_filters[i], &bs[off], this->ramps_size);
 		if (!n)
 			return 0;
-		COPY_RAMP_SIZES(&this->table_sums[i].u8, this);
-		off += n = gamma_ramps_unmarshal(&this->table_sums[i], &bs[off], this->ramps_size);
-		if (!n)
-			return 0;
 	}
 
+	/* The result table is not marshalled, so all
+	 * filters are marked as updated to have it
+	 * recomposed when the output is flushed */
+	this->last_updated = this->table_size;
+
+	if (output_index_filters(this, 0) < 0)
+		return 0;
+
 	return off;
 }
 
@@ -280,6 +304,69 @@ output_unmarshal(struct output *restrict this, const void *restrict buf)
 #endif
 
 
+/**
+ * Get the number of bytes between the beginnings
+ * of two consecutive elements in the result
+ * table of an output, in `.table_sums_slab`
+ * 
+ * @param   this  The output
+ * @return        `this->ramps_size` rounded up to
+ *                a multiple of the size of a cache line
+ */
+size_t
+output_sums_stride(const struct output *restrict this)
+{
+	size_t stride = (this->ramps_size + (CACHE_LINE_SIZE - 1)) & ~(size_t)(CACHE_LINE_SIZE - 1);
+	return stride ? stride : CACHE_LINE_SIZE;
+}
+
+
+/**
+ * Grow the result table of an output
+ * 
+ * The elements that are already in the table are kept,
+ * but are moved to a new slab; `this->table_alloc` is
+ * not updated
+ * 
+ * @param   this   The output, its gamma ramp layout must be set
+ * @param   alloc  The new number of elements, at least `this->table_size`
+ * @return         Zero on success, -1 on error
+ */
+int
+output_grow_sums(struct output *restrict this, size_t alloc)
+{
+	size_t i, stride = output_sums_stride(this);
+	size_t stops = this->red_size + this->green_size + this->blue_size;
+	size_t width = stops ? this->ramps_size / stops : 0;
+	union gamma_ramps *sums;
+	uint8_t *slab;
+
+	sums = realloc(this->table_sums, alloc * sizeof(*sums));
+	if (!sums)
+		return -1;
+	this->table_sums = sums;
+
+	/* The slab is allocated anew rather than reallocated,
+	 * as realloc(3) does not preserve the alignment */
+	slab = aligned_alloc(CACHE_LINE_SIZE, alloc * stride);
+	if (!slab)
+		return -1;
+	if (this->table_size)
+		memcpy(slab, this->table_sums_slab, this->table_size * stride);
+	free(this->table_sums_slab);
+	this->table_sums_slab = slab;
+
+	for (i = 0; i < alloc; i++, slab += stride) {
+		COPY_RAMP_SIZES(&sums[i].u8, this);
+		sums[i].u8.red   = slab;
+		sums[i].u8.green = sums[i].u8.red   + this->red_size   * width;
+		sums[i].u8.blue  = sums[i].u8.green + this->green_size * width;
+	}
+
+	return 0;
+}
+
+
 /**
  * Compare to outputs by the names of their respective CRTC:s
  * 
@@ -320,3 +407,246 @@ output_find_by_name(const char *restrict key, struct output *restrict base, size
 
 	return bsearch(&k, base, n, sizeof(*base), output_cmp_by_name);
 }
+
+
+/**
+ * Find a filter on an output by its class
+ * 
+ * @param   this   The output
+ * @param   class  The interned class of the filter
+ * @return         The index of the filter, `this->table_size` if not found
+ */
+size_t
+output_find_filter(const struct output *restrict this, const char *restrict class)
+{
+	size_t i, mask = this->class_index_size - 1;
+
+	if (!this->class_index_size)
+		return this->table_size;
+
+	for (i = class_hash(class) & mask; this->class_index[i].class; i = (i + 1) & mask)
+		if (this->class_index[i].class == class)
+			return this->class_index[i].index;
+
+	return this->table_size;
+}
+
+
+/**
+ * Find where in the filter table of an output, which is
+ * sorted by descending priority, a priority belongs
+ * 
+ * @param   this       The output
+ * @param   priority   The priority
+ * @param   inclusive  Whether filters with the priority `priority`
+ *                     shall be counted as below it
+ * @return             The index of the first filter whose priority is
+ *                     less than `priority`, or if `inclusive` is set,
+ *                     less than or equal to `priority`,
+ *                     `this->table_size` if there is none
+ */
+size_t
+output_bisect_priority(const struct output *restrict this, int64_t priority, int inclusive)
+{
+	size_t lo = 0, hi = this->table_size, mid;
+	int64_t p;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		p = this->table_filters[mid].priority;
+		if (p < priority || (inclusive && p == priority))
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return lo;
+}
+
+
+/**
+ * Add filters to the class index of an output, or update
+ * their indices if they already are in the index, the
+ * index must have room for them
+ * 
+ * @param  this   The output
+ * @param  first  The index of the first filter in `this->table_filters`
+ *                to index, all following filters will be indexed
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static void
+index_filters(struct output *restrict this, size_t first)
+{
+	size_t i, j, mask = this->class_index_size - 1;
+	const char *class;
+
+	for (i = first; i < this->table_size; i++) {
+		class = this->table_filters[i].class;
+		for (j = class_hash(class) & mask; this->class_index[j].class; j = (j + 1) & mask)
+			if (this->class_index[j].class == class)
+				break;
+		this->class_index[j].class = class;
+		this->class_index[j].index = i;
+	}
+}
+
+
+/**
+ * Grow the class index of an output, if necessary,
+ * so that it has room for a number of filters
+ * 
+ * @param   this  The output
+ * @param   n     The number of filters
+ * @return        Zero on success, -1 on error
+ */
+int
+output_reserve_index(struct output *restrict this, size_t n)
+{
+	size_t size = this->class_index_size;
+	void *new;
+
+	/* Keep the index at most half full, it is rebuilt when it is grown */
+	if (2 * n <= size)
+		return 0;
+
+	for (size = size ? size : 16; 2 * n > size; size <<= 1);
+	new = calloc(size, sizeof(*this->class_index));
+	if (!new)
+		return -1;
+	free(this->class_index);
+	this->class_index = new;
+	this->class_index_size = size;
+	index_filters(this, 0);
+	return 0;
+}
+
+
+/**
+ * Add filters to the class index of an output, or update
+ * their indices if they already are in the index
+ * 
+ * Shall be called when filters have been added,
+ * removed, or moved in `this->table_filters`
+ * 
+ * @param   this   The output
+ * @param   first  The index of the first filter in `this->table_filters`
+ *                 that has been added or moved, all following filters
+ *                 will be indexed
+ * @return         Zero on success, -1 on error
+ */
+int
+output_index_filters(struct output *restrict this, size_t first)
+{
+	size_t size = this->class_index_size;
+
+	if (output_reserve_index(this, this->table_size) < 0)
+		return -1;
+	if (this->class_index_size == size)
+		index_filters(this, first);
+
+	return 0;
+}
+
+
+/**
+ * Remove a filter from the class index of an output
+ * 
+ * @param  this   The output
+ * @param  class  The interned class of the filter
+ */
+void
+output_unindex_filter(struct output *restrict this, const char *restrict class)
+{
+	struct class_slot *restrict index = this->class_index;
+	size_t i, j, k, mask = this->class_index_size - 1;
+
+	if (!this->class_index_size)
+		return;
+
+	for (i = class_hash(class) & mask; index[i].class != class; i = (i + 1) & mask)
+		if (!index[i].class)
+			return;
+
+	/* Move back following filters in the probe sequence, so
+	 * that no filter is separated from its home slot by the
+	 * slot that is being freed */
+	for (j = i;;) {
+		j = (j + 1) & mask;
+		if (!index[j].class)
+			break;
+		k = class_hash(index[j].class) & mask;
+		if (((j - k) & mask) >= ((j - i) & mask)) {
+			index[i] = index[j];
+			i = j;
+		}
+	}
+	index[i].class = NULL;
+}
+
+
+/**
+ * Get a cached coalesced priority window of an output
+ * 
+ * @param   this   The output
+ * @param   start  The index of the first filter in the window
+ * @param   end    The index of the last filter in the window, plus 1
+ * @return         The composed ramps, `NULL` if not cached
+ *                 or if the filters have changed since
+ */
+const void *
+output_find_window(struct output *restrict this, size_t start, size_t end)
+{
+	struct cached_window *restrict window;
+	size_t i;
+
+	for (i = 0; i < WINDOW_CACHE_SIZE; i++) {
+		window = &this->windows[i];
+		if (window->last_used && window->generation == this->generation &&
+		    window->start == start && window->end == end) {
+			window->last_used = ++this->window_clock;
+			return window->ramps;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Cache a coalesced priority window of an output,
+ * evicting the least recently used window if the
+ * cache is full
+ * 
+ * @param   this   The output
+ * @param   start  The index of the first filter in the window
+ * @param   end    The index of the last filter in the window, plus 1
+ * @param   ramps  The composed ramps, `this->ramps_size` bytes
+ * @return         Zero on success, -1 on error
+ */
+int
+output_cache_window(struct output *restrict this, size_t start, size_t end, const void *restrict ramps)
+{
+	struct cached_window *restrict window = &this->windows[0];
+	size_t i;
+
+	/* Stale windows are as good as unused */
+	for (i = 0; i < WINDOW_CACHE_SIZE; i++) {
+		if (this->windows[i].generation != this->generation)
+			this->windows[i].last_used = 0;
+		if (this->windows[i].last_used < window->last_used)
+			window = &this->windows[i];
+	}
+
+	if (!window->ramps) {
+		window->ramps = malloc(this->ramps_size);
+		if (!window->ramps)
+			return -1;
+	}
+
+	memcpy(window->ramps, ramps, this->ramps_size);
+	window->start = start;
+	window->end = end;
+	window->generation = this->generation;
+	window->last_used = ++this->window_clock;
+	return 0;
+}
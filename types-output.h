@@ -3,6 +3,7 @@
 #define TYPES_OUTPUT_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <libgamma.h>
 
@@ -17,6 +18,14 @@
 # endif
 #endif
 
+#ifndef WINDOW_CACHE_SIZE
+/**
+ * The number of coalesced priority windows, requested
+ * with ‘Command: get-gamma’, that are cached per output
+ */
+# define WINDOW_CACHE_SIZE 4
+#endif
+
 /**
  * Copy the ramp sizes
  * 
@@ -71,6 +80,60 @@ enum colourspace {
 	COLOURSPACE_GREY = 6
 };
 
+/**
+ * A slot in the class index of an output
+ */
+struct class_slot {
+	/**
+	 * The interned class of the filter,
+	 * `NULL` if the slot is unused
+	 */
+	const char *class;
+
+	/**
+	 * The index of the filter in `.table_filters`
+	 */
+	size_t index;
+};
+
+/**
+ * Identity mapping ramps shared by all outputs
+ * with the same gamma ramp layout, see `get_plain_ramps`
+ */
+struct plain_ramps;
+
+/**
+ * A cached coalesced priority window of an output
+ */
+struct cached_window {
+	/**
+	 * The index of the first filter in the window
+	 */
+	size_t start;
+
+	/**
+	 * The index of the last filter in the window, plus 1
+	 */
+	size_t end;
+
+	/**
+	 * The output's `.generation` when the window was composed
+	 */
+	uint64_t generation;
+
+	/**
+	 * The output's `.window_clock` when the window was
+	 * last used, 0 if the entry is unused
+	 */
+	uint64_t last_used;
+
+	/**
+	 * The composed ramps, `.ramps_size` bytes,
+	 * `NULL` if never allocated
+	 */
+	void *ramps;
+};
+
 /**
  * Information about an output
  */
@@ -201,10 +264,18 @@ struct output {
 	 * adjustment made when all filter
 	 * from `.table_filters[0]` up to and
 	 * including `.table_filters[i]` has
-	 * been applied
+	 * been applied; the ramps of the elements
+	 * are stored in `.table_sums_slab`
 	 */
 	union gamma_ramps *restrict table_sums;
 
+	/**
+	 * The ramps of the elements in `.table_sums`,
+	 * back to back, in order, each starting at a
+	 * cache line; `.table_alloc` elements are allocated
+	 */
+	void *table_sums_slab;
+
 	/**
 	 * The number of elements allocated
 	 * for `.table_filters` and for `.table_sums`
@@ -216,6 +287,92 @@ struct output {
 	 * `.table_filters` and in `.table_sums`
 	 */
 	size_t table_size;
+
+	/**
+	 * The number of elements, from the beginning,
+	 * in `.table_sums` that are up to date,
+	 * `.table_sums[.table_size - 1]` is however
+	 * always up to date
+	 */
+	size_t table_sums_valid;
+
+	/**
+	 * Open-addressing hash table, with linear probing,
+	 * from the classes of the filters in `.table_filters`
+	 * to their indices, keyed by the interned classes'
+	 * addresses
+	 */
+	struct class_slot *restrict class_index;
+
+	/**
+	 * The number of slots in `.class_index`, always
+	 * a power of two, 0 if it has not been allocated
+	 */
+	size_t class_index_size;
+
+	/**
+	 * Segment tree of composed filters, `.table_tree[k]`
+	 * is `.table_tree[2 * k]` followed by `.table_tree[2 * k + 1]`,
+	 * where the elements `.tree_leaves` and above are the
+	 * ramps of `.table_filters[k - .tree_leaves]` and are
+	 * not stored in `.table_tree`; `.table_tree[1]` is thus
+	 * all filters in the table composed, `.table_tree[0]`
+	 * is unused; it is not used for outputs with
+	 * floating-point stops
+	 */
+	union gamma_ramps *restrict table_tree;
+
+	/**
+	 * The number of leaves in `.table_tree`, which is
+	 * also the number of elements allocated for it,
+	 * always a power of two, 0 if it has not been built
+	 */
+	size_t tree_leaves;
+
+	/**
+	 * The index of the first filter in `.table_filters`
+	 * that has been added, removed, or updated since
+	 * the resulting gamma was last recalculated
+	 */
+	size_t first_updated;
+
+	/**
+	 * The index of the last filter in `.table_filters`
+	 * that has been added, removed, or updated since
+	 * the resulting gamma was last recalculated, plus 1,
+	 * 0 if no filter has been changed since
+	 */
+	size_t last_updated;
+
+	/**
+	 * Whether the resulting gamma has changed since
+	 * it was last pushed to the CRTC
+	 */
+	int flush_pending;
+
+	/**
+	 * Incremented each time the filters are changed,
+	 * cached windows composed at an earlier
+	 * generation are stale
+	 */
+	uint64_t generation;
+
+	/**
+	 * Incremented each time a cached window is used,
+	 * so that the least recently used can be evicted
+	 */
+	uint64_t window_clock;
+
+	/**
+	 * Cached coalesced priority windows
+	 */
+	struct cached_window windows[WINDOW_CACHE_SIZE];
+
+	/**
+	 * The output's reference to the identity mapping
+	 * ramps for its layout, `NULL` if not yet acquired
+	 */
+	struct plain_ramps *plain;
 };
 
 /**
@@ -250,6 +407,120 @@ size_t output_marshal(const struct output *restrict this, void *restrict buf);
 GCC_ONLY(__attribute__((__nonnull__)))
 size_t output_unmarshal(struct output *restrict this, const void *restrict buf);
 
+/**
+ * Get the number of bytes between the beginnings
+ * of two consecutive elements in the result
+ * table of an output, in `.table_sums_slab`
+ * 
+ * @param   this  The output
+ * @return        `this->ramps_size` rounded up to
+ *                a multiple of the size of a cache line
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+size_t output_sums_stride(const struct output *restrict this);
+
+/**
+ * Grow the result table of an output
+ * 
+ * The elements that are already in the table are kept,
+ * but are moved to a new slab; `this->table_alloc` is
+ * not updated
+ * 
+ * @param   this   The output, its gamma ramp layout must be set
+ * @param   alloc  The new number of elements, at least `this->table_size`
+ * @return         Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int output_grow_sums(struct output *restrict this, size_t alloc);
+
+/**
+ * Find a filter on an output by its class
+ * 
+ * @param   this   The output
+ * @param   class  The interned class of the filter
+ * @return         The index of the filter, `this->table_size` if not found
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+size_t output_find_filter(const struct output *restrict this, const char *restrict class);
+
+/**
+ * Find where in the filter table of an output, which is
+ * sorted by descending priority, a priority belongs
+ * 
+ * @param   this       The output
+ * @param   priority   The priority
+ * @param   inclusive  Whether filters with the priority `priority`
+ *                     shall be counted as below it
+ * @return             The index of the first filter whose priority is
+ *                     less than `priority`, or if `inclusive` is set,
+ *                     less than or equal to `priority`,
+ *                     `this->table_size` if there is none
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+size_t output_bisect_priority(const struct output *restrict this, int64_t priority, int inclusive);
+
+/**
+ * Add filters to the class index of an output, or update
+ * their indices if they already are in the index
+ * 
+ * Shall be called when filters have been added,
+ * removed, or moved in `this->table_filters`
+ * 
+ * @param   this   The output
+ * @param   first  The index of the first filter in `this->table_filters`
+ *                 that has been added or moved, all following filters
+ *                 will be indexed
+ * @return         Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int output_index_filters(struct output *restrict this, size_t first);
+
+/**
+ * Grow the class index of an output, if necessary,
+ * so that it has room for a number of filters
+ * 
+ * @param   this  The output
+ * @param   n     The number of filters
+ * @return        Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int output_reserve_index(struct output *restrict this, size_t n);
+
+/**
+ * Remove a filter from the class index of an output
+ * 
+ * @param  this   The output
+ * @param  class  The interned class of the filter
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void output_unindex_filter(struct output *restrict this, const char *restrict class);
+
+/**
+ * Get a cached coalesced priority window of an output
+ * 
+ * @param   this   The output
+ * @param   start  The index of the first filter in the window
+ * @param   end    The index of the last filter in the window, plus 1
+ * @return         The composed ramps, `NULL` if not cached
+ *                 or if the filters have changed since
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+const void *output_find_window(struct output *restrict this, size_t start, size_t end);
+
+/**
+ * Cache a coalesced priority window of an output,
+ * evicting the least recently used window if the
+ * cache is full
+ * 
+ * @param   this   The output
+ * @param   start  The index of the first filter in the window
+ * @param   end    The index of the last filter in the window, plus 1
+ * @param   ramps  The composed ramps, `this->ramps_size` bytes
+ * @return         Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int output_cache_window(struct output *restrict this, size_t start, size_t end, const void *restrict ramps);
+
 /**
  * Compare to outputs by the names of their respective CRTC:s
  * 
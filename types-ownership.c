@@ -0,0 +1,236 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-ownership.h"
+#include "types-class.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * Initialise an ownership list, as empty
+ * 
+ * @param  this  The ownership list
+ */
+void
+ownership_initialise(struct ownership *restrict this)
+{
+	this->filters = NULL;
+	this->n = 0;
+	this->alloc = 0;
+}
+
+
+/**
+ * Release all resources allocated to an ownership list,
+ * the list will be empty afterwards
+ * 
+ * @param  this  The ownership list
+ */
+void
+ownership_destroy(struct ownership *restrict this)
+{
+	size_t i;
+
+	for (i = 0; i < this->n; i++) {
+		free(this->filters[i].crtc);
+		class_release(this->filters[i].class);
+	}
+	free(this->filters);
+	ownership_initialise(this);
+}
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-align"
+#endif
+
+
+/**
+ * Marshal an ownership list
+ * 
+ * @param   this  The ownership list
+ * @param   buf   Output buffer for the marshalled list,
+ *                `NULL` just measure how large the buffers
+ *                needs to be
+ * @return        The number of marshalled byte
+ */
+size_t
+ownership_marshal(const struct ownership *restrict this, void *restrict buf)
+{
+	size_t off = 0, i, n;
+	char *restrict bs = buf;
+
+	if (bs)
+		*(size_t *)&bs[off] = this->n;
+	off += sizeof(size_t);
+
+	for (i = 0; i < this->n; i++) {
+		n = strlen(this->filters[i].crtc) + 1;
+		if (bs)
+			memcpy(&bs[off], this->filters[i].crtc, n);
+		off += n;
+
+		n = strlen(this->filters[i].class) + 1;
+		if (bs)
+			memcpy(&bs[off], this->filters[i].class, n);
+		off += n;
+	}
+
+	return off;
+}
+
+
+/**
+ * Unmarshal an ownership list
+ * 
+ * @param   this  Output for the ownership list
+ * @param   buf   Buffer with the marshalled list
+ * @return        The number of unmarshalled bytes, 0 on error
+ */
+size_t
+ownership_unmarshal(struct ownership *restrict this, const void *restrict buf)
+{
+	size_t off = 0, n;
+	const char *restrict bs = buf;
+	struct owned_filter *restrict filter;
+
+	ownership_initialise(this);
+
+	this->alloc = *(const size_t *)&bs[off];
+	off += sizeof(size_t);
+
+	if (this->alloc > 0) {
+		this->filters = calloc(this->alloc, sizeof(*this->filters));
+		if (!this->filters)
+			return 0;
+	}
+
+	for (; this->n < this->alloc; this->n++) {
+		filter = &this->filters[this->n];
+
+		n = strlen(&bs[off]) + 1;
+		if (!(filter->crtc = memdup(&bs[off], n)))
+			return 0;
+		off += n;
+
+		if (!(filter->class = class_intern(&bs[off])))
+			return 0;
+		off += strlen(&bs[off]) + 1;
+	}
+
+	return off;
+}
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic pop
+#endif
+
+
+/**
+ * Find where a filter is, or belongs, in an ownership list
+ * 
+ * @param   this   The ownership list
+ * @param   crtc   The name of the output the filter is applied to
+ * @param   class  The class of the filter
+ * @param   found  Output parameter for whether the filter is recorded
+ * @return         The index of the filter, or where it shall be inserted
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+static size_t
+ownership_bisect(const struct ownership *restrict this, const char *restrict crtc,
+                 const char *restrict class, int *restrict found)
+{
+	size_t lo = 0, hi = this->n, mid;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		cmp = strcmp(crtc, this->filters[mid].crtc);
+		if (!cmp)
+			cmp = strcmp(class, this->filters[mid].class);
+		if (!cmp) {
+			*found = 1;
+			return mid;
+		}
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	*found = 0;
+	return lo;
+}
+
+
+/**
+ * Record that a filter is owned, nothing is
+ * changed if it is already recorded
+ * 
+ * @param   this   The ownership list
+ * @param   crtc   The name of the output the filter is applied to
+ * @param   class  The interned class of the filter
+ * @return         Zero on success, -1 on error
+ */
+int
+ownership_add(struct ownership *restrict this, const char *restrict crtc, const char *restrict class)
+{
+	struct owned_filter filter, *new;
+	size_t i, alloc;
+	int found;
+
+	i = ownership_bisect(this, crtc, class, &found);
+	if (found)
+		return 0;
+
+	if (this->n == this->alloc) {
+		alloc = this->alloc ? 2 * this->alloc : 4;
+		new = realloc(this->filters, alloc * sizeof(*this->filters));
+		if (!new)
+			return -1;
+		this->filters = new;
+		this->alloc = alloc;
+	}
+
+	filter.crtc = memdup(crtc, strlen(crtc) + 1);
+	if (!filter.crtc)
+		return -1;
+	filter.class = class_intern(class);
+	if (!filter.class) {
+		free(filter.crtc);
+		return -1;
+	}
+
+	memmove(&this->filters[i + 1], &this->filters[i], (this->n - i) * sizeof(*this->filters));
+	this->filters[i] = filter;
+	this->n += 1;
+	return 0;
+}
+
+
+/**
+ * Record that a filter is no longer owned, nothing
+ * is changed if it is not recorded
+ * 
+ * @param  this   The ownership list
+ * @param  crtc   The name of the output the filter is applied to
+ * @param  class  The interned class of the filter
+ */
+void
+ownership_remove(struct ownership *restrict this, const char *restrict crtc, const char *restrict class)
+{
+	size_t i;
+	int found;
+
+	i = ownership_bisect(this, crtc, class, &found);
+	if (!found)
+		return;
+
+	free(this->filters[i].crtc);
+	class_release(this->filters[i].class);
+	this->n -= 1;
+	memmove(&this->filters[i], &this->filters[i + 1], (this->n - i) * sizeof(*this->filters));
+}
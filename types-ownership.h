@@ -0,0 +1,121 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_OWNERSHIP_H
+#define TYPES_OWNERSHIP_H
+
+#include <stddef.h>
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+/**
+ * A filter owned by a connection
+ */
+struct owned_filter {
+	/**
+	 * The name of the output the filter is applied to
+	 */
+	char *restrict crtc;
+
+	/**
+	 * The class of the filter, interned with `class_intern`
+	 */
+	char *restrict class;
+};
+
+/**
+ * The filters, with the lifespan `LIFESPAN_UNTIL_DEATH`,
+ * that a connection has applied, so that they can be
+ * removed without searching all outputs when the
+ * connection is closed
+ * 
+ * An entry may outlive the ownership of its filter, if
+ * another client replaced it, such entries are ignored
+ * when the connection is closed
+ */
+struct ownership {
+	/**
+	 * The owned filters, sorted by output name
+	 * and then by class, without duplicates
+	 */
+	struct owned_filter *restrict filters;
+
+	/**
+	 * The number of elements in `.filters`
+	 */
+	size_t n;
+
+	/**
+	 * The number of elements allocated to `.filters`
+	 */
+	size_t alloc;
+};
+
+
+/**
+ * Initialise an ownership list, as empty
+ * 
+ * @param  this  The ownership list
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void ownership_initialise(struct ownership *restrict this);
+
+/**
+ * Release all resources allocated to an ownership list,
+ * the list will be empty afterwards
+ * 
+ * @param  this  The ownership list
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void ownership_destroy(struct ownership *restrict this);
+
+/**
+ * Marshal an ownership list
+ * 
+ * @param   this  The ownership list
+ * @param   buf   Output buffer for the marshalled list,
+ *                `NULL` just measure how large the buffers
+ *                needs to be
+ * @return        The number of marshalled byte
+ */
+GCC_ONLY(__attribute__((__nonnull__(1))))
+size_t ownership_marshal(const struct ownership *restrict this, void *restrict buf);
+
+/**
+ * Unmarshal an ownership list
+ * 
+ * @param   this  Output for the ownership list
+ * @param   buf   Buffer with the marshalled list
+ * @return        The number of unmarshalled bytes, 0 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+size_t ownership_unmarshal(struct ownership *restrict this, const void *restrict buf);
+
+/**
+ * Record that a filter is owned, nothing is
+ * changed if it is already recorded
+ * 
+ * @param   this   The ownership list
+ * @param   crtc   The name of the output the filter is applied to
+ * @param   class  The interned class of the filter
+ * @return         Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int ownership_add(struct ownership *restrict this, const char *restrict crtc, const char *restrict class);
+
+/**
+ * Record that a filter is no longer owned, nothing
+ * is changed if it is not recorded
+ * 
+ * @param  this   The ownership list
+ * @param  crtc   The name of the output the filter is applied to
+ * @param  class  The interned class of the filter
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void ownership_remove(struct ownership *restrict this, const char *restrict crtc, const char *restrict class);
+
+#endif
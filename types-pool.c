@@ -0,0 +1,147 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-pool.h"
+#include "types-stats.h"
+
+#include <stdlib.h>
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic ignored "-Wcast-align"
+#endif
+
+
+/**
+ * The binary logarithm of the size of
+ * the smallest size class
+ */
+#define POOL_MIN_SHIFT 6
+
+/**
+ * The number of size classes, buffers larger
+ * than the largest class are not kept
+ */
+#define POOL_CLASSES 12
+
+/**
+ * The largest number of released buffers
+ * that are kept in each size class
+ */
+#define POOL_CLASS_MAX 32
+
+
+/**
+ * A buffer
+ */
+struct buffer {
+	/**
+	 * The size class of the buffer,
+	 * `POOL_CLASSES` if it has none
+	 */
+	size_t class;
+
+	/**
+	 * The next released buffer in
+	 * the buffer's size class
+	 */
+	struct buffer *next;
+
+	/**
+	 * The content of the buffer
+	 */
+	_Alignas(max_align_t) char data[];
+};
+
+
+/**
+ * The released buffers in each size class
+ */
+static struct buffer *released[POOL_CLASSES];
+
+/**
+ * The number of released buffers in each size class
+ */
+static size_t released_count[POOL_CLASSES];
+
+
+/**
+ * Allocate a buffer from the pool of short-lived buffers
+ * 
+ * Buffers are kept in power-of-two size classes when
+ * they are released, so that messages, which are
+ * allocated for each reply and freed once they have
+ * been sent, seldom need to be allocated with malloc(3)
+ * 
+ * @param   size  The number of bytes needed
+ * @return        The buffer, it shall be released with
+ *                `pool_free`; `NULL` on error
+ */
+void *
+pool_alloc(size_t size)
+{
+	struct buffer *buffer;
+	size_t class = 0;
+
+	while (class < POOL_CLASSES && (size_t)1 << (class + POOL_MIN_SHIFT) < size)
+		class++;
+
+	if (class < POOL_CLASSES && released[class]) {
+		buffer = released[class];
+		released[class] = buffer->next;
+		released_count[class] -= 1;
+		stats.counters[COUNTER_BUFFER_POOL_HITS] += 1;
+		return buffer->data;
+	}
+
+	if (class < POOL_CLASSES)
+		size = (size_t)1 << (class + POOL_MIN_SHIFT);
+	buffer = malloc(offsetof(struct buffer, data) + size);
+	if (!buffer)
+		return NULL;
+	buffer->class = class;
+	stats.counters[COUNTER_BUFFER_POOL_MISSES] += 1;
+	return buffer->data;
+}
+
+
+/**
+ * Release a buffer allocated with `pool_alloc`
+ * 
+ * @param  buf  The buffer, may be `NULL`
+ */
+void
+pool_free(void *restrict buf)
+{
+	struct buffer *buffer;
+
+	if (!buf)
+		return;
+
+	buffer = (struct buffer *)(void *)((char *)buf - offsetof(struct buffer, data));
+	if (buffer->class == POOL_CLASSES || released_count[buffer->class] == POOL_CLASS_MAX) {
+		free(buffer);
+		return;
+	}
+
+	buffer->next = released[buffer->class];
+	released[buffer->class] = buffer;
+	released_count[buffer->class] += 1;
+}
+
+
+/**
+ * Free all buffers kept in the pool
+ */
+void
+pool_trim(void)
+{
+	struct buffer *buffer;
+	size_t i;
+
+	for (i = 0; i < POOL_CLASSES; i++) {
+		while ((buffer = released[i])) {
+			released[i] = buffer->next;
+			free(buffer);
+		}
+		released_count[i] = 0;
+	}
+}
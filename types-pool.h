@@ -0,0 +1,43 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_POOL_H
+#define TYPES_POOL_H
+
+#include <stddef.h>
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+
+/**
+ * Allocate a buffer from the pool of short-lived buffers
+ * 
+ * Buffers are kept in power-of-two size classes when
+ * they are released, so that messages, which are
+ * allocated for each reply and freed once they have
+ * been sent, seldom need to be allocated with malloc(3)
+ * 
+ * @param   size  The number of bytes needed
+ * @return        The buffer, it shall be released with
+ *                `pool_free`; `NULL` on error
+ */
+GCC_ONLY(__attribute__((__malloc__)))
+void *pool_alloc(size_t size);
+
+/**
+ * Release a buffer allocated with `pool_alloc`
+ * 
+ * @param  buf  The buffer, may be `NULL`
+ */
+void pool_free(void *restrict buf);
+
+/**
+ * Free all buffers kept in the pool
+ */
+void pool_trim(void);
+
+#endif
@@ -4,6 +4,7 @@
 #include <libclut.h>
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -84,3 +85,138 @@ gamma_ramps_unmarshal(union gamma_ramps *restrict this, const void *restrict buf
 	memcpy(this->u8.red, buf, ramps_size);
 	return ramps_size;
 }
+
+
+/**
+ * Define a function that applies a channel of a filter with
+ * floating-point stops on top of the same channel of another
+ * filter, interpolating linearly between the stops of the
+ * applied filter rather than picking the nearest stop
+ * 
+ * The defined function, `apply_interpolated_##SUFFIX`, takes
+ * the channel the filter shall be applied on, its number of
+ * stops, the channel of the filter that shall be applied,
+ * and its number of stops
+ * 
+ * @param  SUFFIX  The suffix of the function's name
+ * @param  TYPE    The type of the stops
+ */
+#define APPLY_INTERPOLATED(SUFFIX, TYPE)\
+	static void\
+	apply_interpolated_##SUFFIX(TYPE *restrict dest, size_t n, const TYPE *restrict app, size_t m)\
+	{\
+		size_t i, j;\
+		TYPE x;\
+		if (m < 2) {\
+			for (i = 0; i < n; i++)\
+				dest[i] = app[0];\
+			return;\
+		}\
+		m -= 1;\
+		for (i = 0; i < n; i++) {\
+			x = dest[i] * (TYPE)m;\
+			x = x > 0 ? x : 0;\
+			x = x < (TYPE)m ? x : (TYPE)m;\
+			j = (size_t)x;\
+			j -= (j == m);\
+			x -= (TYPE)j;\
+			dest[i] = (1 - x) * app[j] + x * app[j + 1];\
+		}\
+	}
+
+APPLY_INTERPOLATED(f, float)
+APPLY_INTERPOLATED(d, double)
+
+
+/**
+ * Apply a filter on top of another filter
+ * 
+ * @param  dest         The output for the resulting ramp-trio, must be initialised
+ * @param  application  The red, green and blue ramps, as one single raw array,
+ *                      of the filter that should be applied
+ * @param  depth        -1: `float` stops, interpolated linearly
+ *                      -2: `double` stops, interpolated linearly
+ *                      Other: the number of bits of each (integral) stop
+ * @param  base         The CLUT on top of which the new filter should be applied,
+ *                      this can be the same pointer as `dest`
+ */
+void
+gamma_ramps_apply(union gamma_ramps *dest, void *restrict application, int depth, const union gamma_ramps *base)
+{
+	union gamma_ramps app;
+	size_t bytedepth;
+	size_t red_width, green_width, blue_width;
+	int grey;
+
+	if (depth == -1)
+		bytedepth = sizeof(float);
+	else if (depth == -2)
+		bytedepth = sizeof(double);
+	else
+		bytedepth = (size_t)depth / 8;
+
+	red_width   = (app.u8.red_size   = base->u8.red_size)   * bytedepth;
+	green_width = (app.u8.green_size = base->u8.green_size) * bytedepth;
+	blue_width  = (app.u8.blue_size  = base->u8.blue_size)  * bytedepth;
+
+	app.u8.red   = application;
+	app.u8.green = &app.u8.red[red_width];
+	app.u8.blue  = &app.u8.green[green_width];
+
+	if (dest != base) {
+		memcpy(dest->u8.red,   base->u8.red,   red_width);
+		memcpy(dest->u8.green, base->u8.green, green_width);
+		memcpy(dest->u8.blue,  base->u8.blue,  blue_width);
+	}
+
+	/* Filters very often adjust all channels alike, in which case only
+	 * one channel needs to be calculated, and the result is bit-identical
+	 * because the same calculation is made on the same values. */
+	grey = (red_width == green_width && green_width == blue_width &&
+	        !memcmp(app.u8.red,   app.u8.green,   red_width) &&
+	        !memcmp(app.u8.red,   app.u8.blue,    red_width) &&
+	        !memcmp(dest->u8.red, dest->u8.green, red_width) &&
+	        !memcmp(dest->u8.red, dest->u8.blue,  red_width));
+
+	switch (depth) {
+	case 8:
+		libclut_apply(&dest->u8, UINT8_MAX, uint8_t, &app.u8, UINT8_MAX, uint8_t, 1, !grey, !grey);
+		break;
+
+	case 16:
+		libclut_apply(&dest->u16, UINT16_MAX, uint16_t, &app.u16, UINT16_MAX, uint16_t, 1, !grey, !grey);
+		break;
+
+	case 32:
+		libclut_apply(&dest->u32, UINT32_MAX, uint32_t, &app.u32, UINT32_MAX, uint32_t, 1, !grey, !grey);
+		break;
+
+	case 64:
+		libclut_apply(&dest->u64, UINT64_MAX, uint64_t, &app.u64, UINT64_MAX, uint64_t, 1, !grey, !grey);
+		break;
+
+	case -1:
+		apply_interpolated_f(dest->f.red, dest->f.red_size, app.f.red, app.f.red_size);
+		if (!grey) {
+			apply_interpolated_f(dest->f.green, dest->f.green_size, app.f.green, app.f.green_size);
+			apply_interpolated_f(dest->f.blue,  dest->f.blue_size,  app.f.blue,  app.f.blue_size);
+		}
+		break;
+
+	case -2:
+		apply_interpolated_d(dest->d.red, dest->d.red_size, app.d.red, app.d.red_size);
+		if (!grey) {
+			apply_interpolated_d(dest->d.green, dest->d.green_size, app.d.green, app.d.green_size);
+			apply_interpolated_d(dest->d.blue,  dest->d.blue_size,  app.d.blue,  app.d.blue_size);
+		}
+		break;
+
+	default:
+		abort();
+	}
+
+	if (grey) {
+		memcpy(dest->u8.green, dest->u8.red, red_width);
+		memcpy(dest->u8.blue,  dest->u8.red, red_width);
+	}
+}
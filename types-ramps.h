@@ -72,4 +72,19 @@ size_t gamma_ramps_marshal(const union gamma_ramps *restrict this, void *restric
 GCC_ONLY(__attribute__((__nonnull__)))
 size_t gamma_ramps_unmarshal(union gamma_ramps *restrict this, const void *restrict buf, size_t ramps_size);
 
+/**
+ * Apply a filter on top of another filter
+ * 
+ * @param  dest         The output for the resulting ramp-trio, must be initialised
+ * @param  application  The red, green and blue ramps, as one single raw array,
+ *                      of the filter that should be applied
+ * @param  depth        -1: `float` stops, interpolated linearly
+ *                      -2: `double` stops, interpolated linearly
+ *                      Other: the number of bits of each (integral) stop
+ * @param  base         The CLUT on top of which the new filter should be applied,
+ *                      this can be the same pointer as `dest`
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void gamma_ramps_apply(union gamma_ramps *dest, void *restrict application, int depth, const union gamma_ramps *base);
+
 #endif
@@ -1,5 +1,6 @@
 /* See LICENSE file for copyright and license details. */
 #include "types-ring.h"
+#include "types-pool.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -13,10 +14,12 @@
 void
 ring_initialise(struct ring *restrict this)
 {
-	this->start  = 0;
-	this->end    = 0;
-	this->size   = 0;
-	this->buffer = NULL;
+	this->messages = NULL;
+	this->start    = 0;
+	this->count    = 0;
+	this->size     = 0;
+	this->offset   = 0;
+	this->bytes    = 0;
 }
 
 
@@ -38,16 +41,20 @@ ring_initialise(struct ring *restrict this)
 size_t
 ring_marshal(const struct ring *restrict this, void *restrict buf)
 {
-	size_t off = 0, n = this->end - this->start;
+	size_t off = 0, i;
+	const struct iovec *message;
 	char *bs = buf;
 
 	if (bs)
-		*(size_t *)&bs[off] = n;
+		*(size_t *)&bs[off] = this->bytes;
 	off += sizeof(size_t);
 
-	if (bs)
-		memcpy(&bs[off], this->buffer + this->start, n);
-	off += n;
+	for (i = 0; i < this->count; i++) {
+		message = &this->messages[(this->start + i) % this->size];
+		if (bs)
+			memcpy(&bs[off], message->iov_base, message->iov_len);
+		off += message->iov_len;
+	}
 
 	return off;
 }
@@ -63,21 +70,26 @@ ring_marshal(const struct ring *restrict this, void *restrict buf)
 size_t
 ring_unmarshal(struct ring *restrict this, const void *restrict buf)
 {
-	size_t off = 0;
+	size_t off = 0, n;
 	const char *bs = buf;
+	char *data;
 
 	ring_initialise(this);
 
-	this->size = this->end = *(const size_t *)&bs[off];
+	n = *(const size_t *)&bs[off];
 	off += sizeof(size_t);
 
-	if (this->end > 0) {
-		this->buffer = malloc(this->end);
-		if (!this->buffer)
+	if (n > 0) {
+		data = pool_alloc(n);
+		if (!data)
 			return 0;
+		memcpy(data, &bs[off], n);
+		off += n;
 
-		memcpy(this->buffer, bs + off, this->end);
-		off += this->end;
+		if (ring_push(this, data, n) < 0) {
+			pool_free(data);
+			return 0;
+		}
 	}
 
 	return off;
@@ -90,85 +102,80 @@ ring_unmarshal(struct ring *restrict this, const void *restrict buf)
 
 
 /**
- * Append data to a ring buffer
+ * Append a message to a ring buffer
+ * 
+ * The ring buffer takes over the ownership of
+ * `data`, but not on failure
  * 
  * @param   this  The ring buffer
- * @param   data  The new data
+ * @param   data  The message, must have been allocated with `pool_alloc`
  * @param   n     The number of bytes in `data`
  * @return        Zero on success, -1 on error
  */
 int
 ring_push(struct ring *restrict this, void *restrict data, size_t n)
 {
-	size_t used = 0;
-	char *restrict new;
-
-	if (this->start == this->end) {
-		if (this->buffer)
-			used = this->size;
-	} else if (this->start > this->end) {
-		used = this->size - this->start + this->end;
-	} else {
-		used = this->start - this->end;
+	struct iovec *restrict new;
+	size_t size, head;
+
+	if (!n) {
+		pool_free(data);
+		return 0;
 	}
 
-	if (used + n > this->size) {
-		new = malloc(used + n);
+	if (this->count == this->size) {
+		size = this->size ? this->size << 1 : 8;
+		new = malloc(size * sizeof(*new));
 		if (!new)
 			return -1;
-		if (this->buffer) {
-			if (this->start < this->end) {
-				memcpy(new, this->buffer + this->start, this->end - this->start);
-			} else {
-				memcpy(new, this->buffer + this->start, this->size - this->start);
-				memcpy(new + this->size - this->start, this->buffer, this->end);
-			}
+		head = this->size - this->start;
+		if (head > this->count)
+			head = this->count;
+		if (this->messages) {
+			memcpy(new, &this->messages[this->start], head * sizeof(*new));
+			memcpy(&new[head], this->messages, (this->count - head) * sizeof(*new));
 		}
-		memcpy(new + used, data, n);
-		this->buffer = new;
+		free(this->messages);
+		this->messages = new;
 		this->start = 0;
-		this->end = used + n;
-		this->size = used + n;
-	} else if (this->start >= this->end || this->end + n <= this->size) {
-		memcpy(&this->buffer[this->end], data, n);
-		this->end += n;
-	} else {
-		memcpy(&this->buffer[this->end], data, this->size - this->end);
-		data = &((char *)data)[this->size - this->end];
-		n -= this->size - this->end;
-		memcpy(this->buffer, data, n);
-		this->end = n;
+		this->size = size;
 	}
 
+	new = &this->messages[(this->start + this->count) % this->size];
+	new->iov_base = data;
+	new->iov_len = n;
+	this->count += 1;
+	this->bytes += n;
+
 	return 0;
 }
 
 
 /**
- * Get queued data from a ring buffer
+ * Get queued messages from a ring buffer
  * 
  * It can take up to two calls (with `ring_pop` between)
- * to get all queued data
+ * to get all queued messages
  * 
  * @param   this  The ring buffer
- * @param   n     Output parameter for the length
- *                of the returned segment
- * @return        The beginning of the queued data,
- *                `NULL` if there is nothing more
+ * @param   n     Output parameter for the number
+ *                of returned messages
+ * @return        The first queued message, the returned
+ *                messages are contiguous, `NULL` if
+ *                there is nothing more
  */
-void *
+struct iovec *
 ring_peek(struct ring *restrict this, size_t *restrict n)
 {
-	if (!this->buffer) {
+	if (!this->count) {
 		*n = 0;
 		return NULL;
 	}
 
-	if (this->start < this->end)
-		*n = this->end - this->start;
-	else
-		*n = this->size - this->start;
-	return this->buffer + this->start;
+	*n = this->size - this->start;
+	if (*n > this->count)
+		*n = this->count;
+	return &this->messages[this->start];
 }
 
 
@@ -181,13 +188,41 @@ ring_peek(struct ring *restrict this, size_t *restrict n)
 void
 ring_pop(struct ring *restrict this, size_t n)
 {
-	this->start += n;
-	this->start %= this->size;
-	if (this->start == this->end) {
-		free(this->buffer);
-		this->start  = 0;
-		this->end    = 0;
-		this->size   = 0;
-		this->buffer = NULL;
+	struct iovec *message;
+
+	this->bytes -= n;
+
+	while (n) {
+		message = &this->messages[this->start];
+		if (n < message->iov_len) {
+			message->iov_base = &((char *)message->iov_base)[n];
+			message->iov_len -= n;
+			this->offset += n;
+			break;
+		}
+		n -= message->iov_len;
+		pool_free((char *)message->iov_base - this->offset);
+		this->offset = 0;
+		this->start = (this->start + 1) % this->size;
+		this->count -= 1;
 	}
+
+	if (!this->count)
+		this->start = 0;
+}
+
+
+/**
+ * Release resource allocated to a ring buffer,
+ * the ring buffer will be empty afterwards
+ * 
+ * @param  this  The ring buffer
+ */
+void
+ring_destroy(struct ring *restrict this)
+{
+	if (this->count)
+		ring_pop(this, this->bytes);
+	free(this->messages);
+	ring_initialise(this);
 }
@@ -2,6 +2,7 @@
 #ifndef TYPES_RING_H
 #define TYPES_RING_H
 
+#include <sys/uio.h>
 #include <stdlib.h>
 
 #ifndef GCC_ONLY
@@ -13,28 +14,42 @@
 #endif
 
 /**
- * Ring buffer
+ * Ring buffer of queued messages
  */
 struct ring {
 	/**
-	 * Buffer for the data
+	 * The queued messages, each message is
+	 * owned by the ring buffer; the first
+	 * message has been advanced past the
+	 * `.offset` bytes that have been dequeued
 	 */
-	char *restrict buffer;
+	struct iovec *restrict messages;
 
 	/**
-	 * The first set byte in `.buffer`
+	 * The index of the first message in `.messages`
 	 */
 	size_t start;
 
 	/**
-	 * The last set byte in `.buffer`, plus 1
+	 * The number of messages in `.messages`
 	 */
-	size_t end;
+	size_t count;
 
 	/**
-	 * The size of `.buffer`
+	 * The number of elements allocated for `.messages`
 	 */
 	size_t size;
+
+	/**
+	 * The number of bytes that have been dequeued
+	 * from the first message in `.messages`
+	 */
+	size_t offset;
+
+	/**
+	 * The number of queued bytes
+	 */
+	size_t bytes;
 };
 
 /**
@@ -68,10 +83,13 @@ GCC_ONLY(__attribute__((__nonnull__)))
 size_t ring_unmarshal(struct ring *restrict this, const void *restrict buf);
 
 /**
- * Append data to a ring buffer
+ * Append a message to a ring buffer
+ * 
+ * The ring buffer takes over the ownership of
+ * `data`, but not on failure
  * 
  * @param   this  The ring buffer
- * @param   data  The new data
+ * @param   data  The message, must have been allocated with `pool_alloc`
  * @param   n     The number of bytes in `data`
  * @return        Zero on success, -1 on error
  */
@@ -79,19 +97,20 @@ GCC_ONLY(__attribute__((__nonnull__(1))))
 int ring_push(struct ring *restrict this, void *restrict data, size_t n);
 
 /**
- * Get queued data from a ring buffer
+ * Get queued messages from a ring buffer
  * 
  * It can take up to two calls (with `ring_pop` between)
- * to get all queued data
+ * to get all queued messages
  * 
  * @param   this  The ring buffer
- * @param   n     Output parameter for the length
- *                of the returned segment
- * @return        The beginning of the queued data,
- *                `NULL` if there is nothing more
+ * @param   n     Output parameter for the number
+ *                of returned messages
+ * @return        The first queued message, the returned
+ *                messages are contiguous, `NULL` if
+ *                there is nothing more
  */
 GCC_ONLY(__attribute__((__nonnull__)))
-void *ring_peek(struct ring *restrict this, size_t *restrict n);
+struct iovec *ring_peek(struct ring *restrict this, size_t *restrict n);
 
 /**
  * Dequeue data from a ring bubber
@@ -103,16 +122,13 @@ GCC_ONLY(__attribute__((__nonnull__)))
 void ring_pop(struct ring *restrict this, size_t n);
 
 /**
- * Release resource allocated to a ring buffer
+ * Release resource allocated to a ring buffer,
+ * the ring buffer will be empty afterwards
  * 
  * @param  this  The ring buffer
  */
 GCC_ONLY(__attribute__((__nonnull__)))
-static inline void
-ring_destroy(struct ring *restrict this)
-{
-	free(this->buffer);
-}
+void ring_destroy(struct ring *restrict this);
 
 /**
  * Check whether there is more data waiting
@@ -125,7 +141,7 @@ GCC_ONLY(__attribute__((__nonnull__)))
 static inline int
 ring_have_more(struct ring *restrict this)
 {
-	return !!this->buffer;
+	return this->count > 0;
 }
 
 #endif
@@ -0,0 +1,213 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-stats.h"
+
+#include <stdio.h>
+#include <time.h>
+
+
+/**
+ * Runtime statistics, collected since the
+ * process started or was last re-executed
+ */
+struct stats stats;
+
+
+/**
+ * The names of the counters,
+ * indexed by `enum counter`
+ */
+static const char *const counter_names[] = {
+#define X(C, N) N,
+	LIST_COUNTERS
+#undef X
+};
+
+/**
+ * The names of the measured operations,
+ * indexed by `enum timing`
+ */
+static const char *const timing_names[] = {
+#define X(C, N) N,
+	LIST_TIMINGS
+#undef X
+};
+
+
+/**
+ * Read the monotonic clock
+ * 
+ * @return  The current time, in nanoseconds, 0 on error
+ */
+uint64_t
+stats_clock(void)
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/**
+ * Record the duration of an operation
+ * 
+ * @param  this    The statistics
+ * @param  timing  The operation
+ * @param  start   The value `stats_clock` returned when
+ *                 the operation started
+ */
+void
+stats_time(struct stats *restrict this, enum timing timing, uint64_t start)
+{
+	uint64_t end = stats_clock();
+	histogram_record(&this->timings[timing], end > start ? end - start : 0);
+}
+
+
+/**
+ * Get the index of the bucket a value belongs to
+ * 
+ * @param   value  The value
+ * @return         The index of the bucket
+ */
+GCC_ONLY(__attribute__((__const__)))
+static size_t
+bucket_index(uint64_t value)
+{
+	unsigned exponent;
+
+	if (value < HISTOGRAM_SUB_BUCKETS)
+		return (size_t)value;
+
+#if defined(__GNUC__)
+	exponent = 63U - (unsigned)__builtin_clzll((unsigned long long int)value);
+#else
+	for (exponent = HISTOGRAM_SUB_BUCKET_BITS; value >> exponent >> 1; exponent++);
+#endif
+
+	return (size_t)(exponent - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS +
+	       (size_t)((value >> (exponent - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+
+/**
+ * Record a value in a histogram
+ * 
+ * @param  this   The histogram
+ * @param  value  The value
+ */
+void
+histogram_record(struct histogram *restrict this, uint64_t value)
+{
+	this->buckets[bucket_index(value)] += 1;
+	this->count += 1;
+	this->sum += value;
+	if (this->max < value)
+		this->max = value;
+}
+
+
+/**
+ * Get the lowest value that is recorded in a bucket
+ * 
+ * @param   bucket  The index of the bucket
+ * @return          The lowest value that belongs to the bucket
+ */
+uint64_t
+histogram_bucket_value(size_t bucket)
+{
+	unsigned exponent;
+	uint64_t mantissa;
+
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+		return (uint64_t)bucket;
+
+	exponent = (unsigned)(bucket / HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BUCKET_BITS - 1;
+	mantissa = (uint64_t)(bucket % HISTOGRAM_SUB_BUCKETS) + HISTOGRAM_SUB_BUCKETS;
+	return mantissa << (exponent - HISTOGRAM_SUB_BUCKET_BITS);
+}
+
+
+/**
+ * Get a percentile of the recorded values in a histogram
+ * 
+ * @param   this      The histogram
+ * @param   fraction  The percentile divided by 100
+ * @return            The highest value that belongs to the bucket in
+ *                    which the percentile lies, but no higher than
+ *                    the greatest recorded value, 0 if no values
+ *                    have been recorded
+ */
+uint64_t
+histogram_percentile(const struct histogram *restrict this, double fraction)
+{
+	uint64_t rank, seen = 0, value;
+	size_t i;
+
+	if (!this->count)
+		return 0;
+
+	rank = (uint64_t)(fraction * (double)this->count + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+		seen += this->buckets[i];
+		if (seen >= rank) {
+			value = histogram_bucket_value(i + 1) - 1;
+			return value < this->max ? value : this->max;
+		}
+	}
+
+	return this->max;
+}
+
+
+/**
+ * Format statistics as human-readable and machine-parsable text,
+ * one line per counter, and two lines per measured operation
+ * 
+ * @param   this  The statistics
+ * @param   buf   Output buffer for the text, `NULL` to
+ *                only measure how large buffer is needed,
+ *                it must have room for a NUL byte after the text
+ * @return        The length of the text
+ */
+size_t
+stats_format(const struct stats *restrict this, char *restrict buf)
+{
+#define PRINT(...)\
+	do {\
+		int m__ = buf ? sprintf(&buf[n], __VA_ARGS__) : snprintf(NULL, 0, __VA_ARGS__);\
+		n += (size_t)(m__ < 0 ? 0 : m__);\
+	} while (0)
+
+	const struct histogram *restrict histogram;
+	size_t i, j, n = 0;
+
+	for (i = 0; i < COUNTER_COUNT; i++)
+		PRINT("%s: %llu\n", counter_names[i], (unsigned long long int)this->counters[i]);
+
+	for (i = 0; i < TIMING_COUNT; i++) {
+		histogram = &this->timings[i];
+		PRINT("%s latency: count %llu, sum %llu, max %llu, p50 %llu, p99 %llu, p99.9 %llu\n",
+		      timing_names[i],
+		      (unsigned long long int)histogram->count,
+		      (unsigned long long int)histogram->sum,
+		      (unsigned long long int)histogram->max,
+		      (unsigned long long int)histogram_percentile(histogram, 0.5),
+		      (unsigned long long int)histogram_percentile(histogram, 0.99),
+		      (unsigned long long int)histogram_percentile(histogram, 0.999));
+		PRINT("%s buckets:", timing_names[i]);
+		for (j = 0; j < HISTOGRAM_BUCKETS; j++)
+			if (histogram->buckets[j])
+				PRINT(" %llu:%llu",
+				      (unsigned long long int)histogram_bucket_value(j),
+				      (unsigned long long int)histogram->buckets[j]);
+		PRINT("\n");
+	}
+
+	return n;
+
+#undef PRINT
+}
@@ -0,0 +1,211 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_STATS_H
+#define TYPES_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+/**
+ * The base-2 logarithm of the number of buckets
+ * each power of two is divided into in a histogram
+ */
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+
+/**
+ * The number of buckets each power of two
+ * is divided into in a histogram
+ */
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+
+/**
+ * The number of buckets in a histogram, enough
+ * to cover all 64-bit values
+ */
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * Lists all counters, will call macro X with
+ * the value of `enum counter` for the counter
+ * as the first argument and the counter's name,
+ * as reported to clients, as the second argument
+ */
+#define LIST_COUNTERS\
+	X(COUNTER_BYTES_RECEIVED,        "Bytes received")\
+	X(COUNTER_BYTES_SENT,            "Bytes sent")\
+	X(COUNTER_DEFERRED_MESSAGES,     "Deferred messages")\
+	X(COUNTER_RECOMPOSITIONS,        "Recompositions")\
+	X(COUNTER_SHARED_COMPOSITIONS,   "Shared compositions")\
+	X(COUNTER_HARDWARE_WRITES,       "Hardware writes")\
+	X(COUNTER_HARDWARE_WRITE_ERRORS, "Hardware write errors")\
+	X(COUNTER_WINDOW_CACHE_HITS,     "Window cache hits")\
+	X(COUNTER_WINDOW_CACHE_MISSES,   "Window cache misses")\
+	X(COUNTER_BUFFER_POOL_HITS,      "Buffer pool hits")\
+	X(COUNTER_BUFFER_POOL_MISSES,    "Buffer pool misses")\
+	X(COUNTER_RAMP_POOL_HITS,        "Ramp pool hits")\
+	X(COUNTER_RAMP_POOL_MISSES,      "Ramp pool misses")
+
+/**
+ * Lists all measured operations, will call macro X
+ * with the value of `enum timing` for the operation
+ * as the first argument and the operation's name,
+ * as reported to clients, as the second argument
+ */
+#define LIST_TIMINGS\
+	X(TIMING_PARSE,          "Parse")\
+	X(TIMING_DISPATCH,       "Dispatch")\
+	X(TIMING_COMPOSITION,    "Composition")\
+	X(TIMING_HARDWARE_WRITE, "Hardware write")
+
+/**
+ * Counters
+ */
+enum counter {
+#define X(C, N) C,
+	LIST_COUNTERS
+#undef X
+
+	/**
+	 * The number of counters
+	 */
+	COUNTER_COUNT
+};
+
+/**
+ * Measured operations
+ */
+enum timing {
+#define X(C, N) C,
+	LIST_TIMINGS
+#undef X
+
+	/**
+	 * The number of measured operations
+	 */
+	TIMING_COUNT
+};
+
+/**
+ * Log-linear histogram of durations, in nanoseconds
+ * 
+ * Values less than `HISTOGRAM_SUB_BUCKETS` have a bucket
+ * each, every following power of two is divided into
+ * `HISTOGRAM_SUB_BUCKETS` equally wide buckets, so the
+ * relative error of any recorded value is bounded by
+ * 1 / `HISTOGRAM_SUB_BUCKETS`
+ */
+struct histogram {
+	/**
+	 * The number of recorded values in each bucket
+	 */
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+
+	/**
+	 * The number of recorded values
+	 */
+	uint64_t count;
+
+	/**
+	 * The sum of all recorded values
+	 */
+	uint64_t sum;
+
+	/**
+	 * The greatest recorded value
+	 */
+	uint64_t max;
+};
+
+/**
+ * Runtime statistics
+ */
+struct stats {
+	/**
+	 * Counters, indexed by `enum counter`
+	 */
+	uint64_t counters[COUNTER_COUNT];
+
+	/**
+	 * Durations of operations, indexed by `enum timing`
+	 */
+	struct histogram timings[TIMING_COUNT];
+};
+
+
+/**
+ * Runtime statistics, collected since the
+ * process started or was last re-executed
+ */
+extern struct stats stats;
+
+
+/**
+ * Read the monotonic clock
+ * 
+ * @return  The current time, in nanoseconds, 0 on error
+ */
+uint64_t stats_clock(void);
+
+/**
+ * Record the duration of an operation
+ * 
+ * @param  this    The statistics
+ * @param  timing  The operation
+ * @param  start   The value `stats_clock` returned when
+ *                 the operation started
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void stats_time(struct stats *restrict this, enum timing timing, uint64_t start);
+
+/**
+ * Record a value in a histogram
+ * 
+ * @param  this   The histogram
+ * @param  value  The value
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void histogram_record(struct histogram *restrict this, uint64_t value);
+
+/**
+ * Get the lowest value that is recorded in a bucket
+ * 
+ * @param   bucket  The index of the bucket
+ * @return          The lowest value that belongs to the bucket
+ */
+GCC_ONLY(__attribute__((__const__)))
+uint64_t histogram_bucket_value(size_t bucket);
+
+/**
+ * Get a percentile of the recorded values in a histogram
+ * 
+ * @param   this      The histogram
+ * @param   fraction  The percentile divided by 100
+ * @return            The highest value that belongs to the bucket in
+ *                    which the percentile lies, but no higher than
+ *                    the greatest recorded value, 0 if no values
+ *                    have been recorded
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+uint64_t histogram_percentile(const struct histogram *restrict this, double fraction);
+
+/**
+ * Format statistics as human-readable and machine-parsable text,
+ * one line per counter, and two lines per measured operation
+ * 
+ * @param   this  The statistics
+ * @param   buf   Output buffer for the text, `NULL` to
+ *                only measure how large buffer is needed,
+ *                it must have room for a NUL byte after the text
+ * @return        The length of the text
+ */
+GCC_ONLY(__attribute__((__nonnull__(1))))
+size_t stats_format(const struct stats *restrict this, char *restrict buf);
+
+#endif
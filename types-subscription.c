@@ -0,0 +1,226 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-subscription.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * The names of the events,
+ * indexed by `enum event`
+ */
+static const char *const event_names[] = {
+#define X(C, N) N,
+	LIST_EVENTS
+#undef X
+};
+
+
+/**
+ * Initialise a subscription, as not subscribed
+ * 
+ * @param  this  The subscription
+ */
+void
+subscription_initialise(struct subscription *restrict this)
+{
+	this->events = 0;
+	this->coalesced = 0;
+	this->crtc = NULL;
+}
+
+
+/**
+ * Release all resources allocated to a subscription,
+ * the subscription will be unsubscribed afterwards
+ * 
+ * @param  this  The subscription
+ */
+void
+subscription_destroy(struct subscription *restrict this)
+{
+	free(this->crtc);
+	subscription_initialise(this);
+}
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-align"
+#endif
+
+
+/**
+ * Marshal a subscription
+ * 
+ * @param   this  The subscription
+ * @param   buf   Output buffer for the marshalled subscription,
+ *                `NULL` just measure how large the buffers
+ *                needs to be
+ * @return        The number of marshalled byte
+ */
+size_t
+subscription_marshal(const struct subscription *restrict this, void *restrict buf)
+{
+	size_t off = 0, n;
+	char *restrict bs = buf;
+
+	if (bs)
+		*(unsigned *)&bs[off] = this->events;
+	off += sizeof(unsigned);
+
+	if (bs)
+		*(unsigned *)&bs[off] = this->coalesced;
+	off += sizeof(unsigned);
+
+	if (bs)
+		bs[off] = this->crtc != NULL;
+	off += 1;
+
+	if (this->crtc) {
+		n = strlen(this->crtc) + 1;
+		if (bs)
+			memcpy(&bs[off], this->crtc, n);
+		off += n;
+	}
+
+	return off;
+}
+
+
+/**
+ * Unmarshal a subscription
+ * 
+ * @param   this  Output for the subscription
+ * @param   buf   Buffer with the marshalled subscription
+ * @return        The number of unmarshalled bytes, 0 on error
+ */
+size_t
+subscription_unmarshal(struct subscription *restrict this, const void *restrict buf)
+{
+	size_t off = 0, n;
+	const char *restrict bs = buf;
+
+	this->crtc = NULL;
+
+	this->events = *(const unsigned *)&bs[off];
+	off += sizeof(unsigned);
+
+	this->coalesced = *(const unsigned *)&bs[off];
+	off += sizeof(unsigned);
+
+	if (bs[off++]) {
+		n = strlen(&bs[off]) + 1;
+		if (!(this->crtc = memdup(&bs[off], n)))
+			return 0;
+		off += n;
+	}
+
+	return off;
+}
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic pop
+#endif
+
+
+/**
+ * Check whether a subscription covers an event on a CRTC
+ * 
+ * @param   this   The subscription
+ * @param   event  The event
+ * @param   crtc   The name of the CRTC
+ * @return         1 if the event shall be reported, 0 otherwise
+ */
+int
+subscription_covers(const struct subscription *restrict this, enum event event, const char *restrict crtc)
+{
+	if (!(this->events & EVENT_BIT(event)))
+		return 0;
+	return !this->crtc || !strcmp(this->crtc, crtc);
+}
+
+
+/**
+ * Parse a space-separated list of event names
+ * 
+ * @param   list  The list, "none" for the empty list
+ * @param   mask  Output parameter for the events, as a
+ *                mask of `EVENT_BIT` values
+ * @return        Zero on success, -1 if an event is not recognised
+ */
+int
+events_parse(const char *restrict list, unsigned *restrict mask)
+{
+	size_t len;
+	int i;
+
+	*mask = 0;
+	if (!strcmp(list, "none"))
+		return 0;
+
+	for (;;) {
+		while (*list == ' ')
+			list++;
+		if (!*list)
+			return 0;
+		len = strcspn(list, " ");
+		for (i = 0; i < EVENT_COUNT; i++)
+			if (strlen(event_names[i]) == len && !memcmp(list, event_names[i], len))
+				break;
+		if (i == EVENT_COUNT)
+			return -1;
+		*mask |= EVENT_BIT(i);
+		list += len;
+	}
+}
+
+
+/**
+ * Format a mask of events as a space-separated list of event names
+ * 
+ * @param   mask  The events, as a mask of `EVENT_BIT` values
+ * @param   buf   Output buffer for the list, `NULL` to
+ *                only measure how large buffer is needed,
+ *                it must have room for a NUL byte after the list
+ * @return        The length of the list
+ */
+size_t
+events_format(unsigned mask, char *restrict buf)
+{
+	size_t n = 0, len;
+	int i;
+
+	for (i = 0; i < EVENT_COUNT; i++) {
+		if (!(mask & EVENT_BIT(i)))
+			continue;
+		if (n) {
+			if (buf)
+				buf[n] = ' ';
+			n += 1;
+		}
+		len = strlen(event_names[i]);
+		if (buf)
+			memcpy(&buf[n], event_names[i], len);
+		n += len;
+	}
+
+	if (buf)
+		buf[n] = '\0';
+	return n;
+}
+
+
+/**
+ * Get the name of an event
+ * 
+ * @param   event  The event
+ * @return         The name of the event
+ */
+const char *
+event_name(enum event event)
+{
+	return event_names[event];
+}
@@ -0,0 +1,156 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_SUBSCRIPTION_H
+#define TYPES_SUBSCRIPTION_H
+
+#include <stddef.h>
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+/**
+ * Lists all events clients can subscribe to, will
+ * call macro X with the value of `enum event` for
+ * the event as the first argument and the event's
+ * name, as used in the protocol, as the second argument
+ */
+#define LIST_EVENTS\
+	X(EVENT_FILTER_ADDED,      "filter-added")\
+	X(EVENT_FILTER_REMOVED,    "filter-removed")\
+	X(EVENT_FILTER_UPDATED,    "filter-updated")\
+	X(EVENT_OUTPUT_HOTPLUGGED, "output-hotplugged")\
+	X(EVENT_WRITE_FAILED,      "write-failed")
+
+/**
+ * Get the bit that represents an event in an event mask
+ * 
+ * @param   event  The event, an `enum event`
+ * @return         The bit for the event
+ */
+#define EVENT_BIT(event) (1U << (event))
+
+/**
+ * Events clients can subscribe to
+ */
+enum event {
+#define X(C, N) C,
+	LIST_EVENTS
+#undef X
+
+	/**
+	 * The number of events
+	 */
+	EVENT_COUNT
+};
+
+/**
+ * A connection's subscription to events
+ */
+struct subscription {
+	/**
+	 * The events subscribed to, as a mask of
+	 * `EVENT_BIT` values, 0 if not subscribed
+	 */
+	unsigned events;
+
+	/**
+	 * Events that occurred while the client was lagging
+	 * and have not yet been reported to it, as a mask of
+	 * `EVENT_BIT` values
+	 */
+	unsigned coalesced;
+
+	/**
+	 * The name of the only CRTC for which events are
+	 * reported, `NULL` if events are reported for all CRTC:s
+	 */
+	char *restrict crtc;
+};
+
+
+/**
+ * Initialise a subscription, as not subscribed
+ * 
+ * @param  this  The subscription
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void subscription_initialise(struct subscription *restrict this);
+
+/**
+ * Release all resources allocated to a subscription,
+ * the subscription will be unsubscribed afterwards
+ * 
+ * @param  this  The subscription
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void subscription_destroy(struct subscription *restrict this);
+
+/**
+ * Marshal a subscription
+ * 
+ * @param   this  The subscription
+ * @param   buf   Output buffer for the marshalled subscription,
+ *                `NULL` just measure how large the buffers
+ *                needs to be
+ * @return        The number of marshalled byte
+ */
+GCC_ONLY(__attribute__((__nonnull__(1))))
+size_t subscription_marshal(const struct subscription *restrict this, void *restrict buf);
+
+/**
+ * Unmarshal a subscription
+ * 
+ * @param   this  Output for the subscription
+ * @param   buf   Buffer with the marshalled subscription
+ * @return        The number of unmarshalled bytes, 0 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+size_t subscription_unmarshal(struct subscription *restrict this, const void *restrict buf);
+
+/**
+ * Check whether a subscription covers an event on a CRTC
+ * 
+ * @param   this   The subscription
+ * @param   event  The event
+ * @param   crtc   The name of the CRTC
+ * @return         1 if the event shall be reported, 0 otherwise
+ */
+GCC_ONLY(__attribute__((__pure__, __nonnull__)))
+int subscription_covers(const struct subscription *restrict this, enum event event, const char *restrict crtc);
+
+/**
+ * Parse a space-separated list of event names
+ * 
+ * @param   list  The list, "none" for the empty list
+ * @param   mask  Output parameter for the events, as a
+ *                mask of `EVENT_BIT` values
+ * @return        Zero on success, -1 if an event is not recognised
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int events_parse(const char *restrict list, unsigned *restrict mask);
+
+/**
+ * Format a mask of events as a space-separated list of event names
+ * 
+ * @param   mask  The events, as a mask of `EVENT_BIT` values
+ * @param   buf   Output buffer for the list, `NULL` to
+ *                only measure how large buffer is needed,
+ *                it must have room for a NUL byte after the list
+ * @return        The length of the list
+ */
+size_t events_format(unsigned mask, char *restrict buf);
+
+/**
+ * Get the name of an event
+ * 
+ * @param   event  The event
+ * @return         The name of the event
+ */
+GCC_ONLY(__attribute__((__const__, __returns_nonnull__)))
+const char *event_name(enum event event);
+
+#endif
@@ -0,0 +1,216 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-transaction.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * Initialise a transaction, as not begun
+ * 
+ * @param  this  The transaction
+ */
+void
+transaction_initialise(struct transaction *restrict this)
+{
+	this->open = 0;
+	this->filters = NULL;
+	this->n = 0;
+	this->alloc = 0;
+}
+
+
+/**
+ * Release all resources allocated to a transaction, staged
+ * changes are discarded and the transaction will not be begun
+ * 
+ * @param  this  The transaction
+ */
+void
+transaction_destroy(struct transaction *restrict this)
+{
+	size_t i;
+
+	for (i = 0; i < this->n; i++) {
+		free(this->filters[i].crtc);
+		filter_destroy(&this->filters[i].filter);
+	}
+	free(this->filters);
+	transaction_initialise(this);
+}
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-align"
+#endif
+
+
+/**
+ * Marshal a transaction
+ * 
+ * @param   this  The transaction
+ * @param   buf   Output buffer for the marshalled transaction,
+ *                `NULL` just measure how large the buffers
+ *                needs to be
+ * @return        The number of marshalled byte
+ */
+size_t
+transaction_marshal(const struct transaction *restrict this, void *restrict buf)
+{
+	size_t off = 0, i, n;
+	char *restrict bs = buf;
+
+	if (bs)
+		*(int *)&bs[off] = this->open;
+	off += sizeof(int);
+
+	if (bs)
+		*(size_t *)&bs[off] = this->n;
+	off += sizeof(size_t);
+
+	for (i = 0; i < this->n; i++) {
+		if (bs)
+			*(size_t *)&bs[off] = this->filters[i].ramps_size;
+		off += sizeof(size_t);
+
+		if (bs)
+			*(signed *)&bs[off] = this->filters[i].depth;
+		off += sizeof(signed);
+
+		if (bs)
+			*(size_t *)&bs[off] = this->filters[i].red_size;
+		off += sizeof(size_t);
+
+		if (bs)
+			*(size_t *)&bs[off] = this->filters[i].green_size;
+		off += sizeof(size_t);
+
+		if (bs)
+			*(size_t *)&bs[off] = this->filters[i].blue_size;
+		off += sizeof(size_t);
+
+		n = strlen(this->filters[i].crtc) + 1;
+		if (bs)
+			memcpy(&bs[off], this->filters[i].crtc, n);
+		off += n;
+
+		off += filter_marshal(&this->filters[i].filter, bs ? &bs[off] : NULL, this->filters[i].ramps_size);
+	}
+
+	return off;
+}
+
+
+/**
+ * Unmarshal a transaction
+ * 
+ * @param   this  Output for the transaction
+ * @param   buf   Buffer with the marshalled transaction
+ * @return        The number of unmarshalled bytes, 0 on error
+ */
+size_t
+transaction_unmarshal(struct transaction *restrict this, const void *restrict buf)
+{
+	size_t off = 0, n;
+	const char *restrict bs = buf;
+	struct staged_filter *restrict staged;
+
+	transaction_initialise(this);
+
+	this->open = *(const int *)&bs[off];
+	off += sizeof(int);
+
+	this->alloc = *(const size_t *)&bs[off];
+	off += sizeof(size_t);
+
+	if (this->alloc > 0) {
+		this->filters = calloc(this->alloc, sizeof(*this->filters));
+		if (!this->filters)
+			return 0;
+	}
+
+	for (; this->n < this->alloc; this->n++) {
+		staged = &this->filters[this->n];
+
+		staged->ramps_size = *(const size_t *)&bs[off];
+		off += sizeof(size_t);
+
+		staged->depth = *(const signed *)&bs[off];
+		off += sizeof(signed);
+
+		staged->red_size = *(const size_t *)&bs[off];
+		off += sizeof(size_t);
+
+		staged->green_size = *(const size_t *)&bs[off];
+		off += sizeof(size_t);
+
+		staged->blue_size = *(const size_t *)&bs[off];
+		off += sizeof(size_t);
+
+		n = strlen(&bs[off]) + 1;
+		if (!(staged->crtc = memdup(&bs[off], n)))
+			return 0;
+		off += n;
+
+		off += n = filter_unmarshal(&staged->filter, &bs[off], staged->ramps_size);
+		if (!n) {
+			free(staged->crtc);
+			return 0;
+		}
+	}
+
+	return off;
+}
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic pop
+#endif
+
+
+/**
+ * Stage a filter change in a transaction
+ * 
+ * @param   this    The transaction
+ * @param   output  The output the change applies to
+ * @param   filter  The filter, the ownership of its class and
+ *                  ramps is transferred to this function
+ * @return          Zero on success, -1 on error
+ */
+int
+transaction_stage(struct transaction *restrict this, const struct output *restrict output,
+                  struct filter *restrict filter)
+{
+	struct staged_filter *new, *staged;
+	size_t alloc;
+	int saved_errno;
+
+	if (this->n == this->alloc) {
+		alloc = this->alloc ? 2 * this->alloc : 4;
+		new = realloc(this->filters, alloc * sizeof(*this->filters));
+		if (!new)
+			goto fail;
+		this->filters = new;
+		this->alloc = alloc;
+	}
+
+	staged = &this->filters[this->n];
+	staged->crtc = memdup(output->name, strlen(output->name) + 1);
+	if (!staged->crtc)
+		goto fail;
+	staged->filter = *filter;
+	staged->ramps_size = filter->ramps ? output->ramps_size : 0;
+	staged->depth = output->depth;
+	COPY_RAMP_SIZES(staged, output);
+	this->n += 1;
+	return 0;
+
+fail:
+	saved_errno = errno;
+	filter_destroy(filter);
+	errno = saved_errno;
+	return -1;
+}
@@ -0,0 +1,149 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_TRANSACTION_H
+#define TYPES_TRANSACTION_H
+
+#include "types-output.h"
+
+#include <stddef.h>
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+/**
+ * The maximum number of filter changes that
+ * may be staged in a transaction
+ */
+#define TRANSACTION_STAGED_MAX 1024
+
+/**
+ * A filter change that has been staged in a transaction
+ */
+struct staged_filter {
+	/**
+	 * The name of the output the change applies to
+	 */
+	char *restrict crtc;
+
+	/**
+	 * The filter, as it shall be passed to `add_filter`
+	 */
+	struct filter filter;
+
+	/**
+	 * The byte-size of `.filter.ramps`
+	 */
+	size_t ramps_size;
+
+	/**
+	 * The gamma ramp depth of the output when the
+	 * change was staged, the transaction cannot be
+	 * committed if the output's gamma ramp layout
+	 * has changed since
+	 */
+	signed depth;
+
+	/**
+	 * The number of stops in the red gamma ramp
+	 * of the output when the change was staged
+	 */
+	size_t red_size;
+
+	/**
+	 * The number of stops in the green gamma ramp
+	 * of the output when the change was staged
+	 */
+	size_t green_size;
+
+	/**
+	 * The number of stops in the blue gamma ramp
+	 * of the output when the change was staged
+	 */
+	size_t blue_size;
+};
+
+/**
+ * A connection's transaction, the filter changes
+ * the connection has requested since ‘Command: begin’,
+ * which are applied together on ‘Command: commit’
+ */
+struct transaction {
+	/**
+	 * Whether a transaction has been begun
+	 */
+	int open;
+
+	/**
+	 * The staged changes, in the order they were requested
+	 */
+	struct staged_filter *restrict filters;
+
+	/**
+	 * The number of elements in `.filters`
+	 */
+	size_t n;
+
+	/**
+	 * The number of elements allocated to `.filters`
+	 */
+	size_t alloc;
+};
+
+
+/**
+ * Initialise a transaction, as not begun
+ * 
+ * @param  this  The transaction
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void transaction_initialise(struct transaction *restrict this);
+
+/**
+ * Release all resources allocated to a transaction, staged
+ * changes are discarded and the transaction will not be begun
+ * 
+ * @param  this  The transaction
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void transaction_destroy(struct transaction *restrict this);
+
+/**
+ * Marshal a transaction
+ * 
+ * @param   this  The transaction
+ * @param   buf   Output buffer for the marshalled transaction,
+ *                `NULL` just measure how large the buffers
+ *                needs to be
+ * @return        The number of marshalled byte
+ */
+GCC_ONLY(__attribute__((__nonnull__(1))))
+size_t transaction_marshal(const struct transaction *restrict this, void *restrict buf);
+
+/**
+ * Unmarshal a transaction
+ * 
+ * @param   this  Output for the transaction
+ * @param   buf   Buffer with the marshalled transaction
+ * @return        The number of unmarshalled bytes, 0 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+size_t transaction_unmarshal(struct transaction *restrict this, const void *restrict buf);
+
+/**
+ * Stage a filter change in a transaction
+ * 
+ * @param   this    The transaction
+ * @param   output  The output the change applies to
+ * @param   filter  The filter, the ownership of its class and
+ *                  ramps is transferred to this function
+ * @return          Zero on success, -1 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int transaction_stage(struct transaction *restrict this, const struct output *restrict output,
+                      struct filter *restrict filter);
+
+#endif
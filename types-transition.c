@@ -0,0 +1,301 @@
+/* See LICENSE file for copyright and license details. */
+#include "types-transition.h"
+#include "types-class.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * The names of the easing curves,
+ * indexed by `enum easing`
+ */
+static const char *const easing_names[] = {
+#define X(C, N) N,
+	LIST_EASINGS
+#undef X
+};
+
+
+/**
+ * Release all resources allocated to a transition
+ * 
+ * @param  this  The transition
+ */
+void
+transition_destroy(struct transition *restrict this)
+{
+	free(this->crtc);
+	class_release(this->class);
+	free(this->start);
+	free(this->target);
+	this->crtc = NULL;
+	this->class = NULL;
+	this->start = NULL;
+	this->target = NULL;
+}
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wcast-align"
+#endif
+
+
+/**
+ * Marshal a transition
+ * 
+ * @param   this  The transition
+ * @param   buf   Output buffer for the marshalled transition,
+ *                `NULL` just measure how large the buffers
+ *                needs to be
+ * @return        The number of marshalled byte
+ */
+size_t
+transition_marshal(const struct transition *restrict this, void *restrict buf)
+{
+	size_t off = 0, n;
+	char *restrict bs = buf;
+
+	if (bs)
+		*(size_t *)&bs[off] = this->ramps_size;
+	off += sizeof(size_t);
+
+	if (bs)
+		*(signed *)&bs[off] = this->depth;
+	off += sizeof(signed);
+
+	if (bs)
+		*(uint64_t *)&bs[off] = this->begin;
+	off += sizeof(uint64_t);
+
+	if (bs)
+		*(uint64_t *)&bs[off] = this->duration;
+	off += sizeof(uint64_t);
+
+	if (bs)
+		*(enum easing *)&bs[off] = this->easing;
+	off += sizeof(enum easing);
+
+	n = strlen(this->crtc) + 1;
+	if (bs)
+		memcpy(&bs[off], this->crtc, n);
+	off += n;
+
+	n = strlen(this->class) + 1;
+	if (bs)
+		memcpy(&bs[off], this->class, n);
+	off += n;
+
+	if (bs)
+		memcpy(&bs[off], this->start, this->ramps_size);
+	off += this->ramps_size;
+
+	if (bs)
+		memcpy(&bs[off], this->target, this->ramps_size);
+	off += this->ramps_size;
+
+	return off;
+}
+
+
+/**
+ * Unmarshal a transition
+ * 
+ * @param   this  Output for the transition
+ * @param   buf   Buffer with the marshalled transition
+ * @return        The number of unmarshalled bytes, 0 on error
+ */
+size_t
+transition_unmarshal(struct transition *restrict this, const void *restrict buf)
+{
+	size_t off = 0, n;
+	const char *restrict bs = buf;
+
+	this->crtc = NULL;
+	this->class = NULL;
+	this->start = NULL;
+	this->target = NULL;
+
+	this->ramps_size = *(const size_t *)&bs[off];
+	off += sizeof(size_t);
+
+	this->depth = *(const signed *)&bs[off];
+	off += sizeof(signed);
+
+	this->begin = *(const uint64_t *)&bs[off];
+	off += sizeof(uint64_t);
+
+	this->duration = *(const uint64_t *)&bs[off];
+	off += sizeof(uint64_t);
+
+	this->easing = *(const enum easing *)&bs[off];
+	off += sizeof(enum easing);
+
+	n = strlen(&bs[off]) + 1;
+	if (!(this->crtc = memdup(&bs[off], n)))
+		goto fail;
+	off += n;
+
+	if (!(this->class = class_intern(&bs[off])))
+		goto fail;
+	off += strlen(&bs[off]) + 1;
+
+	if (!(this->start = memdup(&bs[off], this->ramps_size)))
+		goto fail;
+	off += this->ramps_size;
+
+	if (!(this->target = memdup(&bs[off], this->ramps_size)))
+		goto fail;
+	off += this->ramps_size;
+
+	return off;
+
+fail:
+	transition_destroy(this);
+	return 0;
+}
+
+
+#if defined(__clang__)
+# pragma GCC diagnostic pop
+#endif
+
+
+/**
+ * Get how far a transition has come
+ * 
+ * @param   this  The transition
+ * @param   now   The current time, as returned by `stats_clock`
+ * @return        The eased progress, 0 at the beginning
+ *                of the transition, and 1 at its end
+ */
+double
+transition_progress(const struct transition *restrict this, uint64_t now)
+{
+	double t;
+
+	if (now < this->begin)
+		return 0;
+	if (now - this->begin >= this->duration)
+		return 1;
+	t = (double)(now - this->begin) / (double)this->duration;
+
+	switch (this->easing) {
+	case EASING_EASE_IN:
+		return t * t;
+	case EASING_EASE_OUT:
+		return t * (2 - t);
+	case EASING_EASE_IN_OUT:
+		return t * t * (3 - 2 * t);
+	case EASING_LINEAR:
+	default:
+		return t;
+	}
+}
+
+
+/**
+ * Interpolate between ramps with integral stops
+ * 
+ * The distance is scaled rather than the end points, so that
+ * the result can neither overshoot the target nor overflow
+ * 
+ * @param  TYPE  The type of the stops
+ */
+#define INTERPOLATE_INTEGRAL(TYPE)\
+	do {\
+		const TYPE *restrict s = this->start;\
+		const TYPE *restrict g = this->target;\
+		TYPE *restrict out = ramps, diff;\
+		double d;\
+		for (i = 0; i < n; i++) {\
+			diff = g[i] >= s[i] ? (TYPE)(g[i] - s[i]) : (TYPE)(s[i] - g[i]);\
+			d = (double)diff * progress;\
+			diff = d >= (double)diff ? diff : (TYPE)d;\
+			out[i] = g[i] >= s[i] ? (TYPE)(s[i] + diff) : (TYPE)(s[i] - diff);\
+		}\
+	} while (0)
+
+
+/**
+ * Interpolate between ramps with floating-point stops
+ * 
+ * @param  TYPE  The type of the stops
+ */
+#define INTERPOLATE_FLOATING(TYPE)\
+	do {\
+		const TYPE *restrict s = this->start;\
+		const TYPE *restrict g = this->target;\
+		TYPE *restrict out = ramps;\
+		for (i = 0; i < n; i++)\
+			out[i] = (TYPE)(s[i] + (g[i] - s[i]) * (TYPE)progress);\
+	} while (0)
+
+
+/**
+ * Interpolate between the start and the target of a transition
+ * 
+ * @param  this      The transition
+ * @param  progress  The eased progress, as returned by
+ *                   `transition_progress`, less than 1
+ * @param  ramps     Output buffer for the ramps, `this->ramps_size` bytes
+ */
+void
+transition_interpolate(const struct transition *restrict this, double progress, void *restrict ramps)
+{
+	size_t i, n;
+
+	switch (this->depth) {
+	case 8:
+		n = this->ramps_size / sizeof(uint8_t);
+		INTERPOLATE_INTEGRAL(uint8_t);
+		break;
+	case 16:
+		n = this->ramps_size / sizeof(uint16_t);
+		INTERPOLATE_INTEGRAL(uint16_t);
+		break;
+	case 32:
+		n = this->ramps_size / sizeof(uint32_t);
+		INTERPOLATE_INTEGRAL(uint32_t);
+		break;
+	case 64:
+		n = this->ramps_size / sizeof(uint64_t);
+		INTERPOLATE_INTEGRAL(uint64_t);
+		break;
+	case -1:
+		n = this->ramps_size / sizeof(float);
+		INTERPOLATE_FLOATING(float);
+		break;
+	case -2:
+		n = this->ramps_size / sizeof(double);
+		INTERPOLATE_FLOATING(double);
+		break;
+	default:
+		abort();
+	}
+}
+
+
+/**
+ * Parse the name of an easing curve
+ * 
+ * @param   name    The name of the easing curve
+ * @param   easing  Output parameter for the easing curve
+ * @return          Zero on success, -1 if the curve is not recognised
+ */
+int
+easing_parse(const char *restrict name, enum easing *restrict easing)
+{
+	int i;
+
+	for (i = 0; i < EASING_COUNT; i++) {
+		if (!strcmp(name, easing_names[i])) {
+			*easing = (enum easing)i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
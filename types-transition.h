@@ -0,0 +1,161 @@
+/* See LICENSE file for copyright and license details. */
+#ifndef TYPES_TRANSITION_H
+#define TYPES_TRANSITION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef GCC_ONLY
+# if defined(__GNUC__) && !defined(__clang__)
+#  define GCC_ONLY(...) __VA_ARGS__
+# else
+#  define GCC_ONLY(...) /* nothing */
+# endif
+#endif
+
+/**
+ * Lists all easing curves for transitions, will
+ * call macro X with the value of `enum easing` for
+ * the curve as the first argument and the curve's
+ * name, as used in the protocol, as the second argument
+ */
+#define LIST_EASINGS\
+	X(EASING_LINEAR,      "linear")\
+	X(EASING_EASE_IN,     "ease-in")\
+	X(EASING_EASE_OUT,    "ease-out")\
+	X(EASING_EASE_IN_OUT, "ease-in-out")
+
+/**
+ * Easing curves for transitions
+ */
+enum easing {
+#define X(C, N) C,
+	LIST_EASINGS
+#undef X
+
+	/**
+	 * The number of easing curves
+	 */
+	EASING_COUNT
+};
+
+/**
+ * A filter that is being faded from one
+ * set of ramps to another by the server
+ */
+struct transition {
+	/**
+	 * The name of the output the filter is applied to
+	 */
+	char *restrict crtc;
+
+	/**
+	 * The class of the filter, interned with `class_intern`
+	 */
+	char *restrict class;
+
+	/**
+	 * The ramps the filter had when the transition began
+	 */
+	void *restrict start;
+
+	/**
+	 * The ramps the filter shall have when the transition ends
+	 */
+	void *restrict target;
+
+	/**
+	 * The byte-size of `.start` and `.target`, the
+	 * transition is abandoned if the output no
+	 * longer has this size
+	 */
+	size_t ramps_size;
+
+	/**
+	 * The depth of `.start` and `.target`, see
+	 * `struct output.depth`, the transition is
+	 * abandoned if the output no longer has
+	 * this depth
+	 */
+	signed depth;
+
+	/**
+	 * When the transition began, as returned by `stats_clock`
+	 */
+	uint64_t begin;
+
+	/**
+	 * The duration of the transition, in nanoseconds
+	 */
+	uint64_t duration;
+
+	/**
+	 * The easing curve
+	 */
+	enum easing easing;
+};
+
+
+/**
+ * Release all resources allocated to a transition
+ * 
+ * @param  this  The transition
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void transition_destroy(struct transition *restrict this);
+
+/**
+ * Marshal a transition
+ * 
+ * @param   this  The transition
+ * @param   buf   Output buffer for the marshalled transition,
+ *                `NULL` just measure how large the buffers
+ *                needs to be
+ * @return        The number of marshalled byte
+ */
+GCC_ONLY(__attribute__((__nonnull__(1))))
+size_t transition_marshal(const struct transition *restrict this, void *restrict buf);
+
+/**
+ * Unmarshal a transition
+ * 
+ * @param   this  Output for the transition
+ * @param   buf   Buffer with the marshalled transition
+ * @return        The number of unmarshalled bytes, 0 on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+size_t transition_unmarshal(struct transition *restrict this, const void *restrict buf);
+
+/**
+ * Get how far a transition has come
+ * 
+ * @param   this  The transition
+ * @param   now   The current time, as returned by `stats_clock`
+ * @return        The eased progress, 0 at the beginning
+ *                of the transition, and 1 at its end
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+double transition_progress(const struct transition *restrict this, uint64_t now);
+
+/**
+ * Interpolate between the start and the target of a transition
+ * 
+ * @param  this      The transition
+ * @param  progress  The eased progress, as returned by
+ *                   `transition_progress`, less than 1
+ * @param  ramps     Output buffer for the ramps, `this->ramps_size` bytes
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+void transition_interpolate(const struct transition *restrict this, double progress, void *restrict ramps);
+
+/**
+ * Parse the name of an easing curve
+ * 
+ * @param   name    The name of the easing curve
+ * @param   easing  Output parameter for the easing curve
+ * @return          Zero on success, -1 if the curve is not recognised
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+int easing_parse(const char *restrict name, enum easing *restrict easing);
+
+#endif
@@ -12,6 +12,39 @@
 #include <unistd.h>
 
 
+/**
+ * Identity mapping ramps shared by all
+ * outputs with the same gamma ramp layout
+ */
+struct plain_ramps {
+	/**
+	 * The next ramps in `plain_ramps_list`
+	 */
+	struct plain_ramps *next;
+
+	/**
+	 * The number of outputs using the ramps
+	 */
+	size_t refs;
+
+	/**
+	 * The depth of the ramps, see `struct output.depth`
+	 */
+	signed depth;
+
+	/**
+	 * The ramps
+	 */
+	union gamma_ramps ramps;
+};
+
+
+/**
+ * All shared identity mapping ramps
+ */
+static struct plain_ramps *plain_ramps_list = NULL;
+
+
 /**
  * Duplicate a memory segment
  * 
@@ -272,3 +305,68 @@ make_plain_ramps(union gamma_ramps *restrict ramps, struct output *restrict outp
 	}
 	return 0;
 }
+
+
+/**
+ * Get identity mapping ramps for an output, they are built
+ * once for each gamma ramp layout and shared, read-only,
+ * by all outputs with that layout
+ * 
+ * @param   output  The output
+ * @return          The ramps, they must not be modified,
+ *                  `NULL` on error
+ */
+const union gamma_ramps *
+get_plain_ramps(struct output *restrict output)
+{
+	struct plain_ramps *plain = output->plain;
+
+	if (plain)
+		return &plain->ramps;
+
+	for (plain = plain_ramps_list; plain; plain = plain->next)
+		if (plain->depth                 == output->depth      &&
+		    plain->ramps.u8.red_size   == output->red_size   &&
+		    plain->ramps.u8.green_size == output->green_size &&
+		    plain->ramps.u8.blue_size  == output->blue_size)
+			break;
+
+	if (!plain) {
+		plain = malloc(sizeof(*plain));
+		if (!plain)
+			return NULL;
+		if (make_plain_ramps(&plain->ramps, output) < 0) {
+			free(plain);
+			return NULL;
+		}
+		plain->depth = output->depth;
+		plain->refs = 0;
+		plain->next = plain_ramps_list;
+		plain_ramps_list = plain;
+	}
+
+	plain->refs += 1;
+	output->plain = plain;
+	return &plain->ramps;
+}
+
+
+/**
+ * Release an output's reference to shared
+ * identity mapping ramps
+ * 
+ * @param  plain  The output's `.plain`, may be `NULL`
+ */
+void
+release_plain_ramps(struct plain_ramps *restrict plain)
+{
+	struct plain_ramps **p;
+
+	if (!plain || --plain->refs)
+		return;
+
+	for (p = &plain_ramps_list; *p != plain; p = &(*p)->next);
+	*p = plain->next;
+	libgamma_gamma_ramps8_destroy(&plain->ramps.u8);
+	free(plain);
+}
@@ -78,4 +78,24 @@ int verify_utf8(const char *restrict string);
 GCC_ONLY(__attribute__((__nonnull__)))
 int make_plain_ramps(union gamma_ramps *restrict ramps, struct output *restrict output);
 
+/**
+ * Get identity mapping ramps for an output, they are built
+ * once for each gamma ramp layout and shared, read-only,
+ * by all outputs with that layout
+ * 
+ * @param   output  The output
+ * @return          The ramps, they must not be modified,
+ *                  `NULL` on error
+ */
+GCC_ONLY(__attribute__((__nonnull__)))
+const union gamma_ramps *get_plain_ramps(struct output *restrict output);
+
+/**
+ * Release an output's reference to shared
+ * identity mapping ramps
+ * 
+ * @param  plain  The output's `.plain`, may be `NULL`
+ */
+void release_plain_ramps(struct plain_ramps *restrict plain);
+
 #endif